@@ -51,7 +51,6 @@ echo ""
 echo "✓ Build Successful"
 echo "Run the compiler with: ./build/neko <source-file>"
 echo ""
-echo "To assemble and link the output:"
-echo "  nasm -f elf64 output.asm -o output.o"
-echo "  gcc -no-pie output.o -o output"
+echo "The compiler writes an object file, build/output.o by default. To link and run it:"
+echo "  ld output.o -o output"
 echo "  ./output"
@@ -0,0 +1,265 @@
+#include "assembly.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+
+namespace codegen {
+
+namespace {
+
+std::string trim(const std::string& text)
+{
+    size_t begin = text.find_first_not_of(' ');
+    if (begin == std::string::npos)
+        return {};
+    return text.substr(begin, text.find_last_not_of(' ') - begin + 1);
+}
+
+// the 64-, 32- and 8-bit names of each general-purpose register
+const std::array<std::array<const char*, 3>, 16> register_names = {{
+    {"rax", "eax", "al"},
+    {"rbx", "ebx", "bl"},
+    {"rcx", "ecx", "cl"},
+    {"rdx", "edx", "dl"},
+    {"rsi", "esi", "sil"},
+    {"rdi", "edi", "dil"},
+    {"rbp", "ebp", "bpl"},
+    {"rsp", "esp", "spl"},
+    {"r8", "r8d", "r8b"},
+    {"r9", "r9d", "r9b"},
+    {"r10", "r10d", "r10b"},
+    {"r11", "r11d", "r11b"},
+    {"r12", "r12d", "r12b"},
+    {"r13", "r13d", "r13b"},
+    {"r14", "r14d", "r14b"},
+    {"r15", "r15d", "r15b"},
+}};
+
+} // namespace
+
+Line parse_line(const std::string& text)
+{
+    Line line;
+    line.text = text;
+    if (!text.empty() && text.back() == ':' && text.front() != ' ')
+    {
+        line.is_label = true;
+        line.text = text.substr(0, text.size() - 1);
+        return line;
+    }
+    std::string body = trim(text);
+    if (body.empty() || text.front() != ' ')
+        return line;
+
+    line.is_instruction = true;
+    size_t space = body.find(' ');
+    line.mnemonic = body.substr(0, space);
+    if (space == std::string::npos)
+        return line;
+    std::string rest = body.substr(space + 1);
+    for (size_t start = 0;;)
+    {
+        size_t comma = rest.find(',', start);
+        line.operands.push_back(trim(rest.substr(start, comma - start)));
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+    return line;
+}
+
+std::string format_line(const Line& line)
+{
+    if (line.is_label)
+        return line.text + ":";
+    if (!line.is_instruction)
+        return line.text;
+    std::string text = "    " + line.mnemonic;
+    for (size_t k = 0; k < line.operands.size(); ++k)
+    {
+        text += (k == 0 ? " " : ", ") + line.operands[k];
+    }
+    return text;
+}
+
+std::string full_register(const std::string& name)
+{
+    for (const auto& names : register_names)
+    {
+        if (std::find(names.begin(), names.end(), name) != names.end())
+            return names[0];
+    }
+    return {};
+}
+
+std::string low_dword(const std::string& reg)
+{
+    for (const auto& names : register_names)
+    {
+        if (names[0] == reg)
+            return names[1];
+    }
+    return reg;
+}
+
+bool is_register(const std::string& operand)
+{
+    return !full_register(operand).empty();
+}
+
+bool is_memory(const std::string& operand)
+{
+    return operand.find('[') != std::string::npos;
+}
+
+std::vector<std::string> registers_in(const std::string& operand)
+{
+    std::vector<std::string> registers;
+    std::string word;
+    for (size_t i = 0; i <= operand.size(); ++i)
+    {
+        if (i < operand.size() && std::isalnum(static_cast<unsigned char>(operand[i])))
+        {
+            word += operand[i];
+            continue;
+        }
+        if (std::string reg = full_register(word); !reg.empty())
+            registers.push_back(reg);
+        word.clear();
+    }
+    return registers;
+}
+
+bool mentions(const std::string& operand, const std::string& reg)
+{
+    std::vector<std::string> registers = registers_in(operand);
+    return std::find(registers.begin(), registers.end(), full_register(reg)) !=
+           registers.end();
+}
+
+Effects effects_of(const Line& line)
+{
+    Effects effects;
+    const std::string& m = line.mnemonic;
+    const std::vector<std::string>& ops = line.operands;
+
+    // the registers of an address are read even when memory is not
+    auto address = [&](const std::string& operand)
+    {
+        std::vector<std::string> registers = registers_in(operand);
+        effects.reads.insert(effects.reads.end(), registers.begin(), registers.end());
+    };
+    auto read = [&](const std::string& operand)
+    {
+        address(operand);
+        if (is_memory(operand))
+            effects.loads.push_back(operand);
+    };
+    // a register destination is written, the address of a memory one read
+    auto write = [&](const std::string& operand)
+    {
+        if (is_register(operand))
+        {
+            effects.writes.push_back(full_register(operand));
+            return;
+        }
+        address(operand);
+        if (is_memory(operand))
+            effects.stores.push_back(operand);
+    };
+
+    if (m == "lea")
+    {
+        write(ops[0]);
+        address(ops[1]);
+    }
+    else if (m == "mov" || m == "movzx" || m.starts_with("set"))
+    {
+        write(ops[0]);
+        if (ops.size() > 1)
+            read(ops[1]);
+        effects.reads_flags = m.starts_with("set");
+    }
+    else if (m.starts_with("cmov"))
+    {
+        read(ops[0]);
+        read(ops[1]);
+        write(ops[0]);
+        effects.reads_flags = true;
+    }
+    else if ((m == "xor" || m == "sub") && ops.size() == 2 && ops[0] == ops[1])
+    {
+        write(ops[0]);
+        effects.writes_flags = true;
+    }
+    else if (m == "add" || m == "sub" || m == "and" || m == "or" || m == "xor" ||
+             m == "shl" || m == "sar" || m == "shr" || m == "neg" || m == "inc" ||
+             m == "dec" || (m == "imul" && ops.size() == 2))
+    {
+        for (const std::string& operand : ops)
+        {
+            read(operand);
+        }
+        write(ops[0]);
+        effects.writes_flags = true;
+    }
+    else if (m == "imul" && ops.size() == 3)
+    {
+        read(ops[1]);
+        write(ops[0]);
+        effects.writes_flags = true;
+    }
+    else if (m == "imul" || m == "idiv" || m == "div")
+    {
+        read(ops[0]);
+        effects.reads.insert(effects.reads.end(), {"rax", "rdx"});
+        effects.writes.insert(effects.writes.end(), {"rax", "rdx"});
+        effects.writes_flags = true;
+    }
+    else if (m == "cqo")
+    {
+        effects.reads.push_back("rax");
+        effects.writes.push_back("rdx");
+    }
+    else if (m == "cmp" || m == "test")
+    {
+        read(ops[0]);
+        read(ops[1]);
+        effects.writes_flags = true;
+    }
+    else if (m == "push")
+    {
+        read(ops[0]);
+        effects.reads.push_back("rsp");
+        effects.writes.push_back("rsp");
+    }
+    else if (m == "pop")
+    {
+        write(ops[0]);
+        effects.reads.push_back("rsp");
+        effects.writes.push_back("rsp");
+    }
+    else if (m == "call")
+    {
+        // arguments (rax counts the vector registers of a variadic call) in,
+        // caller-saved registers and flags clobbered
+        effects.reads = {"rdi", "rsi", "rdx", "rcx", "r8", "r9", "rax", "rsp"};
+        effects.writes = {"rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
+        effects.writes_flags = true;
+    }
+    else if (m == "ret")
+    {
+        effects.reads = {"rax", "rbx", "rbp", "rsp", "r12", "r13", "r14", "r15"};
+        effects.returns = true;
+    }
+    else
+    {
+        // jumps included: whatever is live at the target counts as read
+        effects.opaque = true;
+        effects.reads_flags = m.starts_with("j") && m != "jmp";
+    }
+    return effects;
+}
+
+} // namespace codegen
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace codegen {
+
+// A line of generated assembly, split into its parts. Instructions are
+// indented, labels are not and end in a colon.
+struct Line {
+    bool is_label = false;
+    bool is_instruction = false;
+    std::string text; // labels and anything that is not an instruction
+    std::string mnemonic;
+    std::vector<std::string> operands;
+};
+
+Line parse_line(const std::string& text);
+std::string format_line(const Line& line);
+
+// the 64-bit register a register name is part of, or empty
+std::string full_register(const std::string& name);
+// the 32-bit name of a 64-bit register
+std::string low_dword(const std::string& reg);
+bool is_register(const std::string& operand);
+bool is_memory(const std::string& operand);
+// the registers an operand reads, including those of an address
+std::vector<std::string> registers_in(const std::string& operand);
+bool mentions(const std::string& operand, const std::string& reg);
+
+// What an instruction does to registers, memory and flags, as far as the
+// passes over the assembly need to know. Registers are named by their 64-bit
+// names, memory by the operands accessing it. Anything not modeled is
+// `opaque`: it may read anything.
+struct Effects {
+    std::vector<std::string> reads;
+    std::vector<std::string> writes;
+    std::vector<std::string> loads;
+    std::vector<std::string> stores;
+    bool reads_flags = false;
+    bool writes_flags = false;
+    bool opaque = false;
+    bool returns = false;
+};
+
+Effects effects_of(const Line& line);
+
+} // namespace codegen
@@ -0,0 +1,379 @@
+#include "c_generator.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+
+namespace codegen {
+
+namespace {
+
+const char* const runtime[] = {
+    "#include <stdint.h>",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "",
+    "static char neko_buffer[1 << 16];",
+    "static size_t neko_buffered;",
+    "",
+    "static inline void neko_flush(void)",
+    "{",
+    "    fwrite(neko_buffer, 1, neko_buffered, stdout);",
+    "    neko_buffered = 0;",
+    "}",
+    "",
+    "static inline void neko_write(const char* bytes, size_t length)",
+    "{",
+    "    if (neko_buffered + length > sizeof neko_buffer)",
+    "    {",
+    "        neko_flush();",
+    "        if (length > sizeof neko_buffer)",
+    "        {",
+    "            fwrite(bytes, 1, length, stdout);",
+    "            return;",
+    "        }",
+    "    }",
+    "    memcpy(neko_buffer + neko_buffered, bytes, length);",
+    "    neko_buffered += length;",
+    "}",
+    "",
+    "static inline void neko_print_int(int64_t value)",
+    "{",
+    "    char digits[24];",
+    "    char* p = digits + sizeof digits;",
+    "    uint64_t n = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;",
+    "    *--p = '\\n';",
+    "    do",
+    "    {",
+    "        *--p = (char)('0' + n % 10);",
+    "        n /= 10;",
+    "    } while (n != 0);",
+    "    if (value < 0)",
+    "        *--p = '-';",
+    "    neko_write(p, (size_t)(digits + sizeof digits - p));",
+    "}",
+    "",
+    "static inline void neko_print_str(const char* text)",
+    "{",
+    "    neko_write(text, strlen(text));",
+    "    neko_write(\"\\n\", 1);",
+    "}",
+    "",
+    "static inline void neko_exit(int status)",
+    "{",
+    "    neko_flush();",
+    "    exit(status);",
+    "}",
+    "",
+    "/* the high 64 bits of the 128-bit product */",
+    "static inline int64_t neko_mulhi(int64_t a, int64_t b)",
+    "{",
+    "#ifdef __SIZEOF_INT128__",
+    "    return (int64_t)(((__int128)a * b) >> 64);",
+    "#else",
+    "    uint64_t x = (uint64_t)a, y = (uint64_t)b;",
+    "    uint64_t low = (x & 0xffffffff) * (y & 0xffffffff);",
+    "    uint64_t middle = (x >> 32) * (y & 0xffffffff) + (low >> 32);",
+    "    uint64_t middle2 = (x & 0xffffffff) * (y >> 32) + (middle & 0xffffffff);",
+    "    uint64_t high = (x >> 32) * (y >> 32) + (middle >> 32) + (middle2 >> 32);",
+    "    /* from the unsigned product to the signed one */",
+    "    if (a < 0)",
+    "        high -= y;",
+    "    if (b < 0)",
+    "        high -= x;",
+    "    return (int64_t)high;",
+    "#endif",
+    "}",
+};
+
+bool is_value(const ir::Operand& op)
+{
+    return op.type == ir::OperandType::VARIABLE ||
+           op.type == ir::OperandType::TEMPORARY;
+}
+
+// `expression` computed on uint64_t, where overflow wraps around
+std::string wrapping(const std::string& expression)
+{
+    return "(int64_t)(" + expression + ")";
+}
+
+std::string as_unsigned(const std::string& operand)
+{
+    return "(uint64_t)" + operand;
+}
+
+} // namespace
+
+std::string CGenerator::identifier(const std::string& name, const std::string& prefix)
+{
+    auto known = identifiers.find(prefix + name);
+    if (known != identifiers.end())
+        return known->second;
+
+    // derived names have dots, which C does not allow
+    std::string candidate = prefix;
+    for (char c : name)
+    {
+        candidate += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    std::string unique = candidate;
+    for (int n = 1; taken.count(unique); ++n)
+    {
+        unique = candidate + "_" + std::to_string(n);
+    }
+    taken.insert(unique);
+    identifiers[prefix + name] = unique;
+    return unique;
+}
+
+std::string CGenerator::value(const ir::Operand& op)
+{
+    if (is_value(op))
+        return identifier(op.name, op.type == ir::OperandType::TEMPORARY ? "" : "v_");
+    if (op.value.front() == '"')
+        return "(int64_t)(intptr_t)" + op.value;
+    // the parser rejects literals that do not fit
+    std::optional<int64_t> constant = op.as_integer();
+    if (!constant)
+        throw std::logic_error("the constant " + op.value + " is not a 64-bit integer");
+    if (*constant == std::numeric_limits<int64_t>::min())
+        return "INT64_MIN";
+    return std::to_string(*constant);
+}
+
+void CGenerator::generate(const ir::Program& program, const LineSink& sink)
+{
+    output.clear();
+    identifiers.clear();
+    taken.clear();
+    globals = program.get_globals();
+
+    output.insert(output.end(), std::begin(runtime), std::end(runtime));
+    output.push_back("");
+
+    std::vector<std::string> names(globals.begin(), globals.end());
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names)
+    {
+        output.push_back("static int64_t " + identifier(name, "v_") + ";");
+    }
+    if (!names.empty())
+        output.push_back("");
+
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    for (const ir::Function& function : functions)
+    {
+        if (function.is_main())
+            continue;
+        size_t parameters = function.parameters().size();
+        std::string signature =
+            "static int64_t " + identifier(function.name, "f_") + "(";
+        for (size_t k = 0; k < parameters; ++k)
+        {
+            signature += k == 0 ? "int64_t" : ", int64_t";
+        }
+        output.push_back(signature + (parameters == 0 ? "void);" : ");"));
+    }
+
+    // main last, after everything it calls
+    std::rotate(functions.begin(), functions.begin() + 1, functions.end());
+    for (const ir::Function& function : functions)
+    {
+        output.push_back("");
+        generate_function(function);
+        sink(output);
+        output.clear();
+    }
+}
+
+void CGenerator::generate_function(const ir::Function& function)
+{
+    std::vector<std::string> parameters = function.parameters();
+    if (function.is_main())
+    {
+        output.push_back("int main(void)");
+    }
+    else
+    {
+        std::string signature =
+            "static int64_t " + identifier(function.name, "f_") + "(";
+        for (size_t k = 0; k < parameters.size(); ++k)
+        {
+            // a parameter nothing binds still takes its argument
+            std::string unused = function.name + ".unused" + std::to_string(k);
+            std::string name = parameters[k].empty()
+                                   ? identifier(unused, "")
+                                   : value(ir::Operand::variable(parameters[k]));
+            signature += (k == 0 ? "int64_t " : ", int64_t ") + name;
+        }
+        output.push_back(signature + (parameters.empty() ? "void)" : ")"));
+    }
+    output.push_back("{");
+
+    // every other variable and temporary is a local, and only labels that
+    // are jumped to are kept
+    std::unordered_set<std::string> declared(parameters.begin(), parameters.end());
+    std::unordered_set<std::string> targets;
+    for (const ir::Instruction& inst : function.body)
+    {
+        std::vector<const ir::Operand*> operands = inst.uses();
+        if (const ir::Operand* def = inst.def())
+            operands.push_back(def);
+        for (const ir::Operand* op : operands)
+        {
+            if (is_value(*op) && !globals.count(op->name) &&
+                declared.insert(op->name).second)
+                emit("int64_t " + value(*op) + " = 0;");
+        }
+        if (const ir::Operand* target = inst.jump_target())
+            targets.insert(target->name);
+    }
+
+    std::vector<std::string> arguments;
+    for (const ir::Instruction& inst : function.body)
+    {
+        auto assign = [&](const std::string& expression)
+        { emit(value(*inst.result) + " = " + expression + ";"); };
+        auto binary = [&](const std::string& symbol)
+        { assign(value(*inst.arg1) + " " + symbol + " " + value(*inst.arg2)); };
+        auto wrapped = [&](const std::string& symbol)
+        {
+            assign(wrapping(as_unsigned(value(*inst.arg1)) + " " + symbol + " " +
+                            as_unsigned(value(*inst.arg2))));
+        };
+        auto jump_if = [&](const std::string& condition, const ir::Operand& label)
+        { emit("if (" + condition + ") goto " + identifier(label.name, "") + ";"); };
+        auto call = [&]()
+        {
+            std::string text = identifier(inst.arg1->name, "f_") + "(";
+            for (size_t k = 0; k < arguments.size(); ++k)
+            {
+                text += (k == 0 ? "" : ", ") + arguments[k];
+            }
+            arguments.clear();
+            return text + ")";
+        };
+        auto shift_count = [&]() { return "(" + value(*inst.arg2) + " & 63)"; };
+
+        switch (inst.op)
+        {
+        case ir::OpCode::ADD:
+            wrapped("+");
+            break;
+        case ir::OpCode::SUB:
+            wrapped("-");
+            break;
+        case ir::OpCode::MUL:
+            wrapped("*");
+            break;
+        case ir::OpCode::DIV:
+        case ir::OpCode::UDIV:
+            binary("/");
+            break;
+        case ir::OpCode::MULHI:
+            assign("neko_mulhi(" + value(*inst.arg1) + ", " + value(*inst.arg2) + ")");
+            break;
+        case ir::OpCode::SHL:
+            assign(wrapping(as_unsigned(value(*inst.arg1)) + " << " + shift_count()));
+            break;
+        case ir::OpCode::SAR:
+            assign(value(*inst.arg1) + " >> " + shift_count());
+            break;
+        case ir::OpCode::SHR:
+            assign(wrapping(as_unsigned(value(*inst.arg1)) + " >> " + shift_count()));
+            break;
+        case ir::OpCode::NEG:
+            assign(wrapping("0 - " + as_unsigned(value(*inst.arg1))));
+            break;
+        case ir::OpCode::NOT:
+            assign(value(*inst.arg1) + " == 0");
+            break;
+        case ir::OpCode::ASSIGN:
+            assign(value(*inst.arg1));
+            break;
+        case ir::OpCode::LT:
+        case ir::OpCode::GT:
+        case ir::OpCode::LE:
+        case ir::OpCode::GE:
+        case ir::OpCode::EQ:
+        case ir::OpCode::NE:
+            binary(ir::comparison_symbol(inst.op));
+            break;
+        case ir::OpCode::SELECT:
+            assign(value(*inst.arg1) + " != 0 ? " + value(*inst.arg2) + " : " +
+                   value(*inst.arg3));
+            break;
+        case ir::OpCode::LABEL:
+            if (targets.count(inst.arg1->name))
+                output.push_back(identifier(inst.arg1->name, "") + ":;");
+            break;
+        case ir::OpCode::JUMP:
+            emit("goto " + identifier(inst.arg1->name, "") + ";");
+            break;
+        case ir::OpCode::JUMP_IF_FALSE:
+            jump_if(value(*inst.arg1) + " == 0", *inst.arg2);
+            break;
+        case ir::OpCode::JUMP_IF_TRUE:
+            jump_if(value(*inst.arg1) + " != 0", *inst.arg2);
+            break;
+        case ir::OpCode::JUMP_IF_LT:
+        case ir::OpCode::JUMP_IF_GT:
+        case ir::OpCode::JUMP_IF_LE:
+        case ir::OpCode::JUMP_IF_GE:
+        case ir::OpCode::JUMP_IF_EQ:
+        case ir::OpCode::JUMP_IF_NE: {
+            std::string symbol = ir::comparison_symbol(ir::compared_by(inst.op));
+            jump_if(value(*inst.arg1) + " " + symbol + " " + value(*inst.arg2),
+                    *inst.result);
+            break;
+        }
+        case ir::OpCode::PARAM:
+            arguments.push_back(value(*inst.arg1));
+            break;
+        case ir::OpCode::CALL:
+            if (inst.result)
+                assign(call());
+            else
+                emit(call() + ";");
+            break;
+        case ir::OpCode::TAIL_CALL:
+            emit("return " + call() + ";");
+            break;
+        case ir::OpCode::RETURN:
+            if (function.is_main())
+                emit("neko_exit(0);");
+            else
+                emit("return " + (inst.arg1 ? value(*inst.arg1) : "0") + ";");
+            break;
+        case ir::OpCode::PRINT:
+            if (inst.arg1->type == ir::OperandType::CONSTANT &&
+                inst.arg1->value.front() == '"')
+                emit("neko_print_str(" + inst.arg1->value + ");");
+            else
+                emit("neko_print_int(" + value(*inst.arg1) + ");");
+            break;
+        case ir::OpCode::HALT:
+            emit("neko_exit(0);");
+            break;
+        case ir::OpCode::PARAM_BIND:
+        case ir::OpCode::PROLOGUE:
+            // parameters are those of the C function
+            break;
+        }
+    }
+
+    ir::OpCode last =
+        function.body.empty() ? ir::OpCode::PROLOGUE : function.body.back().op;
+    if (function.is_main())
+        emit("neko_exit(0);");
+    else if (last != ir::OpCode::RETURN && last != ir::OpCode::TAIL_CALL)
+        emit("return 0;");
+    output.push_back("}");
+}
+
+} // namespace codegen
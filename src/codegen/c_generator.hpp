@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../ir/function.hpp"
+#include "../ir/tac.hpp"
+#include "line_sink.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace codegen {
+
+// Generates C for a program, as an alternative to the NASM backend.
+//
+// Each function becomes a C function over int64_t with its variables and
+// temporaries as locals, and the control flow of the three-address code is
+// kept as gotos between labels. Arithmetic wraps around as on the machine,
+// through unsigned arithmetic where C would leave overflow undefined. A
+// small runtime at the top of the file buffers the output of print, like
+// the one the native programs carry. The result is plain C99 and builds
+// with any C compiler.
+class CGenerator {
+  public:
+    // gives `sink` the C source, a function at a time after the runtime and
+    // the declarations
+    void generate(const ir::Program& program, const LineSink& sink);
+
+  private:
+    std::vector<std::string> output;
+    std::unordered_set<std::string> globals;
+    // the C identifier of each name of the program, and the identifiers taken
+    std::unordered_map<std::string, std::string> identifiers;
+    std::unordered_set<std::string> taken;
+
+    void emit(const std::string& statement) { output.push_back("    " + statement); }
+
+    // a C identifier for the variable, function or label `name`, the same
+    // each time and different from those of all other names
+    std::string identifier(const std::string& name, const std::string& prefix);
+    std::string value(const ir::Operand& op);
+    void generate_function(const ir::Function& function);
+};
+
+} // namespace codegen
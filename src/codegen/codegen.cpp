@@ -1,231 +1,691 @@
 #include "codegen.hpp"
 
+#include "register_allocator.hpp"
+#include "runtime.hpp"
+
 #include <algorithm>
-#include <sstream>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
 
 namespace codegen {
 
-std::string CodeGenerator::generate(const ir::Program& program)
+namespace {
+
+const char* const argument_registers[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+// Comparisons into a temporary that only the SELECTs right after them read.
+// Those SELECTs use the flags, so the comparison never has to materialize its
+// result.
+std::unordered_set<const ir::Instruction*>
+flag_only_comparisons(const std::vector<ir::Instruction>& code)
+{
+    std::unordered_map<std::string, int> reads;
+    for (const auto& inst : code)
+    {
+        for (const ir::Operand* use : inst.uses())
+        {
+            if (use->type == ir::OperandType::TEMPORARY)
+                reads[use->name]++;
+        }
+    }
+
+    std::unordered_set<const ir::Instruction*> comparisons;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (!ir::is_comparison(code[i].op) ||
+            code[i].result->type != ir::OperandType::TEMPORARY)
+            continue;
+
+        const std::string& name = code[i].result->name;
+        int selects = 0;
+        for (size_t j = i + 1; j < code.size(); ++j)
+        {
+            const ir::Instruction& next = code[j];
+            if (next.op != ir::OpCode::ASSIGN && next.op != ir::OpCode::SELECT)
+                break;
+            if (next.op == ir::OpCode::SELECT && next.arg1->name == name)
+                selects++;
+            if (next.result->name == name)
+                break;
+        }
+
+        if (selects > 0 && selects == reads[name])
+            comparisons.insert(&code[i]);
+    }
+    return comparisons;
+}
+
+// A run of tests of one value against constants, the way a switch statement
+// comes out of the IR: `if x == c goto L` for each case, then possibly `if
+// x != c goto D` or `goto D` for where no case leads.
+struct CaseRun {
+    const ir::Operand* subject = nullptr;
+    // values with the labels they lead to, an empty label for the code after
+    // the run
+    std::vector<std::pair<int64_t, std::string>> cases;
+    std::string otherwise; // empty for the code after the run
+    size_t length = 0;     // instructions, 0 when there is no run worth a dispatch
+};
+
+// the value `inst` compares with a constant, if it is such a test
+const ir::Operand* tested_value(const ir::Instruction& inst, ir::OpCode op)
+{
+    if (inst.op != op)
+        return nullptr;
+    if (inst.arg2->is_integer() && !inst.arg1->is_integer() &&
+        inst.arg1->type != ir::OperandType::CONSTANT)
+        return &*inst.arg1;
+    if (inst.arg1->is_integer() && !inst.arg2->is_integer() &&
+        inst.arg2->type != ir::OperandType::CONSTANT)
+        return &*inst.arg2;
+    return nullptr;
+}
+
+int64_t tested_constant(const ir::Instruction& inst)
+{
+    return inst.arg2->is_integer() ? *inst.arg2->as_integer()
+                                   : *inst.arg1->as_integer();
+}
+
+// The run starting at code[start]. Fewer than four distinct cases are left
+// to the compare-and-branches, which do about as well.
+CaseRun case_run(const std::vector<ir::Instruction>& code, size_t start)
+{
+    CaseRun run;
+    run.subject = tested_value(code[start], ir::OpCode::JUMP_IF_EQ);
+    if (!run.subject)
+        return run;
+
+    size_t end = start;
+    std::unordered_set<int64_t> values;
+    auto add_case = [&](const ir::Instruction& test, std::string label)
+    {
+        int64_t value = tested_constant(test);
+        // a later test of the same value is never reached
+        if (values.insert(value).second)
+            run.cases.emplace_back(value, std::move(label));
+    };
+    for (; end < code.size(); ++end)
+    {
+        const ir::Operand* value = tested_value(code[end], ir::OpCode::JUMP_IF_EQ);
+        if (!value || !(*value == *run.subject))
+            break;
+        add_case(code[end], code[end].result->name);
+    }
+    if (end < code.size())
+    {
+        const ir::Operand* value = tested_value(code[end], ir::OpCode::JUMP_IF_NE);
+        if (value && *value == *run.subject)
+        {
+            // what a block layout leaves of the last case, falling into it
+            add_case(code[end], "");
+            run.otherwise = code[end].result->name;
+            ++end;
+        }
+        else if (code[end].op == ir::OpCode::JUMP)
+        {
+            run.otherwise = code[end].arg1->name;
+            ++end;
+        }
+    }
+
+    if (run.cases.size() >= 4)
+        run.length = end - start;
+    return run;
+}
+
+// the contents of the string literals of the program, in order of appearance
+std::vector<std::string> string_literals(const ir::Program& program)
+{
+    std::vector<std::string> literals;
+    std::unordered_set<std::string> seen;
+    for (const auto& inst : program.get_instructions())
+    {
+        if (inst.arg1 && inst.arg1->type == ir::OperandType::CONSTANT &&
+            inst.arg1->value.front() == '"')
+        {
+            std::string s = inst.arg1->value.substr(1, inst.arg1->value.length() - 2);
+            if (seen.insert(s).second)
+                literals.push_back(std::move(s));
+        }
+    }
+    return literals;
+}
+
+// whether control can run past the last instruction of `function`
+bool can_fall_off(const ir::Function& function)
+{
+    if (function.body.empty())
+        return true;
+    ir::OpCode last = function.body.back().op;
+    return last != ir::OpCode::HALT && last != ir::OpCode::JUMP &&
+           last != ir::OpCode::RETURN && last != ir::OpCode::TAIL_CALL;
+}
+
+} // namespace
+
+void CodeGenerator::generate(const ir::Program& program, const LineSink& sink)
 {
     output.clear();
-    variables.clear();
-    string_literals.clear();
-    next_string_id = 0;
 
-    collect_variables(program);
+    Module shared;
+    shared.globals = program.get_globals();
+    std::vector<std::string> literals = string_literals(program);
+    for (size_t i = 0; i < literals.size(); ++i)
+    {
+        shared.string_literals.emplace(literals[i], "str_" + std::to_string(i));
+    }
 
     // Header
     output.push_back("section .note.GNU-stack noalloc noexec nowrite progbits");
-    output.push_back("extern printf");
-    output.push_back("extern exit");
+    output.push_back("global _start");
     output.push_back("global main");
     output.push_back("");
 
     // Data section
     output.push_back("section .data");
-    output.push_back("    fmt_int: db \"%ld\", 10, 0");
-    output.push_back("    fmt_str: db \"%s\", 10, 0");
-    for (auto const& [str, id] : string_literals)
+    for (const std::string& str : literals)
     {
-        output.push_back("    " + id + ": db `" + str + "`, 0");
+        output.push_back("    " + shared.string_literals.at(str) + ": db `" + str +
+                         "`, 0");
     }
     output.push_back("");
 
-    // BSS section
+    // BSS section: only globals, everything else lives in stack frames
+    std::vector<std::string> names(shared.globals.begin(), shared.globals.end());
+    std::sort(names.begin(), names.end());
     output.push_back("section .bss");
-    for (const auto& var : variables)
+    for (const auto& name : names)
     {
-        output.push_back("    " + var + ": resq 1");
+        output.push_back("    " + name + ": resq 1");
     }
     output.push_back("");
 
     // Text section
     output.push_back("section .text");
-    output.push_back("main:");
-    output.push_back("    push rbp");
-    output.push_back("    mov rbp, rsp");
-    output.push_back("");
+    sink(output);
+    output.clear();
 
-    const auto& instructions = program.get_instructions();
-    for (const auto& inst : instructions)
+    // the functions are generated in parallel a batch at a time, and each
+    // batch is written out in order before the next one is started, so that
+    // the text of only a few functions per thread is held at once
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    const size_t batch = size_t(pool->size()) * 4;
+    std::vector<std::string> tables;
+    for (size_t first = 0; first < functions.size(); first += batch)
     {
-        switch (inst.op)
+        size_t count = std::min(batch, functions.size() - first);
+        std::vector<std::unique_ptr<CodeGenerator>> generators;
+        for (size_t i = 0; i < count; ++i)
         {
-        case ir::OpCode::ADD:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("add rax, " + map_operand(*inst.arg2));
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::SUB:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("sub rax, " + map_operand(*inst.arg2));
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::MUL:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("imul rax, " + map_operand(*inst.arg2));
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::DIV:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cqo");
-            emit("idiv qword " + map_operand(*inst.arg2));
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::ASSIGN:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::LABEL:
-            emit_label(inst.arg1->name);
-            break;
-        case ir::OpCode::PROLOGUE:
-            emit("push rbp");
-            emit("mov rbp, rsp");
-            break;
-        case ir::OpCode::JUMP:
-            emit("jmp " + inst.arg1->name);
-            break;
-        case ir::OpCode::JUMP_IF_FALSE:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, 0");
-            emit("je " + inst.arg2->name);
-            break;
-        case ir::OpCode::JUMP_IF_TRUE:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, 0");
-            emit("jne " + inst.arg2->name);
-            break;
-        case ir::OpCode::PRINT:
-            if (inst.arg1->type == ir::OperandType::CONSTANT &&
-                inst.arg1->value.front() == '"')
-            {
-                emit("mov rdi, fmt_str");
-                emit("mov rsi, " + map_operand(*inst.arg1));
-            }
-            else
-            {
-                emit("mov rdi, fmt_int");
-                emit("mov rsi, " + map_operand(*inst.arg1));
-            }
-            emit("xor rax, rax");
-            emit("call printf");
-            break;
-        case ir::OpCode::RETURN:
-            if (inst.arg1)
+            generators.emplace_back(new CodeGenerator(level, shared));
+        }
+        pool->for_each(count, [&](size_t i)
+                       { generators[i]->generate_text(functions[first + i]); });
+
+        for (auto& generator : generators)
+        {
+            sink(generator->output);
+            tables.insert(tables.end(), generator->rodata.begin(),
+                          generator->rodata.end());
+            peephole.merge(generator->peephole);
+            generator.reset();
+        }
+    }
+    emit_runtime(output);
+
+    // Read-only data section: the jump tables of the switches
+    if (!tables.empty())
+    {
+        output.push_back("");
+        output.push_back("section .rodata");
+        output.insert(output.end(), tables.begin(), tables.end());
+    }
+
+    sink(output);
+    output.clear();
+}
+
+void CodeGenerator::generate_text(ir::Function& function)
+{
+    std::vector<size_t> evaluated_at = selector.build_trees(function.body);
+    allocate_frame(function, evaluated_at);
+    if (function.is_main())
+    {
+        output.push_back("main:");
+        emit_frame_setup();
+        output.push_back("");
+    }
+    generate_function(function);
+    if (function.is_main() && can_fall_off(function))
+    {
+        // the top-level code ends by running off its end when there are no
+        // functions after it
+        emit("mov rdi, 0");
+        emit("call neko.exit");
+    }
+
+    peephole.run(output);
+    if (level >= 2)
+        scheduler.run(output);
+}
+
+void CodeGenerator::generate_function(const ir::Function& function)
+{
+    // the comparison whose outcome is still in the flags, so that a SELECT on
+    // its result can use them directly
+    std::optional<std::pair<std::string, ir::OpCode>> flags;
+
+    int returns_left = int(std::count_if(function.body.begin(),
+                                         function.body.end(),
+                                         [](const ir::Instruction& inst)
+                                         { return inst.op == ir::OpCode::RETURN; }));
+    bool shared_epilogue = returns_left > 1 && (!frameless || !saved_registers.empty());
+
+    std::unordered_set<const ir::Instruction*> kept_in_flags =
+        flag_only_comparisons(function.body);
+    auto locate = [this](const ir::Operand& op) { return map_operand(op); };
+    auto emit_line = [this](const std::string& instr) { emit(instr); };
+    for (size_t i = 0; i < function.body.size(); ++i)
+    {
+        const ir::Instruction& inst = function.body[i];
+        // nothing is left of an instruction folded into a later one
+        if (selector.is_folded(inst))
+            continue;
+
+        // a run of tests of one value against constants is dispatched on at once
+        CaseRun run = case_run(function.body, i);
+        if (run.length > 0)
+        {
+            emit_switch(
+                function.name, *run.subject, std::move(run.cases), run.otherwise);
+            i += run.length - 1;
+            flags.reset();
+            continue;
+        }
+
+        // the comparison whose outcome this instruction leaves in the flags
+        ir::OpCode condition = inst.op;
+        if (selector.is_root(inst))
+        {
+            bool flags_only = kept_in_flags.count(&inst) > 0;
+            condition = selector.select(inst, locate, emit_line, flags_only);
+        }
+        else
+        {
+            switch (inst.op)
             {
+            case ir::OpCode::DIV:
+                emit("mov rax, " + map_operand(*inst.arg1));
+                emit("cqo");
+                if (inst.arg2->type == ir::OperandType::CONSTANT)
+                {
+                    // idiv has no immediate form
+                    emit("mov rcx, " + map_operand(*inst.arg2));
+                    emit("idiv rcx");
+                }
+                else
+                {
+                    emit("idiv " + sized_operand(*inst.arg2));
+                }
+                emit("mov " + map_operand(*inst.result) + ", rax");
+                break;
+            case ir::OpCode::UDIV:
+                // both operands are known to be non-negative, so no sign extension
                 emit("mov rax, " + map_operand(*inst.arg1));
+                emit("xor edx, edx");
+                if (inst.arg2->type == ir::OperandType::CONSTANT)
+                {
+                    emit("mov rcx, " + map_operand(*inst.arg2));
+                    emit("div rcx");
+                }
+                else
+                {
+                    emit("div " + sized_operand(*inst.arg2));
+                }
+                emit("mov " + map_operand(*inst.result) + ", rax");
+                break;
+            case ir::OpCode::MULHI:
+                emit("mov rax, " + map_operand(*inst.arg1));
+                emit("mov rcx, " + map_operand(*inst.arg2));
+                emit("imul rcx");
+                emit("mov " + map_operand(*inst.result) + ", rdx");
+                break;
+            case ir::OpCode::SHL:
+            case ir::OpCode::SAR:
+            case ir::OpCode::SHR: {
+                const char* mnemonic = inst.op == ir::OpCode::SHL   ? "shl"
+                                       : inst.op == ir::OpCode::SAR ? "sar"
+                                                                    : "shr";
+                // by a variable amount, which has to be in cl
+                emit("mov rax, " + map_operand(*inst.arg1));
+                emit("mov rcx, " + map_operand(*inst.arg2));
+                emit(std::string(mnemonic) + " rax, cl");
+                emit("mov " + map_operand(*inst.result) + ", rax");
+                break;
             }
-            emit("mov rsp, rbp");
-            emit("pop rbp");
-            emit("ret");
-            break;
-        case ir::OpCode::HALT:
-            emit("mov rdi, 0");
-            emit("call exit");
-            break;
-        case ir::OpCode::LT:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, " + map_operand(*inst.arg2));
-            emit("setl al");
-            emit("movzx rax, al");
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::GT:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, " + map_operand(*inst.arg2));
-            emit("setg al");
-            emit("movzx rax, al");
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::LE:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, " + map_operand(*inst.arg2));
-            emit("setle al");
-            emit("movzx rax, al");
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::GE:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, " + map_operand(*inst.arg2));
-            emit("setge al");
-            emit("movzx rax, al");
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::EQ:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, " + map_operand(*inst.arg2));
-            emit("sete al");
-            emit("movzx rax, al");
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::NE:
-            emit("mov rax, " + map_operand(*inst.arg1));
-            emit("cmp rax, " + map_operand(*inst.arg2));
-            emit("setne al");
-            emit("movzx rax, al");
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
-        case ir::OpCode::PARAM:
-            emit("push qword " + map_operand(*inst.arg1));
-            break;
-        case ir::OpCode::CALL: {
-            int num_args = std::stoi(inst.arg2->value);
-            const char* reg_args[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-            for (int i = std::min(num_args, 6) - 1; i >= 0; --i)
-            {
-                emit("pop " + std::string(reg_args[i]));
+            case ir::OpCode::LABEL:
+                emit_label(inst.arg1->name);
+                break;
+            case ir::OpCode::PROLOGUE:
+                emit_frame_setup();
+                break;
+            case ir::OpCode::JUMP:
+                emit("jmp " + inst.arg1->name);
+                break;
+            case ir::OpCode::SELECT: {
+                std::string condition = "ne";
+                if (flags && flags->first == inst.arg1->name)
+                {
+                    condition = condition_code(flags->second);
+                }
+                else
+                {
+                    emit("mov rax, " + map_operand(*inst.arg1));
+                    emit("cmp rax, 0");
+                }
+                emit("mov rax, " + map_operand(*inst.arg3));
+                // cmov has no immediate form
+                if (inst.arg2->type == ir::OperandType::CONSTANT)
+                {
+                    emit("mov rcx, " + map_operand(*inst.arg2));
+                    emit("cmov" + condition + " rax, rcx");
+                }
+                else
+                {
+                    emit("cmov" + condition + " rax, " + map_operand(*inst.arg2));
+                }
+                emit("mov " + map_operand(*inst.result) + ", rax");
+                break;
             }
-            emit("xor rax, rax");
-            emit("call " + inst.arg1->name);
-            if (num_args > 6)
-            {
-                emit("add rsp, " + std::to_string((num_args - 6) * 8));
+            case ir::OpCode::PRINT:
+                emit("mov rdi, " + map_operand(*inst.arg1));
+                if (inst.arg1->type == ir::OperandType::CONSTANT &&
+                    inst.arg1->value.front() == '"')
+                {
+                    emit("call neko.print_str");
+                }
+                else
+                {
+                    emit("call neko.print_int");
+                }
+                break;
+            case ir::OpCode::RETURN:
+                if (inst.arg1)
+                {
+                    emit("mov rax, " + map_operand(*inst.arg1));
+                }
+                else
+                {
+                    // a function that returns no value returns 0, as the
+                    // optimizer assumes when it inlines or folds the call
+                    emit("xor eax, eax");
+                }
+                // all returns share the epilogue after the last one, unless
+                // it is a bare ret
+                if (returns_left-- > 1 && shared_epilogue)
+                {
+                    emit("jmp " + function.name + ".epilogue");
+                    break;
+                }
+                if (shared_epilogue)
+                    emit_label(function.name + ".epilogue");
+                emit_frame_teardown();
+                emit("ret");
+                break;
+            case ir::OpCode::HALT:
+                emit("mov rdi, 0");
+                emit("call neko.exit");
+                break;
+            case ir::OpCode::PARAM:
+                // moved into place all at once by the call
+                break;
+            case ir::OpCode::CALL:
+                emit_arguments(inst);
+                emit("xor eax, eax");
+                emit("call " + inst.arg1->name);
+                if (inst.result)
+                {
+                    emit("mov " + map_operand(*inst.result) + ", rax");
+                }
+                break;
+            case ir::OpCode::TAIL_CALL:
+                // the callee returns straight to our caller, so tear down our
+                // frame first; only register arguments can be passed this way
+                emit_arguments(inst);
+                emit("xor eax, eax");
+                emit_frame_teardown();
+                emit("jmp " + inst.arg1->name);
+                break;
+            case ir::OpCode::PARAM_BIND: {
+                int index = std::stoi(inst.arg2->value);
+                std::string location = map_operand(*inst.arg1);
+                if (index >= 6)
+                {
+                    // above the return address, and the saved rbp if there is one
+                    int offset = (frameless ? 8 : 16) + (index - 6) * 8;
+                    emit("mov rax, [" + std::string(frameless ? "rsp" : "rbp") + " + " +
+                         std::to_string(offset) + "]");
+                    emit("mov " + location + ", rax");
+                }
+                else if (location != argument_registers[index])
+                {
+                    emit("mov " + location + ", " + argument_registers[index]);
+                }
+                break;
+            }
+            default:
+                break;
             }
-            emit("mov " + map_operand(*inst.result) + ", rax");
-            break;
         }
-        case ir::OpCode::PARAM_BIND: {
-            int index = std::stoi(inst.arg2->value);
-            const char* reg_args[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-            if (index < 6)
+
+        // only SELECT and the plain copies of ASSIGN leave the flags alone
+        bool keeps_flags =
+            inst.op == ir::OpCode::SELECT || selector.preserves_flags(inst);
+        if (ir::is_comparison(inst.op))
+            flags.emplace(inst.result->name, condition);
+        else if (!keeps_flags || (flags && inst.result->name == flags->first))
+            flags.reset();
+    }
+
+}
+
+void CodeGenerator::emit_switch(const std::string& function,
+                                const ir::Operand& subject,
+                                std::vector<std::pair<int64_t, std::string>> cases,
+                                const std::string& otherwise)
+{
+    std::string name = function + ".switch" + std::to_string(switches++);
+    // cases and the default that fall through go to the code after the dispatch
+    std::string end = name + ".end";
+    for (auto& [value, label] : cases)
+    {
+        if (label.empty())
+            label = end;
+    }
+    std::string default_label = otherwise.empty() ? end : otherwise;
+    std::sort(cases.begin(), cases.end());
+
+    auto immediate = [](int64_t value)
+    {
+        return value >= std::numeric_limits<int32_t>::min() &&
+               value <= std::numeric_limits<int32_t>::max();
+    };
+    auto compare = [&](int64_t value)
+    {
+        // cmp has no 64-bit immediate form
+        if (immediate(value))
+        {
+            emit("cmp rax, " + std::to_string(value));
+        }
+        else
+        {
+            emit("mov rcx, " + std::to_string(value));
+            emit("cmp rax, rcx");
+        }
+    };
+
+    emit_label(name);
+    emit("mov rax, " + map_operand(subject));
+
+    // A table when at least a third of its entries are cases. The entries are
+    // the distances of the targets from the start of the dispatch, so that
+    // they need no relocation, as 32-bit numbers to keep the table small.
+    uint64_t span = uint64_t(cases.back().first) - uint64_t(cases.front().first);
+    if (span < 3 * cases.size())
+    {
+        int64_t low = cases.front().first;
+        if (low != 0)
+        {
+            if (immediate(low))
             {
-                emit("mov [" + inst.arg1->name + "], " + reg_args[index]);
+                emit("sub rax, " + std::to_string(low));
             }
             else
             {
-                emit("mov rax, [rbp + " + std::to_string(16 + (index - 6) * 8) + "]");
-                emit("mov [" + inst.arg1->name + "], rax");
+                emit("mov rcx, " + std::to_string(low));
+                emit("sub rax, rcx");
             }
-            break;
         }
-        default:
-            break;
+        // below the lowest case the difference wraps around to a large one
+        emit("cmp rax, " + std::to_string(span));
+        emit("ja " + default_label);
+        emit("lea rcx, [" + name + ".table]");
+        emit("movsxd rax, dword [rcx + rax*4]");
+        emit("lea rcx, [" + name + "]");
+        emit("add rax, rcx");
+        emit("jmp rax");
+
+        rodata.push_back(name + ".table:");
+        auto next = cases.begin();
+        for (uint64_t offset = 0; offset <= span; ++offset)
+        {
+            bool hit = uint64_t(next->first) - uint64_t(low) == offset;
+            const std::string& label = hit ? next->second : default_label;
+            rodata.push_back("    dd " + label + " - " + name);
+            if (hit)
+                ++next;
         }
     }
+    else
+    {
+        // A balanced binary search: test the middle case, then go on with
+        // the half that can still hold the value. A few cases are left to
+        // test one after the other.
+        int subtrees = 0;
+        auto search = [&](auto& self, size_t first, size_t last) -> void
+        {
+            if (last - first <= 3)
+            {
+                for (size_t k = first; k < last; ++k)
+                {
+                    compare(cases[k].first);
+                    emit("je " + cases[k].second);
+                }
+                emit("jmp " + default_label);
+                return;
+            }
+            size_t middle = first + (last - first) / 2;
+            std::string below = name + ".below" + std::to_string(subtrees++);
+            compare(cases[middle].first);
+            emit("je " + cases[middle].second);
+            emit("jl " + below);
+            self(self, middle + 1, last);
+            emit_label(below);
+            self(self, first, middle);
+        };
+        search(search, 0, cases.size());
+    }
+
+    emit_label(end);
+}
 
-    emit("mov rdi, 0");
-    emit("call exit");
+void CodeGenerator::emit_arguments(const ir::Instruction& call)
+{
+    int num_args = std::stoi(call.arg2->value);
+    const ir::Instruction* params = &call - num_args;
+
+    // the rest go to the bottom of the frame, where the callee finds them
+    // above its return address; this reads no argument register
+    for (int i = 6; i < num_args; ++i)
+    {
+        const ir::Operand& arg = *params[i].arg1;
+        std::string slot =
+            i == 6 ? "[rsp]" : "[rsp + " + std::to_string((i - 6) * 8) + "]";
+        auto value = arg.as_integer();
+        bool wide = value && (*value < std::numeric_limits<int32_t>::min() ||
+                              *value > std::numeric_limits<int32_t>::max());
+        if (in_register(arg))
+        {
+            emit("mov " + slot + ", " + map_operand(arg));
+        }
+        else if (arg.type == ir::OperandType::CONSTANT && !wide)
+        {
+            emit("mov qword " + slot + ", " + map_operand(arg));
+        }
+        else
+        {
+            emit("mov rax, " + map_operand(arg));
+            emit("mov " + slot + ", rax");
+        }
+    }
 
-    std::stringstream ss;
-    for (const auto& line : output)
+    // The first six go to their registers, as a parallel move: a register is
+    // written once no pending move still reads it, and a cycle is broken by
+    // setting one of its values aside in rax.
+    std::vector<std::pair<std::string, std::string>> moves; // register, source
+    for (int i = 0; i < std::min(num_args, 6); ++i)
+    {
+        std::string source = map_operand(*params[i].arg1);
+        if (source != argument_registers[i])
+            moves.emplace_back(argument_registers[i], source);
+    }
+    while (!moves.empty())
     {
-        ss << line << "\n";
+        auto still_read = [&](const std::string& reg)
+        {
+            return std::any_of(moves.begin(),
+                               moves.end(),
+                               [&](const auto& other) { return other.second == reg; });
+        };
+        auto ready = std::find_if(moves.begin(),
+                                  moves.end(),
+                                  [&](const auto& move)
+                                  { return !still_read(move.first); });
+        if (ready == moves.end())
+        {
+            std::string blocked = moves.front().first;
+            emit("mov rax, " + blocked);
+            for (auto& move : moves)
+            {
+                if (move.second == blocked)
+                    move.second = "rax";
+            }
+            continue;
+        }
+        emit("mov " + ready->first + ", " + ready->second);
+        moves.erase(ready);
     }
-    return ss.str();
 }
 
 std::string CodeGenerator::map_operand(const ir::Operand& op)
 {
     if (op.type == ir::OperandType::VARIABLE || op.type == ir::OperandType::TEMPORARY)
     {
+        auto location = locations.find(op.name);
+        if (location != locations.end())
+            return location->second;
         return "[" + op.name + "]";
     }
     else if (op.type == ir::OperandType::CONSTANT)
     {
         if (op.value.front() == '"')
         {
-            return string_literals[op.value.substr(1, op.value.length() - 2)];
+            std::string text = op.value.substr(1, op.value.length() - 2);
+            return module->string_literals.at(text);
         }
         if (op.value == "true")
             return "1";
@@ -238,63 +698,99 @@ std::string CodeGenerator::map_operand(const ir::Operand& op)
     return op.name;
 }
 
-void CodeGenerator::collect_variables(const ir::Program& program)
+bool CodeGenerator::in_register(const ir::Operand& op) const
 {
-    std::unordered_set<std::string> labels;
-    for (const auto& inst : program.get_instructions())
+    if (op.type != ir::OperandType::VARIABLE && op.type != ir::OperandType::TEMPORARY)
+        return false;
+    auto location = locations.find(op.name);
+    return location != locations.end() && location->second.front() != '[';
+}
+
+std::string CodeGenerator::sized_operand(const ir::Operand& op)
+{
+    return in_register(op) ? map_operand(op) : "qword " + map_operand(op);
+}
+
+void CodeGenerator::allocate_frame(ir::Function& function,
+                                   const std::vector<size_t>& evaluated_at)
+{
+    RegisterAllocator allocator(module->globals);
+    Allocation allocation = allocator.run(function.body, evaluated_at);
+
+    // A leaf function calls nothing, so the 128 bytes below rsp (the red zone
+    // of the System V ABI) are its own: a frame that fits there needs neither
+    // rbp nor an adjustment of rsp.
+    bool leaf = std::none_of(function.body.begin(),
+                             function.body.end(),
+                             [](const ir::Instruction& inst)
+                             {
+                                 return inst.op == ir::OpCode::CALL ||
+                                        inst.op == ir::OpCode::PRINT ||
+                                        inst.op == ir::OpCode::HALT;
+                             });
+    int slots = allocation.slot_count;
+    int saved = int(allocation.saved_registers.size());
+    frameless = leaf && !function.is_main() && (slots + saved) * 8 <= 128;
+    std::string base = frameless ? "[rsp - " : "[rbp - ";
+
+    locations = std::move(allocation.registers);
+    for (const auto& [name, slot] : allocation.slots)
     {
-        if (inst.op == ir::OpCode::LABEL)
-        {
-            labels.insert(inst.arg1->name);
-        }
+        locations[name] = base + std::to_string((slot + 1) * 8) + "]";
     }
 
-    for (const auto& inst : program.get_instructions())
+    // callee-saved registers are saved below the spill slots
+    saved_registers.clear();
+    for (const std::string& reg : allocation.saved_registers)
     {
-        if (inst.result)
-        {
-            if (inst.result->type == ir::OperandType::VARIABLE ||
-                inst.result->type == ir::OperandType::TEMPORARY)
-            {
-                if (labels.find(inst.result->name) == labels.end())
-                {
-                    variables.insert(inst.result->name);
-                }
-            }
-        }
-        if (inst.arg1)
-        {
-            if (inst.arg1->type == ir::OperandType::VARIABLE ||
-                inst.arg1->type == ir::OperandType::TEMPORARY)
-            {
-                if (labels.find(inst.arg1->name) == labels.end())
-                {
-                    variables.insert(inst.arg1->name);
-                }
-            }
-            else if (inst.arg1->type == ir::OperandType::CONSTANT &&
-                     inst.arg1->value.front() == '"')
-            {
-                std::string s =
-                    inst.arg1->value.substr(1, inst.arg1->value.length() - 2);
-                if (string_literals.find(s) == string_literals.end())
-                {
-                    string_literals[s] = "str_" + std::to_string(next_string_id++);
-                }
-            }
-        }
-        if (inst.arg2)
-        {
-            if (inst.arg2->type == ir::OperandType::VARIABLE ||
-                inst.arg2->type == ir::OperandType::TEMPORARY)
-            {
-                if (labels.find(inst.arg2->name) == labels.end())
-                {
-                    variables.insert(inst.arg2->name);
-                }
-            }
-        }
+        saved_registers.emplace_back(reg, ++slots * 8);
+    }
+
+    // arguments past the sixth are stored at the bottom of the frame rather
+    // than pushed, so the area has room for those of the largest call
+    int outgoing = 0;
+    for (const ir::Instruction& inst : function.body)
+    {
+        if (inst.op == ir::OpCode::CALL)
+            outgoing = std::max(outgoing, std::stoi(inst.arg2->value) - 6);
+    }
+
+    // rsp stays 16-byte aligned below the saved rbp
+    frame_size = frameless ? 0 : (slots + outgoing + 1) / 2 * 16;
+}
+
+std::string CodeGenerator::saved_register_slot(int offset) const
+{
+    return (frameless ? "[rsp - " : "[rbp - ") + std::to_string(offset) + "]";
+}
+
+void CodeGenerator::emit_frame_setup()
+{
+    if (!frameless)
+    {
+        emit("push rbp");
+        emit("mov rbp, rsp");
+    }
+    if (frame_size > 0)
+        emit("sub rsp, " + std::to_string(frame_size));
+    for (const auto& [reg, offset] : saved_registers)
+    {
+        emit("mov " + saved_register_slot(offset) + ", " + reg);
+    }
+}
+
+void CodeGenerator::emit_frame_teardown()
+{
+    for (const auto& [reg, offset] : saved_registers)
+    {
+        emit("mov " + reg + ", " + saved_register_slot(offset));
     }
+    if (frameless)
+        return;
+    // nothing but the prologue moves rsp
+    if (frame_size > 0)
+        emit("mov rsp, rbp");
+    emit("pop rbp");
 }
 
 } // namespace codegen
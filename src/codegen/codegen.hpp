@@ -1,30 +1,97 @@
 #pragma once
 
+#include "../ir/function.hpp"
 #include "../ir/tac.hpp"
+#include "../support/thread_pool.hpp"
+#include "instruction_selector.hpp"
+#include "line_sink.hpp"
+#include "peephole.hpp"
+#include "scheduler.hpp"
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace codegen {
 
+// Generates NASM assembly for a program. The optimization level selects the
+// passes over the assembly: from level 2 on, basic blocks are list scheduled.
+// The functions are generated in parallel on `pool`, a few per thread at a
+// time, each by a generator of its own, and joined in program order, so the
+// assembly is the same for any number of threads.
 class CodeGenerator {
   public:
-    std::string generate(const ir::Program& program);
+    CodeGenerator(int level, support::ThreadPool& pool) : level(level), pool(&pool) {}
+
+    // gives `sink` the assembly, a function at a time once the sections
+    // before the code are out
+    void generate(const ir::Program& program, const LineSink& sink);
+
+    const Peephole& get_peephole() const { return peephole; }
 
   private:
+    // what the functions of a program share: its globals, and the labels of
+    // its string literals by their contents
+    struct Module {
+        std::unordered_set<std::string> globals;
+        std::unordered_map<std::string, std::string> string_literals;
+    };
+
+    // a generator for one function of `module`
+    CodeGenerator(int level, const Module& module) : level(level), module(&module) {}
+
+    int level;
+    support::ThreadPool* pool = nullptr;
+    const Module* module = nullptr;
     std::vector<std::string> output;
-    std::unordered_set<std::string> variables;
-    std::unordered_map<std::string, std::string> string_literals;
-    int next_string_id = 0;
+    // the jump tables of the function, for the read-only data section
+    std::vector<std::string> rodata;
+    int switches = 0; // dispatches emitted so far, for their labels
+
+    // where the values of the function being generated live: a register or a
+    // slot of its frame
+    std::unordered_map<std::string, std::string> locations;
+    // callee-saved registers the function uses, with the frame offsets they
+    // are saved at
+    std::vector<std::pair<std::string, int>> saved_registers;
+    int frame_size = 0; // a multiple of 16
+    // a leaf function whose frame lies in the red zone below rsp, addressed
+    // from rsp without setting up rbp
+    bool frameless = false;
+    // the expression trees of the function being generated
+    InstructionSelector selector;
+    Peephole peephole;
+    Scheduler scheduler;
 
     void emit(const std::string& instr) { output.push_back("    " + instr); }
 
     void emit_label(const std::string& label) { output.push_back(label + ":"); }
 
     std::string map_operand(const ir::Operand& op);
-    void collect_variables(const ir::Program& program);
+    bool in_register(const ir::Operand& op) const;
+    // the operand with an explicit size, unless it is a register
+    std::string sized_operand(const ir::Operand& op);
+    void allocate_frame(ir::Function& function,
+                        const std::vector<size_t>& evaluated_at);
+    // where the callee-saved register saved at `offset` below the frame base is
+    std::string saved_register_slot(int offset) const;
+    void emit_frame_setup();
+    void emit_frame_teardown();
+    // moves the PARAMs right before `call` to where the callee expects them
+    void emit_arguments(const ir::Instruction& call);
+    // Dispatches on `subject` to the label of the case equal to it, or to
+    // `otherwise`, with a table of jumps when the values are dense and by
+    // binary search when not. The first of two cases with one value wins.
+    void emit_switch(const std::string& function,
+                     const ir::Operand& subject,
+                     std::vector<std::pair<int64_t, std::string>> cases,
+                     const std::string& otherwise);
+    void generate_function(const ir::Function& function);
+    // the code of `function` with the passes over it, into `output`
+    void generate_text(ir::Function& function);
 };
 
 } // namespace codegen
@@ -0,0 +1,239 @@
+#include "elf_writer.hpp"
+
+#include <elf.h>
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace codegen {
+
+namespace {
+
+// the section header indices, in the order the sections are written
+enum : uint16_t {
+    NULL_SECTION,
+    TEXT,
+    RODATA,
+    DATA,
+    BSS,
+    NOTE_STACK,
+    SYMTAB,
+    STRTAB,
+    RELA_TEXT,
+    SHSTRTAB,
+    SECTION_COUNT,
+};
+
+// a string table under construction
+struct Strings {
+    std::string bytes{'\0'};
+
+    uint32_t add(const std::string& name)
+    {
+        uint32_t offset = uint32_t(bytes.size());
+        bytes += name;
+        bytes += '\0';
+        return offset;
+    }
+};
+
+template <typename T>
+void append(std::vector<uint8_t>& bytes, const T& value)
+{
+    const auto* raw = reinterpret_cast<const uint8_t*>(&value);
+    bytes.insert(bytes.end(), raw, raw + sizeof(T));
+}
+
+uint16_t section_index(ObjectCode::Section section)
+{
+    switch (section)
+    {
+    case ObjectCode::Section::TEXT: return TEXT;
+    case ObjectCode::Section::RODATA: return RODATA;
+    case ObjectCode::Section::DATA: return DATA;
+    case ObjectCode::Section::BSS: return BSS;
+    case ObjectCode::Section::UNDEFINED: return SHN_UNDEF;
+    }
+    return SHN_UNDEF;
+}
+
+uint32_t relocation_type(ObjectCode::RelocationKind kind)
+{
+    switch (kind)
+    {
+    case ObjectCode::RelocationKind::ABSOLUTE64: return R_X86_64_64;
+    case ObjectCode::RelocationKind::PC_RELATIVE32: return R_X86_64_PC32;
+    case ObjectCode::RelocationKind::CALL32: return R_X86_64_PLT32;
+    }
+    return R_X86_64_NONE;
+}
+
+} // namespace
+
+void write_elf_object(const ObjectCode& object, std::ostream& out)
+{
+    // symbols: the null symbol, the sections, then the locals before the
+    // globals as the format requires
+    Strings names;
+    std::vector<Elf64_Sym> symbols(1, Elf64_Sym{});
+    for (uint16_t section : {TEXT, RODATA, DATA, BSS})
+    {
+        Elf64_Sym symbol{};
+        symbol.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        symbol.st_shndx = section;
+        symbols.push_back(symbol);
+    }
+    std::unordered_map<std::string, uint32_t> symbol_index;
+    uint32_t first_global = 0;
+    for (bool global : {false, true})
+    {
+        if (global)
+            first_global = uint32_t(symbols.size());
+        for (const ObjectCode::Symbol& s : object.symbols)
+        {
+            if (s.global != global)
+                continue;
+            Elf64_Sym symbol{};
+            symbol.st_name = names.add(s.name);
+            // labels in the code are plain addresses, as an assembler leaves them
+            bool object_data = s.section == ObjectCode::Section::RODATA ||
+                               s.section == ObjectCode::Section::DATA ||
+                               s.section == ObjectCode::Section::BSS;
+            int type = s.function ? STT_FUNC : object_data ? STT_OBJECT : STT_NOTYPE;
+            symbol.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, type);
+            symbol.st_shndx = section_index(s.section);
+            symbol.st_value = s.offset;
+            symbol_index[s.name] = uint32_t(symbols.size());
+            symbols.push_back(symbol);
+        }
+    }
+
+    std::vector<Elf64_Rela> relocations;
+    for (const ObjectCode::Relocation& r : object.relocations)
+    {
+        Elf64_Rela relocation{};
+        relocation.r_offset = r.offset;
+        relocation.r_info =
+            ELF64_R_INFO(symbol_index.at(r.symbol), relocation_type(r.kind));
+        relocation.r_addend = r.addend;
+        relocations.push_back(relocation);
+    }
+
+    // the contents follow the ELF header, each section aligned to 16 bytes,
+    // and the section headers come last
+    Strings section_names;
+    std::vector<Elf64_Shdr> headers(SECTION_COUNT, Elf64_Shdr{});
+    std::vector<uint8_t> contents;
+    auto place = [&](uint16_t index,
+                     const char* name,
+                     uint32_t type,
+                     uint64_t flags,
+                     const void* data,
+                     uint64_t size,
+                     uint64_t alignment)
+    {
+        while ((sizeof(Elf64_Ehdr) + contents.size()) % 16 != 0)
+        {
+            contents.push_back(0);
+        }
+        Elf64_Shdr& header = headers[index];
+        header.sh_name = section_names.add(name);
+        header.sh_type = type;
+        header.sh_flags = flags;
+        header.sh_offset = sizeof(Elf64_Ehdr) + contents.size();
+        header.sh_size = size;
+        header.sh_addralign = alignment;
+        if (type != SHT_NOBITS && data)
+        {
+            const auto* bytes = static_cast<const uint8_t*>(data);
+            contents.insert(contents.end(), bytes, bytes + size);
+        }
+    };
+
+    place(TEXT,
+          ".text",
+          SHT_PROGBITS,
+          SHF_ALLOC | SHF_EXECINSTR,
+          object.text.data(),
+          object.text.size(),
+          16);
+    place(RODATA,
+          ".rodata",
+          SHT_PROGBITS,
+          SHF_ALLOC,
+          object.rodata.data(),
+          object.rodata.size(),
+          8);
+    place(DATA,
+          ".data",
+          SHT_PROGBITS,
+          SHF_ALLOC | SHF_WRITE,
+          object.data.data(),
+          object.data.size(),
+          8);
+    place(BSS, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, nullptr, object.bss_size, 8);
+    place(NOTE_STACK, ".note.GNU-stack", SHT_PROGBITS, 0, nullptr, 0, 1);
+    place(SYMTAB,
+          ".symtab",
+          SHT_SYMTAB,
+          0,
+          symbols.data(),
+          symbols.size() * sizeof(Elf64_Sym),
+          8);
+    headers[SYMTAB].sh_link = STRTAB;
+    headers[SYMTAB].sh_info = first_global;
+    headers[SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    place(STRTAB, ".strtab", SHT_STRTAB, 0, names.bytes.data(), names.bytes.size(), 1);
+    place(RELA_TEXT,
+          ".rela.text",
+          SHT_RELA,
+          SHF_INFO_LINK,
+          relocations.data(),
+          relocations.size() * sizeof(Elf64_Rela),
+          8);
+    headers[RELA_TEXT].sh_link = SYMTAB;
+    headers[RELA_TEXT].sh_info = TEXT;
+    headers[RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+    // its own name has to be in the table before it is placed
+    uint32_t shstrtab_name = section_names.add(".shstrtab");
+    place(SHSTRTAB,
+          "",
+          SHT_STRTAB,
+          0,
+          section_names.bytes.data(),
+          section_names.bytes.size(),
+          1);
+    headers[SHSTRTAB].sh_name = shstrtab_name;
+    while (contents.size() % 8 != 0)
+    {
+        contents.push_back(0);
+    }
+
+    Elf64_Ehdr header{};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = sizeof(Elf64_Ehdr) + contents.size();
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = SECTION_COUNT;
+    header.e_shstrndx = SHSTRTAB;
+
+    std::vector<uint8_t> file;
+    append(file, header);
+    file.insert(file.end(), contents.begin(), contents.end());
+    for (const Elf64_Shdr& section : headers)
+    {
+        append(file, section);
+    }
+    out.write(reinterpret_cast<const char*>(file.data()), std::streamsize(file.size()));
+}
+
+} // namespace codegen
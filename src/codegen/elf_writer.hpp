@@ -0,0 +1,16 @@
+#pragma once
+
+#include "encoder.hpp"
+
+#include <ostream>
+
+namespace codegen {
+
+// Writes `object` as an ELF64 relocatable object for x86-64, with the text,
+// read-only data, data and bss sections, a symbol table and the relocations
+// of the text, as the system linker (through gcc or ld) takes it. The stack
+// is marked non-executable, as the NASM output does with its .note.GNU-stack
+// section.
+void write_elf_object(const ObjectCode& object, std::ostream& out);
+
+} // namespace codegen
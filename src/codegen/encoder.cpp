@@ -0,0 +1,883 @@
+#include "encoder.hpp"
+
+#include "assembly.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace codegen {
+
+namespace {
+
+using Relocation = ObjectCode::Relocation;
+using RelocationKind = ObjectCode::RelocationKind;
+using Section = ObjectCode::Section;
+
+struct Register {
+    int number; // as encoded, with bit 3 going into a REX prefix
+    int size;   // in bits
+    bool needs_rex = false; // spl, bpl, sil and dil
+};
+
+const char* const names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                               "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15"};
+const char* const names32[] = {
+    "eax", "ecx", "edx",  "ebx",  "esp",  "ebp",  "esi",  "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+const char* const names8[] = {
+    "al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+std::optional<Register> register_named(const std::string& name)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        if (name == names64[i])
+            return Register{i, 64};
+        if (name == names32[i])
+            return Register{i, 32};
+        if (name == names8[i])
+            return Register{i, 8, i >= 4 && i < 8};
+    }
+    return std::nullopt;
+}
+
+const std::unordered_map<std::string, int> condition_codes = {
+    {"o", 0x0},  {"no", 0x1}, {"b", 0x2},   {"c", 0x2},  {"nae", 0x2}, {"ae", 0x3},
+    {"nb", 0x3}, {"nc", 0x3}, {"e", 0x4},   {"z", 0x4},  {"ne", 0x5},  {"nz", 0x5},
+    {"be", 0x6}, {"na", 0x6}, {"a", 0x7},   {"nbe", 0x7}, {"s", 0x8},  {"ns", 0x9},
+    {"p", 0xa},  {"pe", 0xa}, {"np", 0xb},  {"po", 0xb}, {"l", 0xc},   {"nge", 0xc},
+    {"ge", 0xd}, {"nl", 0xd}, {"le", 0xe},  {"ng", 0xe}, {"g", 0xf},   {"nle", 0xf},
+};
+
+// the condition code of a jcc, setcc or cmovcc
+std::optional<int> condition_of(const std::string& mnemonic, const std::string& prefix)
+{
+    if (!mnemonic.starts_with(prefix))
+        return std::nullopt;
+    auto code = condition_codes.find(mnemonic.substr(prefix.size()));
+    if (code == condition_codes.end())
+        return std::nullopt;
+    return code->second;
+}
+
+// the /digit of the group 1 arithmetic instructions
+const std::unordered_map<std::string, int> arithmetic = {
+    {"add", 0}, {"or", 1}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7},
+};
+
+const std::unordered_map<std::string, int> shifts = {
+    {"shl", 4}, {"shr", 5}, {"sar", 7}};
+
+struct Operand {
+    enum Kind { REGISTER, MEMORY, IMMEDIATE } kind = IMMEDIATE;
+    Register reg{};
+    int base = -1;
+    int index = -1;
+    int scale = 1;
+    int64_t value = 0;  // an immediate, or the displacement of an address
+    std::string symbol; // an address as an immediate, or the memory addressed
+    int size = 64;      // of memory, from its size keyword
+};
+
+bool is_number(const std::string& text)
+{
+    size_t digits = !text.empty() && text.front() == '-' ? 1 : 0;
+    return digits < text.size() &&
+           std::isdigit(static_cast<unsigned char>(text[digits]));
+}
+
+Operand operand_of(const std::string& text)
+{
+    Operand operand;
+    if (auto reg = register_named(text))
+    {
+        operand.kind = Operand::REGISTER;
+        operand.reg = *reg;
+        return operand;
+    }
+
+    size_t open = text.find('[');
+    if (open == std::string::npos)
+    {
+        if (is_number(text))
+            operand.value = std::stoll(text);
+        else
+            operand.symbol = text;
+        return operand;
+    }
+
+    operand.kind = Operand::MEMORY;
+    if (text.starts_with("byte"))
+        operand.size = 8;
+    else if (text.starts_with("dword"))
+        operand.size = 32;
+    std::istringstream in(text.substr(open + 1, text.find(']') - open - 1));
+    int sign = 1;
+    for (std::string term; in >> term;)
+    {
+        if (term == "+" || term == "-")
+        {
+            sign = term == "+" ? 1 : -1;
+            continue;
+        }
+        size_t star = term.find('*');
+        auto reg = register_named(term.substr(0, star));
+        if (star != std::string::npos)
+        {
+            if (!reg)
+                throw std::logic_error("cannot encode the address " + text);
+            operand.index = reg->number;
+            operand.scale = std::stoi(term.substr(star + 1));
+        }
+        else if (reg && operand.base < 0)
+        {
+            operand.base = reg->number;
+        }
+        else if (reg)
+        {
+            operand.index = reg->number;
+        }
+        else if (is_number(term))
+        {
+            operand.value += sign * std::stoll(term);
+        }
+        else
+        {
+            operand.symbol = term;
+        }
+        sign = 1;
+    }
+    if (!operand.symbol.empty() && (operand.base >= 0 || operand.index >= 0))
+        throw std::logic_error("cannot encode the address " + text);
+    return operand;
+}
+
+bool fits_int8(int64_t value)
+{
+    return value >= std::numeric_limits<int8_t>::min() &&
+           value <= std::numeric_limits<int8_t>::max();
+}
+
+bool fits_int32(int64_t value)
+{
+    return value >= std::numeric_limits<int32_t>::min() &&
+           value <= std::numeric_limits<int32_t>::max();
+}
+
+// the bytes of one instruction, with relocations relative to its start
+struct Code {
+    std::vector<uint8_t> bytes;
+    std::vector<Relocation> relocations;
+
+    void byte(int value) { bytes.push_back(uint8_t(value)); }
+
+    void immediate(int64_t value, int size)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            byte(int(value >> (8 * i)) & 0xff);
+        }
+    }
+};
+
+// Emits a REX prefix if one is needed, the opcode and the ModRM byte with
+// `reg_field` and the register or memory operand `rm`, followed by its SIB
+// byte and displacement. `immediate_size` bytes of immediate are still to
+// come, which a rip-relative displacement has to account for.
+void encode_rm(Code& code,
+               std::initializer_list<int> opcode,
+               int reg_field,
+               const Operand& rm,
+               bool wide,
+               int immediate_size = 0,
+               bool force_rex = false)
+{
+    int rex = 0x40 | (wide ? 8 : 0) | (reg_field & 8 ? 4 : 0);
+    if (rm.kind == Operand::REGISTER)
+    {
+        rex |= rm.reg.number & 8 ? 1 : 0;
+        force_rex |= rm.reg.needs_rex;
+    }
+    else
+    {
+        rex |= (rm.index >= 8 ? 2 : 0) | (rm.base >= 8 ? 1 : 0);
+    }
+    if (rex != 0x40 || force_rex)
+        code.byte(rex);
+    for (int op : opcode)
+    {
+        code.byte(op);
+    }
+
+    auto modrm = [&](int mod, int rm_field)
+    { code.byte(mod << 6 | (reg_field & 7) << 3 | rm_field); };
+    if (rm.kind == Operand::REGISTER)
+    {
+        modrm(3, rm.reg.number & 7);
+        return;
+    }
+
+    if (rm.base < 0 && rm.index < 0)
+    {
+        if (rm.symbol.empty())
+            throw std::logic_error("absolute addresses are not supported");
+        // rip-relative, from the end of the instruction
+        modrm(0, 5);
+        code.relocations.push_back({code.bytes.size(),
+                                    rm.symbol,
+                                    RelocationKind::PC_RELATIVE32,
+                                    rm.value - 4 - immediate_size});
+        code.immediate(0, 4);
+        return;
+    }
+
+    int scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+    if (rm.base < 0)
+    {
+        // an index alone always takes a 32-bit displacement
+        modrm(0, 4);
+        code.byte(scale_bits << 6 | (rm.index & 7) << 3 | 5);
+        code.immediate(rm.value, 4);
+        return;
+    }
+
+    // rbp and r13 as a base cannot go without a displacement
+    int mod = rm.value == 0 && (rm.base & 7) != 5 ? 0 : fits_int8(rm.value) ? 1 : 2;
+    if (rm.index >= 0 || (rm.base & 7) == 4)
+    {
+        // rsp and r12 as a base need a SIB byte
+        modrm(mod, 4);
+        int index = rm.index >= 0 ? rm.index & 7 : 4;
+        code.byte(scale_bits << 6 | index << 3 | (rm.base & 7));
+    }
+    else
+    {
+        modrm(mod, rm.base & 7);
+    }
+    if (mod == 1)
+        code.immediate(rm.value, 1);
+    else if (mod == 2)
+        code.immediate(rm.value, 4);
+}
+
+// whether the operation is on 64 bits, from the size of its operands
+bool is_wide(const std::vector<Operand>& operands)
+{
+    for (const Operand& operand : operands)
+    {
+        if (operand.kind == Operand::REGISTER && operand.reg.size != 8)
+            return operand.reg.size == 64;
+    }
+    for (const Operand& operand : operands)
+    {
+        if (operand.kind == Operand::MEMORY)
+            return operand.size == 64;
+    }
+    return true;
+}
+
+[[noreturn]] void unsupported(const Line& line)
+{
+    throw std::logic_error("cannot encode `" + format_line(line).substr(4) + "`");
+}
+
+// Encodes any instruction but the direct jumps and calls, whose encoding
+// depends on where their target ends up.
+Code encode_instruction(const Line& line)
+{
+    Code code;
+    const std::string& m = line.mnemonic;
+    std::vector<Operand> ops;
+    for (const std::string& text : line.operands)
+    {
+        ops.push_back(operand_of(text));
+    }
+    bool wide = is_wide(ops);
+    auto is = [&](size_t k, Operand::Kind kind)
+    { return k < ops.size() && ops[k].kind == kind; };
+    // the byte forms of mov, test and arithmetic have the opcode one below
+    bool bytes = (is(0, Operand::REGISTER) && ops[0].reg.size == 8) ||
+                 (is(0, Operand::MEMORY) && ops[0].size == 8);
+    int w = bytes ? 0 : 1;
+    // spl, bpl, sil and dil take a REX prefix in either place
+    bool byte_rex = is(1, Operand::REGISTER) && ops[1].reg.needs_rex;
+
+    if (auto digit = arithmetic.find(m); digit != arithmetic.end() && ops.size() == 2)
+    {
+        int n = digit->second;
+        if (is(1, Operand::REGISTER))
+        {
+            encode_rm(code,
+                      {0x00 + w + 8 * n},
+                      ops[1].reg.number,
+                      ops[0],
+                      wide,
+                      0,
+                      byte_rex);
+        }
+        else if (is(0, Operand::REGISTER) && is(1, Operand::MEMORY))
+        {
+            encode_rm(code, {0x02 + w + 8 * n}, ops[0].reg.number, ops[1], wide);
+        }
+        else if (bytes && is(1, Operand::IMMEDIATE) && fits_int8(ops[1].value))
+        {
+            encode_rm(code, {0x80}, n, ops[0], false, 1);
+            code.immediate(ops[1].value, 1);
+        }
+        else if (is(1, Operand::IMMEDIATE) && ops[1].symbol.empty() &&
+                 fits_int32(ops[1].value))
+        {
+            bool small = fits_int8(ops[1].value);
+            encode_rm(code, {small ? 0x83 : 0x81}, n, ops[0], wide, small ? 1 : 4);
+            code.immediate(ops[1].value, small ? 1 : 4);
+        }
+        else
+        {
+            unsupported(line);
+        }
+    }
+    else if (m == "test" && ops.size() == 2 && is(1, Operand::REGISTER))
+    {
+        encode_rm(code, {0x84 + w}, ops[1].reg.number, ops[0], wide, 0, byte_rex);
+    }
+    else if (m == "test" && ops.size() == 2 && is(1, Operand::IMMEDIATE))
+    {
+        encode_rm(code, {0xf6 + w}, 0, ops[0], wide, bytes ? 1 : 4);
+        code.immediate(ops[1].value, bytes ? 1 : 4);
+    }
+    else if (m == "mov" && ops.size() == 2)
+    {
+        if (is(1, Operand::REGISTER))
+        {
+            encode_rm(code, {0x88 + w}, ops[1].reg.number, ops[0], wide, 0, byte_rex);
+        }
+        else if (is(0, Operand::REGISTER) && is(1, Operand::MEMORY))
+        {
+            encode_rm(code, {0x8a + w}, ops[0].reg.number, ops[1], wide);
+        }
+        else if (bytes && is(1, Operand::IMMEDIATE) && ops[1].symbol.empty())
+        {
+            encode_rm(code, {0xc6}, 0, ops[0], false, 1);
+            code.immediate(ops[1].value, 1);
+        }
+        else if (is(0, Operand::REGISTER))
+        {
+            int number = ops[0].reg.number;
+            int64_t value = ops[1].value;
+            bool symbol = !ops[1].symbol.empty();
+            if (!symbol && (!wide || (value >= 0 && value <= 0xffffffff)))
+            {
+                // a 32-bit mov clears the upper half
+                if (number & 8)
+                    code.byte(0x41);
+                code.byte(0xb8 + (number & 7));
+                code.immediate(value, 4);
+            }
+            else if (!symbol && fits_int32(value))
+            {
+                encode_rm(code, {0xc7}, 0, ops[0], true, 4);
+                code.immediate(value, 4);
+            }
+            else
+            {
+                code.byte(0x48 | (number & 8 ? 1 : 0));
+                code.byte(0xb8 + (number & 7));
+                if (symbol)
+                    code.relocations.push_back({code.bytes.size(),
+                                                ops[1].symbol,
+                                                RelocationKind::ABSOLUTE64,
+                                                0});
+                code.immediate(value, 8);
+            }
+        }
+        else if (is(0, Operand::MEMORY) && ops[1].symbol.empty() &&
+                 fits_int32(ops[1].value))
+        {
+            encode_rm(code, {0xc7}, 0, ops[0], wide, 4);
+            code.immediate(ops[1].value, 4);
+        }
+        else
+        {
+            unsupported(line);
+        }
+    }
+    else if (m == "movzx" && ops.size() == 2 && is(0, Operand::REGISTER))
+    {
+        encode_rm(code, {0x0f, 0xb6}, ops[0].reg.number, ops[1], ops[0].reg.size == 64);
+    }
+    else if (m == "movsxd" && ops.size() == 2 && is(0, Operand::REGISTER) &&
+             !is(1, Operand::IMMEDIATE))
+    {
+        encode_rm(code, {0x63}, ops[0].reg.number, ops[1], true);
+    }
+    else if (m == "lea" && ops.size() == 2 && is(0, Operand::REGISTER) &&
+             is(1, Operand::MEMORY))
+    {
+        encode_rm(code, {0x8d}, ops[0].reg.number, ops[1], wide);
+    }
+    else if ((m == "inc" || m == "dec" || m == "neg") && ops.size() == 1)
+    {
+        int digit = m == "inc" ? 0 : m == "dec" ? 1 : 3;
+        encode_rm(code, {m == "neg" ? 0xf7 : 0xff}, digit, ops[0], wide);
+    }
+    else if (auto digit = shifts.find(m); digit != shifts.end() && ops.size() == 2)
+    {
+        int n = digit->second;
+        if (is(1, Operand::REGISTER) && line.operands[1] == "cl")
+        {
+            encode_rm(code, {0xd3}, n, ops[0], wide);
+        }
+        else if (is(1, Operand::IMMEDIATE) && ops[1].value == 1)
+        {
+            encode_rm(code, {0xd1}, n, ops[0], wide);
+        }
+        else if (is(1, Operand::IMMEDIATE))
+        {
+            encode_rm(code, {0xc1}, n, ops[0], wide, 1);
+            code.immediate(ops[1].value, 1);
+        }
+        else
+        {
+            unsupported(line);
+        }
+    }
+    else if (m == "mul" && ops.size() == 1)
+    {
+        encode_rm(code, {0xf7}, 4, ops[0], wide);
+    }
+    else if (m == "imul" && ops.size() == 1)
+    {
+        encode_rm(code, {0xf7}, 5, ops[0], wide);
+    }
+    else if (m == "imul" && ops.size() == 2 && is(0, Operand::REGISTER))
+    {
+        encode_rm(code, {0x0f, 0xaf}, ops[0].reg.number, ops[1], wide);
+    }
+    else if (m == "imul" && ops.size() == 3 && is(0, Operand::REGISTER) &&
+             is(2, Operand::IMMEDIATE) && fits_int32(ops[2].value))
+    {
+        bool small = fits_int8(ops[2].value);
+        encode_rm(code,
+                  {small ? 0x6b : 0x69},
+                  ops[0].reg.number,
+                  ops[1],
+                  wide,
+                  small ? 1 : 4);
+        code.immediate(ops[2].value, small ? 1 : 4);
+    }
+    else if ((m == "idiv" || m == "div") && ops.size() == 1)
+    {
+        encode_rm(code, {0xf7}, m == "idiv" ? 7 : 6, ops[0], wide);
+    }
+    else if (m == "cqo" && ops.empty())
+    {
+        code.byte(0x48);
+        code.byte(0x99);
+    }
+    else if (auto cc = condition_of(m, "cmov");
+             cc && ops.size() == 2 && is(0, Operand::REGISTER))
+    {
+        encode_rm(code, {0x0f, 0x40 + *cc}, ops[0].reg.number, ops[1], wide);
+    }
+    else if (auto cc = condition_of(m, "set"); cc && ops.size() == 1)
+    {
+        encode_rm(code, {0x0f, 0x90 + *cc}, 0, ops[0], false);
+    }
+    else if ((m == "push" || m == "pop") && ops.size() == 1 && is(0, Operand::REGISTER))
+    {
+        if (ops[0].reg.number & 8)
+            code.byte(0x41);
+        code.byte((m == "push" ? 0x50 : 0x58) + (ops[0].reg.number & 7));
+    }
+    else if (m == "jmp" && ops.size() == 1 && is(0, Operand::REGISTER))
+    {
+        // an indirect jump is 64-bit without REX.W
+        encode_rm(code, {0xff}, 4, ops[0], false);
+    }
+    else if (m == "ret" && ops.empty())
+    {
+        code.byte(0xc3);
+    }
+    else if (m == "syscall" && ops.empty())
+    {
+        code.bytes.insert(code.bytes.end(), {0x0f, 0x05});
+    }
+    else
+    {
+        unsupported(line);
+    }
+    return code;
+}
+
+// A piece of the text section: a label, an instruction encoded once and for
+// all, or a jump or call, whose form depends on the distance to its target.
+struct Item {
+    enum Kind { LABEL, CODE, BRANCH } kind;
+    std::string label; // of a LABEL, the target of a BRANCH
+    Code code;
+    int condition = -1; // of a conditional jump
+    bool call = false;
+    bool is_short = true;
+    uint64_t offset = 0;
+
+    uint64_t size() const
+    {
+        if (kind == LABEL)
+            return 0;
+        if (kind == CODE)
+            return code.bytes.size();
+        if (call)
+            return 5;
+        return is_short ? 2 : condition < 0 ? 5 : 6;
+    }
+};
+
+// the bytes a db directive lists: numbers and strings, those in backquotes
+// with C-style escapes
+std::vector<uint8_t> data_bytes(const std::string& operands)
+{
+    std::vector<uint8_t> bytes;
+    size_t i = 0;
+    auto hex_digits = [&](size_t limit)
+    {
+        int value = 0;
+        for (size_t n = 0;
+             n < limit && i < operands.size() && std::isxdigit(operands[i]);
+             ++n)
+        {
+            value = value * 16 + std::stoi(std::string(1, operands[i++]), nullptr, 16);
+        }
+        return value;
+    };
+    auto utf8 = [&](uint32_t code_point)
+    {
+        if (code_point < 0x80)
+        {
+            bytes.push_back(uint8_t(code_point));
+        }
+        else if (code_point < 0x800)
+        {
+            bytes.push_back(uint8_t(0xc0 | code_point >> 6));
+            bytes.push_back(uint8_t(0x80 | (code_point & 0x3f)));
+        }
+        else if (code_point < 0x10000)
+        {
+            bytes.push_back(uint8_t(0xe0 | code_point >> 12));
+            bytes.push_back(uint8_t(0x80 | (code_point >> 6 & 0x3f)));
+            bytes.push_back(uint8_t(0x80 | (code_point & 0x3f)));
+        }
+        else
+        {
+            bytes.push_back(uint8_t(0xf0 | code_point >> 18));
+            bytes.push_back(uint8_t(0x80 | (code_point >> 12 & 0x3f)));
+            bytes.push_back(uint8_t(0x80 | (code_point >> 6 & 0x3f)));
+            bytes.push_back(uint8_t(0x80 | (code_point & 0x3f)));
+        }
+    };
+
+    while (i < operands.size())
+    {
+        char c = operands[i];
+        if (c == ' ' || c == ',')
+        {
+            ++i;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            size_t end = operands.find(c, i + 1);
+            bytes.insert(bytes.end(), operands.begin() + i + 1, operands.begin() + end);
+            i = end + 1;
+        }
+        else if (c == '`')
+        {
+            for (++i; i < operands.size() && operands[i] != '`';)
+            {
+                if (operands[i] != '\\')
+                {
+                    bytes.push_back(uint8_t(operands[i++]));
+                    continue;
+                }
+                char escape = operands[++i];
+                ++i;
+                switch (escape)
+                {
+                case 'a': bytes.push_back('\a'); break;
+                case 'b': bytes.push_back('\b'); break;
+                case 't': bytes.push_back('\t'); break;
+                case 'n': bytes.push_back('\n'); break;
+                case 'v': bytes.push_back('\v'); break;
+                case 'f': bytes.push_back('\f'); break;
+                case 'r': bytes.push_back('\r'); break;
+                case 'e': bytes.push_back(0x1b); break;
+                case 'x': bytes.push_back(uint8_t(hex_digits(2))); break;
+                case 'u': utf8(uint32_t(hex_digits(4))); break;
+                case 'U': utf8(uint32_t(hex_digits(8))); break;
+                default:
+                    if (escape >= '0' && escape <= '7')
+                    {
+                        int value = escape - '0';
+                        for (int n = 1;
+                             n < 3 && operands[i] >= '0' && operands[i] <= '7';
+                             ++n)
+                        {
+                            value = value * 8 + (operands[i++] - '0');
+                        }
+                        bytes.push_back(uint8_t(value));
+                    }
+                    else
+                    {
+                        bytes.push_back(uint8_t(escape)); // quotes, ? and the backslash
+                    }
+                }
+            }
+            ++i;
+        }
+        else
+        {
+            size_t end = operands.find(',', i);
+            bytes.push_back(uint8_t(std::stoi(operands.substr(i, end - i))));
+            i = end == std::string::npos ? operands.size() : end;
+        }
+    }
+    return bytes;
+}
+
+} // namespace
+
+ObjectCode Encoder::encode(const std::function<void(const LineSink&)>& generate)
+{
+    ObjectCode object;
+    std::vector<std::string> externs;
+    std::vector<std::string> globals;
+    std::vector<Item> items;
+    // read-only data, data and bss labels, in order
+    std::vector<ObjectCode::Symbol> data_symbols;
+    // the label differences of the dd directives, by where they go
+    std::vector<std::pair<uint64_t, std::pair<std::string, std::string>>> differences;
+
+    std::string section;
+    LineSink add = [&](const std::vector<std::string>& assembly)
+    {
+        for (const std::string& text : assembly)
+        {
+            if (text.starts_with("section "))
+            {
+                section = text.substr(8, text.find(' ', 8) - 8);
+                continue;
+            }
+            if (text.starts_with("extern "))
+            {
+                externs.push_back(text.substr(7));
+                continue;
+            }
+            if (text.starts_with("global "))
+            {
+                globals.push_back(text.substr(7));
+                continue;
+            }
+
+            if (section == ".data" || section == ".bss")
+            {
+                // name: db ... or name: resq n
+                size_t colon = text.find(':');
+                if (colon == std::string::npos)
+                    continue;
+                std::string name = text.substr(text.find_first_not_of(' '));
+                name = name.substr(0, name.find(':'));
+                std::istringstream directive(text.substr(colon + 1));
+                std::string kind;
+                directive >> kind;
+                std::string rest = text.substr(text.find(kind, colon) + kind.size());
+                if (kind == "db")
+                {
+                    data_symbols.push_back(
+                        {name, Section::DATA, object.data.size(), false, false});
+                    std::vector<uint8_t> bytes = data_bytes(rest);
+                    object.data.insert(object.data.end(), bytes.begin(), bytes.end());
+                }
+                else if (kind == "resq")
+                {
+                    data_symbols.push_back(
+                        {name, Section::BSS, object.bss_size, false, false});
+                    object.bss_size += 8 * std::stoull(rest);
+                }
+                else
+                {
+                    throw std::logic_error("cannot encode the directive " + kind);
+                }
+                continue;
+            }
+            if (section == ".rodata")
+            {
+                // name: or dd a - b, c - d, ...
+                std::string line =
+                    text.substr(std::min(text.find_first_not_of(' '), text.size()));
+                if (line.ends_with(':'))
+                {
+                    data_symbols.push_back({line.substr(0, line.size() - 1),
+                                            Section::RODATA,
+                                            object.rodata.size(),
+                                            false,
+                                            false});
+                }
+                else if (line.starts_with("dd "))
+                {
+                    std::istringstream entries(line.substr(3));
+                    for (std::string entry; std::getline(entries, entry, ',');)
+                    {
+                        std::istringstream terms(entry);
+                        std::string target, minus, base;
+                        if (!(terms >> target >> minus >> base) || minus != "-")
+                            throw std::logic_error("cannot encode the entry " + entry);
+                        differences.push_back({object.rodata.size(), {target, base}});
+                        object.rodata.resize(object.rodata.size() + 4);
+                    }
+                }
+                else if (!line.empty())
+                {
+                    throw std::logic_error("cannot encode the directive " + line);
+                }
+                continue;
+            }
+            if (section != ".text")
+                continue;
+
+            Line line = parse_line(text);
+            if (line.is_label)
+            {
+                items.push_back({Item::LABEL, line.text, {}});
+            }
+            else if (!line.is_instruction)
+            {
+                continue;
+            }
+            else if (line.mnemonic == "call" ||
+                     (line.mnemonic == "jmp" && !register_named(line.operands.at(0))) ||
+                     condition_of(line.mnemonic, "j"))
+            {
+                Item branch{Item::BRANCH, line.operands.at(0), {}};
+                branch.call = line.mnemonic == "call";
+                branch.is_short = !branch.call;
+                if (line.mnemonic != "call" && line.mnemonic != "jmp")
+                    branch.condition = *condition_of(line.mnemonic, "j");
+                items.push_back(std::move(branch));
+            }
+            else
+            {
+                items.push_back({Item::CODE, {}, encode_instruction(line)});
+            }
+        }
+    };
+    generate(add);
+
+    // lay the code out with every jump short, then lengthen those that do
+    // not reach until none has to change
+    std::unordered_map<std::string, uint64_t> label_offsets;
+    for (bool changed = true; changed;)
+    {
+        uint64_t offset = 0;
+        for (Item& item : items)
+        {
+            item.offset = offset;
+            offset += item.size();
+            if (item.kind == Item::LABEL)
+                label_offsets[item.label] = item.offset;
+        }
+
+        changed = false;
+        for (Item& item : items)
+        {
+            if (item.kind != Item::BRANCH || !item.is_short)
+                continue;
+            auto target = label_offsets.find(item.label);
+            if (target == label_offsets.end())
+                throw std::logic_error("jump to the undefined label " + item.label);
+            int64_t distance =
+                int64_t(target->second) - int64_t(item.offset + item.size());
+            if (!fits_int8(distance))
+            {
+                item.is_short = false;
+                changed = true;
+            }
+        }
+    }
+
+    for (const Item& item : items)
+    {
+        if (item.kind == Item::LABEL)
+        {
+            bool global =
+                std::find(globals.begin(), globals.end(), item.label) != globals.end();
+            object.symbols.push_back(
+                {item.label, Section::TEXT, item.offset, global, global});
+            continue;
+        }
+        if (item.kind == Item::CODE)
+        {
+            for (Relocation relocation : item.code.relocations)
+            {
+                relocation.offset += item.offset;
+                object.relocations.push_back(relocation);
+            }
+            object.text.insert(
+                object.text.end(), item.code.bytes.begin(), item.code.bytes.end());
+            continue;
+        }
+
+        Code code;
+        if (item.call)
+            code.byte(0xe8);
+        else if (item.condition < 0)
+            code.byte(item.is_short ? 0xeb : 0xe9);
+        else if (item.is_short)
+            code.byte(0x70 + item.condition);
+        else
+            code.bytes.insert(code.bytes.end(), {0x0f, uint8_t(0x80 + item.condition)});
+
+        int size = item.is_short ? 1 : 4;
+        auto target = label_offsets.find(item.label);
+        if (target != label_offsets.end())
+        {
+            code.immediate(
+                int64_t(target->second) - int64_t(item.offset + item.size()), size);
+        }
+        else if (item.call)
+        {
+            object.relocations.push_back(
+                {item.offset + 1, item.label, RelocationKind::CALL32, -4});
+            code.immediate(0, 4);
+        }
+        object.text.insert(object.text.end(), code.bytes.begin(), code.bytes.end());
+    }
+
+    for (const auto& [offset, labels] : differences)
+    {
+        auto target = label_offsets.find(labels.first);
+        auto base = label_offsets.find(labels.second);
+        if (target == label_offsets.end() || base == label_offsets.end())
+            throw std::logic_error("difference of undefined labels " + labels.first +
+                                   " - " + labels.second);
+        int64_t distance = int64_t(target->second) - int64_t(base->second);
+        for (int i = 0; i < 4; ++i)
+        {
+            object.rodata[offset + i] = uint8_t(distance >> (8 * i));
+        }
+    }
+
+    object.symbols.insert(
+        object.symbols.end(), data_symbols.begin(), data_symbols.end());
+    for (const std::string& name : externs)
+    {
+        object.symbols.push_back({name, Section::UNDEFINED, 0, true, false});
+    }
+    return object;
+}
+
+} // namespace codegen
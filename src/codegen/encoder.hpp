@@ -0,0 +1,63 @@
+#pragma once
+
+#include "line_sink.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace codegen {
+
+// The machine code and data of a program, with the symbols it defines and
+// uses and the places in its code that refer to them.
+struct ObjectCode {
+    enum class Section { TEXT, RODATA, DATA, BSS, UNDEFINED };
+
+    enum class RelocationKind {
+        ABSOLUTE64,    // the address of the symbol
+        PC_RELATIVE32, // the address relative to the place, as in rip-relative operands
+        CALL32,        // the same, for a call that may go through the PLT
+    };
+
+    struct Symbol {
+        std::string name;
+        Section section;
+        uint64_t offset;
+        bool global;
+        bool function;
+    };
+
+    // a place in the code to fill in with the address of `symbol` plus `addend`
+    struct Relocation {
+        uint64_t offset;
+        std::string symbol;
+        RelocationKind kind;
+        int64_t addend;
+    };
+
+    std::vector<uint8_t> text;
+    std::vector<uint8_t> rodata;
+    std::vector<uint8_t> data;
+    uint64_t bss_size = 0;
+    std::vector<Symbol> symbols;
+    std::vector<Relocation> relocations;
+};
+
+// Built-in assembler for the x86-64 code the code generator produces.
+//
+// Takes the NASM source as generated, one line each, so the text output
+// stays the single description of the program, and encodes the instructions
+// and data directives it uses. The lines come in batches as they are
+// generated, without the whole source ever being held. Jumps are encoded in
+// their short form wherever their target is near enough, which takes a few
+// passes over the code to settle.
+// Symbols that are not defined in it are left to relocations. The read-only
+// data only holds differences of labels in the code, known once it is laid out.
+class Encoder {
+  public:
+    // `generate` gives the sink it is passed the source, in order
+    ObjectCode encode(const std::function<void(const LineSink&)>& generate);
+};
+
+} // namespace codegen
@@ -0,0 +1,909 @@
+#include "instruction_selector.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+
+namespace codegen {
+
+namespace {
+
+enum Nonterminal {
+    REG,   // a register
+    RM,    // a register or a memory operand
+    IMM,   // an immediate that fits a sign-extended 32-bit field
+    INDEX, // a register scaled by 2, 4 or 8
+    SUM,   // a base register plus an index
+    ADDR,  // anything lea computes
+    FLAGS, // the flags, set so that a condition holds exactly when the value is nonzero
+    nonterminal_count
+};
+
+enum class Shape {
+    LEAF,  // matches an operand
+    NODE,  // matches an operation whose operands reduce to the rule's kids
+    CHAIN, // turns one nonterminal of the same node into another
+};
+
+constexpr int unreachable = 1 << 20;
+
+// the most scratch registers a tree may need at once: one for its value and
+// two more while it is being computed
+constexpr int scratch_limit = 3;
+
+} // namespace
+
+struct Rule;
+
+struct SelectionNode {
+    ir::OpCode op = ir::OpCode::ASSIGN;    // of an operation
+    const ir::Operand* operand = nullptr; // of a leaf
+    std::vector<SelectionNode*> kids;
+    // scratch registers the node needs, as Sethi-Ullman numbers count them
+    int need = 1;
+
+    // filled in by labeling
+    std::string location;
+    std::array<int, nonterminal_count> cost;
+    std::array<const Rule*, nonterminal_count> rule;
+};
+
+namespace {
+
+using Node = SelectionNode;
+
+// the result of reducing a node
+struct Value {
+    std::string text;                      // a register, memory operand or immediate
+    ir::OpCode condition = ir::OpCode::NE; // FLAGS: when the value is nonzero
+    std::string base;                      // INDEX, SUM, ADDR
+    std::string index;
+    int scale = 1;
+    int64_t displacement = 0;
+
+    std::string address() const
+    {
+        std::string text = base;
+        if (!index.empty())
+        {
+            text += (text.empty() ? "" : " + ") + index;
+            if (scale != 1)
+                text += "*" + std::to_string(scale);
+        }
+        if (displacement > 0)
+            text += " + " + std::to_string(displacement);
+        else if (displacement < 0)
+            text += " - " + std::to_string(-displacement);
+        return "[" + text + "]";
+    }
+};
+
+// Hands out the scratch registers of one tree and emits its code. Registers
+// are taken and given back in stack order.
+class Reducer {
+  public:
+    Reducer(const InstructionSelector::Emit& emit, std::vector<std::string> free)
+        : emit(emit), free(std::move(free))
+    {
+    }
+
+    const InstructionSelector::Emit& emit;
+
+    Value reduce(const Node& node, Nonterminal goal, const std::string& target);
+
+    // the node in a register: `target`, or the register a leaf already is in
+    std::string reg(const Node& node, const std::string& target)
+    {
+        return reduce(node, REG, target).text;
+    }
+
+    // the operand `node` reduces to as `goal`, computed into a scratch
+    // register unless it is an immediate; release with reset()
+    Value operand(const Node& node, Nonterminal goal)
+    {
+        return reduce(node, goal, goal == IMM ? std::string() : scratch());
+    }
+
+    std::string scratch()
+    {
+        if (free.empty())
+            throw std::logic_error(
+                "instruction selection ran out of scratch registers");
+        taken.push_back(free.back());
+        free.pop_back();
+        return taken.back();
+    }
+
+    size_t mark() const { return taken.size(); }
+
+    void reset(size_t mark)
+    {
+        while (taken.size() > mark)
+        {
+            free.push_back(taken.back());
+            taken.pop_back();
+        }
+    }
+
+  private:
+    std::vector<std::string> free;
+    std::vector<std::string> taken;
+};
+
+using Reduction = Value (*)(Reducer&, const Node&, const std::string& target);
+
+} // namespace
+
+struct Rule {
+    Nonterminal result;
+    Shape shape;
+    // what the operands of a NODE reduce to; a CHAIN's source
+    std::array<Nonterminal, 2> kids;
+    int cost;
+    bool (*matches)(const Node&);
+    Reduction reduce;
+};
+
+namespace {
+
+std::optional<int64_t> integer(const Node& node)
+{
+    return node.operand ? node.operand->as_integer() : std::nullopt;
+}
+
+bool fits_imm32(int64_t value)
+{
+    return value >= std::numeric_limits<int32_t>::min() &&
+           value <= std::numeric_limits<int32_t>::max();
+}
+
+bool is_imm32(const Node& node)
+{
+    auto value = integer(node);
+    return value && fits_imm32(*value);
+}
+
+bool is_value(const Node& node)
+{
+    return node.operand && (node.operand->type == ir::OperandType::VARIABLE ||
+                            node.operand->type == ir::OperandType::TEMPORARY);
+}
+
+bool is_memory(const std::string& location)
+{
+    return location.front() == '[';
+}
+
+bool in_register(const Node& node)
+{
+    return is_value(node) && !is_memory(node.location);
+}
+
+bool is_operation(const Node& node, ir::OpCode op)
+{
+    return !node.operand && node.op == op;
+}
+
+bool is_shift(const Node& node)
+{
+    return is_operation(node, ir::OpCode::SHL) || is_operation(node, ir::OpCode::SAR) ||
+           is_operation(node, ir::OpCode::SHR);
+}
+
+bool is_compare(const Node& node)
+{
+    return !node.operand && ir::is_comparison(node.op);
+}
+
+bool is_commutative(ir::OpCode op)
+{
+    return op == ir::OpCode::ADD || op == ir::OpCode::MUL || op == ir::OpCode::EQ ||
+           op == ir::OpCode::NE;
+}
+
+// a memory operand needs its size spelled out when no register gives it
+std::string sized(const std::string& operand)
+{
+    return is_memory(operand) ? "qword " + operand : operand;
+}
+
+std::string low_byte(const std::string& reg)
+{
+    if (reg == "rax")
+        return "al";
+    if (reg == "rbx")
+        return "bl";
+    if (reg == "rcx")
+        return "cl";
+    if (reg == "rdx")
+        return "dl";
+    if (reg == "rsi")
+        return "sil";
+    if (reg == "rdi")
+        return "dil";
+    return reg + "b"; // r8 to r15
+}
+
+Value held_in(const std::string& operand)
+{
+    return Value{operand, ir::OpCode::NE, {}, {}, 1, 0};
+}
+
+void move(Reducer& r, const std::string& target, const std::string& source)
+{
+    if (target != source)
+        r.emit("mov " + target + ", " + source);
+}
+
+// add, sub or imul of the second operand into the first, which is computed
+// into `target`
+Value two_operand(Reducer& r,
+                  const Node& node,
+                  const std::string& target,
+                  Nonterminal right,
+                  const std::string& mnemonic)
+{
+    std::string left = r.reg(*node.kids[0], target);
+    size_t mark = r.mark();
+    Value operand = r.operand(*node.kids[1], right);
+    move(r, target, left);
+
+    auto value = integer(*node.kids[1]);
+    bool add = mnemonic == "add";
+    if (right == IMM && (add || mnemonic == "sub") && value &&
+        (*value == 1 || *value == -1))
+    {
+        bool up = add == (*value == 1);
+        r.emit(std::string(up ? "inc " : "dec ") + target);
+    }
+    else
+    {
+        r.emit(mnemonic + " " + target + ", " + operand.text);
+    }
+    r.reset(mark);
+    return held_in(target);
+}
+
+const char* shift_mnemonic(ir::OpCode op)
+{
+    return op == ir::OpCode::SHL ? "shl" : op == ir::OpCode::SAR ? "sar" : "shr";
+}
+
+// the address parts of a reduced REG, INDEX, SUM or ADDR
+Value parts(Value value, Nonterminal kind)
+{
+    if (kind == REG)
+        return Value{{}, ir::OpCode::NE, value.text, {}, 1, 0};
+    return value;
+}
+
+// base, index and displacement of an address, from those of its operands
+Value address(Reducer& r, const Node& node, const std::string& target, Nonterminal left,
+              Nonterminal right)
+{
+    Value result = parts(r.reduce(*node.kids[0], left, target), left);
+    if (right == IMM)
+    {
+        int64_t value = *integer(*node.kids[1]);
+        result.displacement += node.op == ir::OpCode::SUB ? -value : value;
+        return result;
+    }
+
+    // the scratch register of the second operand stays taken until the lea
+    Value other = parts(r.operand(*node.kids[1], right), right);
+    if (right == INDEX)
+    {
+        result.index = other.index;
+        result.scale = other.scale;
+    }
+    else if (result.base.empty())
+    {
+        result.base = other.base;
+    }
+    else
+    {
+        result.index = other.base;
+        result.scale = 1;
+    }
+    return result;
+}
+
+Value index(Reducer& r, const Node& node, const std::string& target)
+{
+    int64_t value = *integer(*node.kids[1]);
+    int scale = node.op == ir::OpCode::SHL ? 1 << value : int(value);
+    return Value{{}, ir::OpCode::NE, {}, r.reg(*node.kids[0], target), scale, 0};
+}
+
+// sets the flags for `left` compared with `right`
+Value compare(Reducer& r, const Node& node, const std::string& target, Nonterminal left,
+              Nonterminal right)
+{
+    std::string lhs = r.reduce(*node.kids[0], left, target).text;
+    size_t mark = r.mark();
+    Value rhs = r.operand(*node.kids[1], right);
+    if (right == IMM && rhs.text == "0" && !is_memory(lhs))
+        r.emit("test " + lhs + ", " + lhs);
+    else
+        r.emit("cmp " + sized(lhs) + ", " + rhs.text);
+    r.reset(mark);
+
+    Value flags;
+    flags.condition = node.op;
+    return flags;
+}
+
+bool is_scale(const Node& node, std::initializer_list<int64_t> scales)
+{
+    auto value = integer(node);
+    return value && std::find(scales.begin(), scales.end(), *value) != scales.end();
+}
+
+bool is_displacement(const Node& node)
+{
+    if (is_operation(node, ir::OpCode::ADD))
+        return true;
+    if (!is_operation(node, ir::OpCode::SUB))
+        return false;
+    // the displacement is negated
+    auto value = integer(*node.kids[1]);
+    return value && *value != std::numeric_limits<int32_t>::min();
+}
+
+// Costs count instructions, with imul as three. Rules for the same node and
+// nonterminal are tried in order, so on equal cost the earlier one wins.
+const Rule rules[] = {
+    // leaves
+    {IMM, Shape::LEAF, {}, 0, [](const Node& n) { return is_imm32(n); },
+     [](Reducer&, const Node& n, const std::string&) { return held_in(n.location); }},
+    {RM, Shape::LEAF, {}, 0, [](const Node& n) { return is_value(n); },
+     [](Reducer&, const Node& n, const std::string&) { return held_in(n.location); }},
+    {REG, Shape::LEAF, {}, 0, [](const Node& n) { return in_register(n); },
+     [](Reducer&, const Node& n, const std::string&) { return held_in(n.location); }},
+    // any constant, 64-bit ones included, by a mov of the full immediate
+    {REG, Shape::LEAF, {}, 1,
+     [](const Node& n)
+     { return n.operand && n.operand->type == ir::OperandType::CONSTANT; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         r.emit("mov " + target + ", " + n.location);
+         return held_in(target);
+     }},
+
+    // chains
+    {REG, Shape::CHAIN, {RM}, 1, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         move(r, target, r.reduce(n, RM, target).text);
+         return held_in(target);
+     }},
+    {RM, Shape::CHAIN, {REG}, 0, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return r.reduce(n, REG, target); }},
+    {REG, Shape::CHAIN, {ADDR}, 1, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         size_t mark = r.mark();
+         Value address = r.reduce(n, ADDR, target);
+         r.emit("lea " + target + ", " + address.address());
+         r.reset(mark);
+         return held_in(target);
+     }},
+    {ADDR, Shape::CHAIN, {SUM}, 0, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return r.reduce(n, SUM, target); }},
+    {ADDR, Shape::CHAIN, {INDEX}, 0, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return r.reduce(n, INDEX, target); }},
+    {FLAGS, Shape::CHAIN, {RM}, 1, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         std::string value = r.reduce(n, RM, target).text;
+         if (is_memory(value))
+             r.emit("cmp qword " + value + ", 0");
+         else
+             r.emit("test " + value + ", " + value);
+         return Value{};
+     }},
+    {REG, Shape::CHAIN, {FLAGS}, 2, [](const Node&) { return true; },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         ir::OpCode condition = r.reduce(n, FLAGS, target).condition;
+         r.emit("set" + condition_code(condition) + " " + low_byte(target));
+         r.emit("movzx " + target + ", " + low_byte(target));
+         return held_in(target);
+     }},
+
+    // arithmetic
+    {REG, Shape::NODE, {REG, IMM}, 1,
+     [](const Node& n) { return is_operation(n, ir::OpCode::ADD); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return two_operand(r, n, target, IMM, "add"); }},
+    {REG, Shape::NODE, {REG, RM}, 1,
+     [](const Node& n) { return is_operation(n, ir::OpCode::ADD); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return two_operand(r, n, target, RM, "add"); }},
+    {REG, Shape::NODE, {REG, IMM}, 1,
+     [](const Node& n) { return is_operation(n, ir::OpCode::SUB); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return two_operand(r, n, target, IMM, "sub"); }},
+    {REG, Shape::NODE, {REG, RM}, 1,
+     [](const Node& n) { return is_operation(n, ir::OpCode::SUB); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return two_operand(r, n, target, RM, "sub"); }},
+    // x * 3, x * 5 and x * 9 are left alone by strength reduction for this
+    {REG, Shape::NODE, {REG, IMM}, 1,
+     [](const Node& n)
+     { return is_operation(n, ir::OpCode::MUL) && is_scale(*n.kids[1], {3, 5, 9}); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         std::string value = r.reg(*n.kids[0], target);
+         int64_t factor = *integer(*n.kids[1]);
+         r.emit("lea " + target + ", [" + value + " + " + value + "*" +
+                std::to_string(factor - 1) + "]");
+         return held_in(target);
+     }},
+    {REG, Shape::NODE, {RM, IMM}, 3,
+     [](const Node& n) { return is_operation(n, ir::OpCode::MUL); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         std::string value = r.reduce(*n.kids[0], RM, target).text;
+         r.emit("imul " + target + ", " + value + ", " + n.kids[1]->location);
+         return held_in(target);
+     }},
+    {REG, Shape::NODE, {REG, RM}, 3,
+     [](const Node& n) { return is_operation(n, ir::OpCode::MUL); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return two_operand(r, n, target, RM, "imul"); }},
+    {REG, Shape::NODE, {REG, IMM}, 1, [](const Node& n) { return is_shift(n); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return two_operand(r, n, target, IMM, shift_mnemonic(n.op)); }},
+    {REG, Shape::NODE, {REG}, 1,
+     [](const Node& n) { return is_operation(n, ir::OpCode::NEG); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     {
+         move(r, target, r.reg(*n.kids[0], target));
+         r.emit("neg " + target);
+         return held_in(target);
+     }},
+
+    // addresses
+    {INDEX, Shape::NODE, {REG, IMM}, 0,
+     [](const Node& n)
+     { return is_operation(n, ir::OpCode::SHL) && is_scale(*n.kids[1], {1, 2, 3}); },
+     index},
+    {INDEX, Shape::NODE, {REG, IMM}, 0,
+     [](const Node& n)
+     { return is_operation(n, ir::OpCode::MUL) && is_scale(*n.kids[1], {2, 4, 8}); },
+     index},
+    {SUM, Shape::NODE, {REG, REG}, 0,
+     [](const Node& n) { return is_operation(n, ir::OpCode::ADD); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return address(r, n, target, REG, REG); }},
+    {SUM, Shape::NODE, {REG, INDEX}, 0,
+     [](const Node& n) { return is_operation(n, ir::OpCode::ADD); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return address(r, n, target, REG, INDEX); }},
+    {SUM, Shape::NODE, {INDEX, REG}, 0,
+     [](const Node& n) { return is_operation(n, ir::OpCode::ADD); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return address(r, n, target, INDEX, REG); }},
+    {ADDR, Shape::NODE, {REG, IMM}, 0, [](const Node& n) { return is_displacement(n); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return address(r, n, target, REG, IMM); }},
+    {ADDR, Shape::NODE, {SUM, IMM}, 0, [](const Node& n) { return is_displacement(n); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return address(r, n, target, SUM, IMM); }},
+    {ADDR, Shape::NODE, {INDEX, IMM}, 0,
+     [](const Node& n) { return is_displacement(n); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return address(r, n, target, INDEX, IMM); }},
+
+    // comparisons
+    {FLAGS, Shape::NODE, {RM, IMM}, 1, [](const Node& n) { return is_compare(n); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return compare(r, n, target, RM, IMM); }},
+    {FLAGS, Shape::NODE, {REG, RM}, 1, [](const Node& n) { return is_compare(n); },
+     [](Reducer& r, const Node& n, const std::string& target)
+     { return compare(r, n, target, REG, RM); }},
+};
+
+void label(Node& node, const InstructionSelector::Locate& locate)
+{
+    for (Node* kid : node.kids)
+    {
+        label(*kid, locate);
+    }
+    if (node.operand)
+        node.location = locate(*node.operand);
+    node.cost.fill(unreachable);
+    node.rule.fill(nullptr);
+
+    auto consider = [&](const Rule& rule, int cost)
+    {
+        if (cost >= node.cost[rule.result])
+            return false;
+        node.cost[rule.result] = cost;
+        node.rule[rule.result] = &rule;
+        return true;
+    };
+
+    for (const Rule& rule : rules)
+    {
+        if (rule.shape == Shape::CHAIN ||
+            (rule.shape == Shape::LEAF) != bool(node.operand) || !rule.matches(node))
+            continue;
+        int cost = rule.cost;
+        for (size_t k = 0; k < node.kids.size(); ++k)
+        {
+            cost = std::min(cost + node.kids[k]->cost[rule.kids[k]], unreachable);
+        }
+        consider(rule, cost);
+    }
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (const Rule& rule : rules)
+        {
+            if (rule.shape == Shape::CHAIN && node.cost[rule.kids[0]] < unreachable &&
+                rule.matches(node))
+                changed |= consider(rule, node.cost[rule.kids[0]] + rule.cost);
+        }
+    }
+}
+
+Value Reducer::reduce(const Node& node, Nonterminal goal, const std::string& target)
+{
+    const Rule* rule = node.rule[goal];
+    if (!rule)
+        throw std::logic_error("no instruction pattern covers the tree");
+    return rule->reduce(*this, node, target);
+}
+
+// the operands an instruction contributes to a tree, none if it is not one
+std::vector<const ir::Operand*> tree_operands(const ir::Instruction& inst)
+{
+    switch (inst.op)
+    {
+    case ir::OpCode::ADD:
+    case ir::OpCode::SUB:
+    case ir::OpCode::MUL:
+    case ir::OpCode::LT:
+    case ir::OpCode::GT:
+    case ir::OpCode::LE:
+    case ir::OpCode::GE:
+    case ir::OpCode::EQ:
+    case ir::OpCode::NE:
+    case ir::OpCode::JUMP_IF_LT:
+    case ir::OpCode::JUMP_IF_GT:
+    case ir::OpCode::JUMP_IF_LE:
+    case ir::OpCode::JUMP_IF_GE:
+    case ir::OpCode::JUMP_IF_EQ:
+    case ir::OpCode::JUMP_IF_NE:
+        return {&*inst.arg1, &*inst.arg2};
+    case ir::OpCode::SHL:
+    case ir::OpCode::SAR:
+    case ir::OpCode::SHR:
+        // shifts by a variable amount need cl
+        if (inst.arg2->is_integer())
+            return {&*inst.arg1, &*inst.arg2};
+        return {};
+    case ir::OpCode::NEG:
+    case ir::OpCode::NOT:
+    case ir::OpCode::ASSIGN:
+    case ir::OpCode::JUMP_IF_FALSE:
+    case ir::OpCode::JUMP_IF_TRUE:
+        return {&*inst.arg1};
+    default:
+        return {};
+    }
+}
+
+// whether the value of `inst` can be folded into the instruction reading it
+bool is_foldable(const ir::Instruction& inst)
+{
+    return inst.op != ir::OpCode::ASSIGN && !inst.is_jump() && inst.result &&
+           inst.result->type == ir::OperandType::TEMPORARY;
+}
+
+// scratch registers needed for an operation on `kids`; a missing kid is a leaf
+int need_of(const std::vector<Node*>& kids)
+{
+    int need = kids[0] ? kids[0]->need : 1;
+    if (kids.size() > 1)
+        need = std::max(need, (kids[1] ? kids[1]->need : 1) + 1);
+    return need;
+}
+
+const ir::Operand zero = ir::Operand::integer(0);
+
+} // namespace
+
+std::string condition_code(ir::OpCode comparison)
+{
+    switch (comparison)
+    {
+    case ir::OpCode::LT:
+        return "l";
+    case ir::OpCode::GT:
+        return "g";
+    case ir::OpCode::LE:
+        return "le";
+    case ir::OpCode::GE:
+        return "ge";
+    case ir::OpCode::EQ:
+        return "e";
+    default:
+        return "ne";
+    }
+}
+
+InstructionSelector::InstructionSelector() = default;
+
+InstructionSelector::~InstructionSelector() = default;
+
+SelectionNode* InstructionSelector::leaf(const ir::Operand& operand)
+{
+    nodes.push_back(std::make_unique<SelectionNode>());
+    nodes.back()->operand = &operand;
+    return nodes.back().get();
+}
+
+std::vector<size_t>
+InstructionSelector::build_trees(const std::vector<ir::Instruction>& code)
+{
+    nodes.clear();
+    roots.clear();
+    folded.clear();
+
+    std::unordered_map<std::string, int> writes;
+    std::unordered_map<std::string, int> reads;
+    for (const auto& inst : code)
+    {
+        for (const ir::Operand* use : inst.uses())
+        {
+            if (use->type == ir::OperandType::TEMPORARY)
+                reads[use->name]++;
+        }
+        if (const ir::Operand* def = inst.def();
+            def && def->type == ir::OperandType::TEMPORARY)
+            writes[def->name]++;
+    }
+
+    std::vector<size_t> evaluated_at(code.size());
+    std::iota(evaluated_at.begin(), evaluated_at.end(), 0);
+
+    // trees not yet read, each covering code[first, last]; only the one on
+    // top can be right before the next instruction
+    struct Pending {
+        size_t first;
+        size_t last;
+        Node* tree;
+    };
+    std::vector<Pending> pending;
+
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        const ir::Instruction& inst = code[i];
+        std::vector<const ir::Operand*> operands = tree_operands(inst);
+        if (operands.empty())
+        {
+            pending.clear();
+            continue;
+        }
+
+        // the tree of an operand is folded in when it ends right before this
+        // instruction, or right before the tree of a later operand; other
+        // operands stay leaves
+        std::vector<Node*> kids(operands.size(), nullptr);
+        size_t first = i;
+        for (size_t k = operands.size(); k-- > 0 && !pending.empty();)
+        {
+            const Pending& top = pending.back();
+            const ir::Operand& operand = *operands[k];
+            if (top.last + 1 != first || operand.type != ir::OperandType::TEMPORARY ||
+                code[top.last].result->name != operand.name ||
+                reads[operand.name] != 1 || writes[operand.name] != 1)
+                continue;
+
+            kids[k] = top.tree;
+            if (need_of(kids) > scratch_limit)
+            {
+                kids[k] = nullptr;
+                break;
+            }
+            first = top.first;
+            pending.pop_back();
+        }
+        for (size_t k = 0; k < kids.size(); ++k)
+        {
+            if (!kids[k])
+                kids[k] = leaf(*operands[k]);
+        }
+
+        Node* tree = kids[0];
+        if (inst.op != ir::OpCode::ASSIGN && inst.op != ir::OpCode::JUMP_IF_FALSE &&
+            inst.op != ir::OpCode::JUMP_IF_TRUE)
+        {
+            nodes.push_back(std::make_unique<SelectionNode>());
+            tree = nodes.back().get();
+            tree->op =
+                ir::is_compare_branch(inst.op) ? ir::compared_by(inst.op) : inst.op;
+            tree->kids = kids;
+            if (inst.op == ir::OpCode::NOT)
+            {
+                // !x is x == 0
+                tree->op = ir::OpCode::EQ;
+                tree->kids.push_back(leaf(zero));
+            }
+
+            // constants go right, and computed operands left, where the
+            // result is built up
+            std::vector<Node*>& k = tree->kids;
+            if (k.size() == 2)
+            {
+                auto constant = [](const Node* n)
+                { return n->operand && n->operand->type == ir::OperandType::CONSTANT; };
+                bool constant_left = constant(k[0]) && !constant(k[1]);
+                bool computed_right = k[0]->operand && !k[1]->operand;
+                if (is_commutative(tree->op) && (constant_left || computed_right))
+                {
+                    std::swap(k[0], k[1]);
+                }
+                else if (ir::is_comparison(tree->op) && constant_left)
+                {
+                    std::swap(k[0], k[1]);
+                    tree->op = ir::mirror(tree->op);
+                }
+            }
+            tree->need = need_of(k);
+        }
+
+        for (size_t j = first; j < i; ++j)
+        {
+            folded.insert(&code[j]);
+            roots.erase(&code[j]);
+            evaluated_at[j] = i;
+        }
+        roots[&inst] = tree;
+
+        if (is_foldable(inst) && reads[inst.result->name] == 1 &&
+            writes[inst.result->name] == 1)
+            pending.push_back({first, i, tree});
+        else
+            pending.clear();
+    }
+    return evaluated_at;
+}
+
+bool InstructionSelector::preserves_flags(const ir::Instruction& inst) const
+{
+    auto root = roots.find(&inst);
+    return inst.op == ir::OpCode::ASSIGN && root != roots.end() &&
+           root->second->operand;
+}
+
+ir::OpCode InstructionSelector::select(const ir::Instruction& root,
+                                       const Locate& locate,
+                                       const Emit& emit,
+                                       bool flags_only)
+{
+    Node& tree = *roots.at(&root);
+    label(tree, locate);
+
+    // branches and comparisons kept in the flags
+    if (root.is_jump() || flags_only)
+    {
+        Reducer r(emit, {"rdx", "rcx", "rax"});
+        ir::OpCode condition = r.reduce(tree, FLAGS, r.scratch()).condition;
+        if (root.op == ir::OpCode::JUMP_IF_FALSE)
+            condition = ir::negate(condition);
+        if (root.op == ir::OpCode::JUMP_IF_FALSE || root.op == ir::OpCode::JUMP_IF_TRUE)
+            emit("j" + condition_code(condition) + " " + root.arg2->name);
+        else if (root.is_jump())
+            emit("j" + condition_code(condition) + " " + root.result->name);
+        return condition;
+    }
+
+    std::string destination = locate(*root.result);
+    auto at_destination = [&](const Node& node)
+    { return is_value(node) && node.location == destination; };
+
+    // an operation of the destination with something else works in place
+    if (!tree.operand && tree.kids.size() == 2 && is_commutative(tree.op) &&
+        at_destination(*tree.kids[1]) && !at_destination(*tree.kids[0]))
+    {
+        std::swap(tree.kids[0], tree.kids[1]);
+        // unless its operands no longer fit the scratch registers that way
+        if (need_of(tree.kids) > scratch_limit)
+            std::swap(tree.kids[0], tree.kids[1]);
+        else
+            label(tree, locate);
+    }
+
+    if (is_memory(destination))
+    {
+        if (tree.operand && tree.cost[IMM] == 0)
+        {
+            emit("mov qword " + destination + ", " + tree.location);
+            return tree.op;
+        }
+        if (tree.operand && in_register(tree))
+        {
+            emit("mov " + destination + ", " + tree.location);
+            return tree.op;
+        }
+
+        // read-modify-write of the destination in place
+        Reducer r(emit, {"rdx", "rcx", "rax"});
+        bool in_place = !tree.operand && at_destination(*tree.kids[0]);
+        if (in_place && is_operation(tree, ir::OpCode::NEG))
+        {
+            emit("neg qword " + destination);
+            return tree.op;
+        }
+        if (in_place && (is_operation(tree, ir::OpCode::ADD) ||
+                         is_operation(tree, ir::OpCode::SUB)))
+        {
+            const char* mnemonic = tree.op == ir::OpCode::ADD ? "add" : "sub";
+            const Node& operand = *tree.kids[1];
+            auto value = integer(operand);
+            if (value && (*value == 1 || *value == -1))
+            {
+                bool up = (tree.op == ir::OpCode::ADD) == (*value == 1);
+                emit(std::string(up ? "inc" : "dec") + " qword " + destination);
+            }
+            else if (operand.cost[IMM] == 0)
+                emit(std::string(mnemonic) + " qword " + destination + ", " +
+                     operand.location);
+            else
+                emit(std::string(mnemonic) + " " + destination + ", " +
+                     r.reg(operand, r.scratch()));
+            return tree.op;
+        }
+        if (in_place && is_shift(tree) && tree.kids[1]->cost[IMM] == 0)
+        {
+            emit(std::string(shift_mnemonic(tree.op)) + " qword " + destination + ", " +
+                 tree.kids[1]->location);
+            return tree.op;
+        }
+
+        emit("mov " + destination + ", " + r.reg(tree, r.scratch()));
+        return tree.op;
+    }
+
+    // The result goes straight into the destination register unless that
+    // would overwrite a leaf still to be read. A first operand already in
+    // the destination is fine: the destination is only written once the rest
+    // has been read.
+    std::vector<const Node*> stack{&tree};
+    bool overwrites = false;
+    while (!stack.empty())
+    {
+        const Node* node = stack.back();
+        stack.pop_back();
+        overwrites |= at_destination(*node);
+        stack.insert(stack.end(), node->kids.begin(), node->kids.end());
+    }
+    if (!tree.operand && at_destination(*tree.kids[0]))
+        overwrites = false;
+
+    std::string target = overwrites ? "rax" : destination;
+    std::vector<std::string> free;
+    for (const char* reg : {"rdx", "rcx", "rax"})
+    {
+        if (reg != target)
+            free.push_back(reg);
+    }
+    Reducer r(emit, std::move(free));
+    std::string value = r.reg(tree, target);
+    if (value != destination)
+        emit("mov " + destination + ", " + value);
+    return tree.op;
+}
+
+} // namespace codegen
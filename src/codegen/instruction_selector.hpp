@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace codegen {
+
+struct SelectionNode;
+
+// x86 condition code suffix (as in jcc and setcc) for a signed comparison
+std::string condition_code(ir::OpCode comparison);
+
+// Tree-pattern instruction selection over a single function body.
+//
+// Temporaries that are written once and read once, right after, are folded
+// into the instruction reading them, so the three-address code of a function
+// becomes a sequence of expression trees. Each tree is labeled bottom-up with
+// the cheapest way to compute it as each nonterminal (a register, a register
+// or memory operand, an immediate, an address, the flags) by dynamic
+// programming over a table of rules, then reduced top-down into x86-64
+// instructions. That is where lea for `a + b*4 + c`, immediate operands,
+// inc/dec, test against zero and read-modify-write of memory come from.
+//
+// Only rax, rcx and rdx are free for intermediate values, so trees are kept
+// small enough never to need more of them at once.
+class InstructionSelector {
+  public:
+    // where an operand is: a register, a memory reference or an immediate
+    using Locate = std::function<std::string(const ir::Operand&)>;
+    using Emit = std::function<void(const std::string&)>;
+
+    InstructionSelector();
+    ~InstructionSelector();
+
+    // Groups `code` into trees. Entry i of the result is the index of the
+    // instruction whose tree computes instruction i; the register allocator
+    // counts the reads of a folded instruction as happening there.
+    std::vector<size_t> build_trees(const std::vector<ir::Instruction>& code);
+
+    // folded into a later instruction, so nothing is emitted for it
+    bool is_folded(const ir::Instruction& inst) const
+    {
+        return folded.count(&inst) > 0;
+    }
+    // emitted by select() rather than by a fixed template
+    bool is_root(const ir::Instruction& inst) const { return roots.count(&inst) > 0; }
+    // a root that compiles to movs only
+    bool preserves_flags(const ir::Instruction& inst) const;
+
+    // Emits the cheapest code for the tree rooted at `root`. A comparison
+    // with `flags_only` set only leaves its outcome in the flags. For a
+    // comparison, returns the one the flags are left holding, which may be
+    // the mirror image of the original.
+    ir::OpCode select(const ir::Instruction& root,
+                      const Locate& locate,
+                      const Emit& emit,
+                      bool flags_only = false);
+
+  private:
+    std::vector<std::unique_ptr<SelectionNode>> nodes;
+    std::unordered_map<const ir::Instruction*, SelectionNode*> roots;
+    std::unordered_set<const ir::Instruction*> folded;
+
+    SelectionNode* leaf(const ir::Operand& operand);
+};
+
+} // namespace codegen
@@ -0,0 +1,106 @@
+#include "jit.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace codegen {
+
+namespace {
+
+uint64_t page_align(uint64_t size)
+{
+    uint64_t page = uint64_t(sysconf(_SC_PAGESIZE));
+    return (size + page - 1) / page * page;
+}
+
+// an anonymous read-write mapping, unmapped when it goes out of scope
+struct Mapping {
+    uint8_t* memory = nullptr;
+    size_t size = 0;
+
+    explicit Mapping(size_t size) : size(size)
+    {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (address == MAP_FAILED)
+            throw std::runtime_error("could not map memory for the program");
+        memory = static_cast<uint8_t*>(address);
+    }
+
+    ~Mapping() { munmap(memory, size); }
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+};
+
+} // namespace
+
+int Jit::run(const ObjectCode& object)
+{
+    // the runtime is part of every program, so nothing is left to link
+    for (const ObjectCode::Symbol& symbol : object.symbols)
+    {
+        if (symbol.section == ObjectCode::Section::UNDEFINED)
+            throw std::runtime_error("undefined symbol " + symbol.name);
+    }
+
+    // the code and its read-only data, then the data and bss on pages of
+    // their own
+    uint64_t rodata = (object.text.size() + 15) / 16 * 16;
+    uint64_t code_size = page_align(rodata + object.rodata.size());
+    uint64_t bss = (object.data.size() + 15) / 16 * 16;
+    Mapping mapping(code_size + page_align(bss + object.bss_size));
+    uint8_t* text = mapping.memory;
+    uint8_t* data = mapping.memory + code_size;
+    std::memcpy(text, object.text.data(), object.text.size());
+    if (!object.rodata.empty())
+        std::memcpy(text + rodata, object.rodata.data(), object.rodata.size());
+    if (!object.data.empty())
+        std::memcpy(data, object.data.data(), object.data.size());
+
+    std::unordered_map<std::string, uint64_t> addresses;
+    for (const ObjectCode::Symbol& symbol : object.symbols)
+    {
+        if (symbol.section == ObjectCode::Section::TEXT)
+            addresses[symbol.name] = reinterpret_cast<uint64_t>(text + symbol.offset);
+        else if (symbol.section == ObjectCode::Section::RODATA)
+            addresses[symbol.name] =
+                reinterpret_cast<uint64_t>(text + rodata + symbol.offset);
+        else if (symbol.section == ObjectCode::Section::DATA)
+            addresses[symbol.name] = reinterpret_cast<uint64_t>(data + symbol.offset);
+        else if (symbol.section == ObjectCode::Section::BSS)
+            addresses[symbol.name] =
+                reinterpret_cast<uint64_t>(data + bss + symbol.offset);
+    }
+
+    for (const ObjectCode::Relocation& relocation : object.relocations)
+    {
+        uint8_t* place = text + relocation.offset;
+        uint64_t value = addresses.at(relocation.symbol) + relocation.addend;
+        if (relocation.kind == ObjectCode::RelocationKind::ABSOLUTE64)
+        {
+            std::memcpy(place, &value, sizeof(value));
+            continue;
+        }
+        int64_t distance = int64_t(value - reinterpret_cast<uint64_t>(place));
+        if (distance != int32_t(distance))
+            throw std::runtime_error("relocation out of range for " +
+                                     relocation.symbol);
+        int32_t displacement = int32_t(distance);
+        std::memcpy(place, &displacement, sizeof(displacement));
+    }
+
+    if (mprotect(text, code_size, PROT_READ | PROT_EXEC) != 0)
+        throw std::runtime_error("could not make the program executable");
+    auto main = addresses.find("main");
+    if (main == addresses.end())
+        throw std::runtime_error("the program has no main");
+    auto entry = reinterpret_cast<int (*)()>(main->second);
+    return entry();
+}
+
+} // namespace codegen
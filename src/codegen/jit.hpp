@@ -0,0 +1,20 @@
+#pragma once
+
+#include "encoder.hpp"
+
+namespace codegen {
+
+// Runs encoded programs inside the compiler's own process.
+//
+// The code and data are copied into freshly mapped memory and relocated
+// there, and main is called directly. Programs bring their own runtime, so
+// there are no symbols to look up elsewhere. Memory is never writable and
+// executable at once: the code is made executable only once it is in place.
+class Jit {
+  public:
+    // calls main of `object` and returns its result; a program that exits
+    // ends the process with its status, as the linked executable would
+    int run(const ObjectCode& object);
+};
+
+} // namespace codegen
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace codegen {
+
+// Takes the output of a backend a batch of lines at a time, in order, so
+// that the whole of it never has to be held at once.
+using LineSink = std::function<void(const std::vector<std::string>& lines)>;
+
+} // namespace codegen
@@ -0,0 +1,115 @@
+#include "liveness.hpp"
+
+#include <unordered_map>
+
+namespace codegen {
+
+namespace {
+
+bool ends_block(const ir::Instruction& inst)
+{
+    return inst.is_jump() || inst.op == ir::OpCode::RETURN ||
+           inst.op == ir::OpCode::HALT || inst.op == ir::OpCode::TAIL_CALL;
+}
+
+} // namespace
+
+std::vector<BasicBlock> build_cfg(const std::vector<ir::Instruction>& code)
+{
+    std::vector<BasicBlock> blocks;
+    size_t begin = 0;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].op == ir::OpCode::LABEL && i > begin)
+        {
+            blocks.push_back({begin, i, {}});
+            begin = i;
+        }
+        if (ends_block(code[i]))
+        {
+            blocks.push_back({begin, i + 1, {}});
+            begin = i + 1;
+        }
+    }
+    if (begin < code.size())
+        blocks.push_back({begin, code.size(), {}});
+
+    std::unordered_map<std::string, size_t> block_of;
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        for (size_t i = blocks[b].begin;
+             i < blocks[b].end && code[i].op == ir::OpCode::LABEL;
+             ++i)
+        {
+            block_of[code[i].arg1->name] = b;
+        }
+    }
+
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        const ir::Instruction& last = code[blocks[b].end - 1];
+        if (const ir::Operand* target = last.jump_target())
+        {
+            auto found = block_of.find(target->name);
+            if (found != block_of.end())
+                blocks[b].successors.push_back(found->second);
+        }
+
+        bool falls_through =
+            last.op != ir::OpCode::JUMP && last.op != ir::OpCode::RETURN &&
+            last.op != ir::OpCode::HALT && last.op != ir::OpCode::TAIL_CALL;
+        if (falls_through && b + 1 < blocks.size())
+            blocks[b].successors.push_back(b + 1);
+    }
+    return blocks;
+}
+
+Liveness compute_liveness(const std::vector<ir::Instruction>& code,
+                          const std::vector<BasicBlock>& blocks,
+                          const std::function<bool(const ir::Operand&)>& tracked)
+{
+    // values each block reads before writing them, and values it writes
+    std::vector<std::unordered_set<std::string>> upward(blocks.size());
+    std::vector<std::unordered_set<std::string>> defined(blocks.size());
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i)
+        {
+            for (const ir::Operand* use : code[i].uses())
+            {
+                if (tracked(*use) && !defined[b].count(use->name))
+                    upward[b].insert(use->name);
+            }
+            if (const ir::Operand* def = code[i].def(); def && tracked(*def))
+                defined[b].insert(def->name);
+        }
+    }
+
+    Liveness liveness{upward,
+                      std::vector<std::unordered_set<std::string>>(blocks.size())};
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;)
+        {
+            std::unordered_set<std::string>& out = liveness.live_out[b];
+            for (size_t successor : blocks[b].successors)
+            {
+                out.insert(liveness.live_in[successor].begin(),
+                           liveness.live_in[successor].end());
+            }
+
+            std::unordered_set<std::string>& in = liveness.live_in[b];
+            size_t before = in.size();
+            for (const std::string& name : out)
+            {
+                if (!defined[b].count(name))
+                    in.insert(name);
+            }
+            changed |= in.size() != before;
+        }
+    }
+    return liveness;
+}
+
+} // namespace codegen
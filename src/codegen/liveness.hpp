@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace codegen {
+
+// A straight-line run code[begin, end) of a function body, entered only at
+// `begin` and left only after `end - 1`.
+struct BasicBlock {
+    size_t begin;
+    size_t end;
+    std::vector<size_t> successors; // indices of the blocks control may go to next
+};
+
+// Splits a function body into basic blocks, in code order, and links each to
+// the blocks it can transfer control to.
+std::vector<BasicBlock> build_cfg(const std::vector<ir::Instruction>& code);
+
+// The values live on entry to and on exit from each basic block.
+struct Liveness {
+    std::vector<std::unordered_set<std::string>> live_in;
+    std::vector<std::unordered_set<std::string>> live_out;
+};
+
+// Backward dataflow over `blocks`. Only the values `tracked` accepts take part;
+// the rest (globals) live in memory and need no liveness.
+Liveness compute_liveness(const std::vector<ir::Instruction>& code,
+                          const std::vector<BasicBlock>& blocks,
+                          const std::function<bool(const ir::Operand&)>& tracked);
+
+} // namespace codegen
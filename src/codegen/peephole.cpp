@@ -0,0 +1,278 @@
+#include "peephole.hpp"
+
+#include "assembly.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <unordered_map>
+
+namespace codegen {
+
+namespace {
+
+// The code after a window: the first `end` of the lines still to be read,
+// which are kept in reverse order so that the next one is at the back.
+struct Rest {
+    const std::vector<Line>& lines;
+    size_t end;
+};
+
+// whether the value of `reg` is never read by the code in `rest`
+bool dead_at(const Rest& rest, const std::string& reg)
+{
+    for (size_t i = rest.end; i-- > 0;)
+    {
+        const Line& line = rest.lines[i];
+        if (!line.is_instruction)
+            return false;
+        Effects effects = effects_of(line);
+        if (effects.opaque ||
+            std::count(effects.reads.begin(), effects.reads.end(), reg))
+            return false;
+        if (effects.returns ||
+            std::count(effects.writes.begin(), effects.writes.end(), reg))
+            return true;
+    }
+    return false;
+}
+
+// whether the flags are never read by the code in `rest`
+bool flags_dead_at(const Rest& rest)
+{
+    for (size_t i = rest.end; i-- > 0;)
+    {
+        const Line& line = rest.lines[i];
+        if (!line.is_instruction)
+            return false;
+        Effects effects = effects_of(line);
+        if (effects.reads_flags || (effects.opaque && !effects.writes_flags))
+            return false;
+        if (effects.writes_flags || effects.returns)
+            return true;
+    }
+    return false;
+}
+
+using Bindings = std::unordered_map<std::string, std::string>;
+
+// A rewrite of `pattern` into `replacement`. In patterns, %r, %s and %t stand
+// for registers, %m for a memory operand and any other %name for any
+// operand; a variable used twice matches the same text both times. In
+// replacements, %r:32 is the 32-bit name of a register. The condition sees
+// the code after the window.
+struct PeepholeRule {
+    const char* name;
+    std::vector<const char*> pattern;
+    std::vector<const char*> replacement;
+    bool (*condition)(const Bindings&, const Rest& rest);
+};
+
+const PeepholeRule rules[] = {
+    // mov [m], r; mov r, [m] -> mov [m], r
+    {"store-reload", {"mov %m, %r", "mov %r, %m"}, {"mov %m, %r"}, nullptr},
+    // mov [m], r; mov s, [m] -> mov [m], r; mov s, r
+    {"store-forward", {"mov %m, %r", "mov %s, %m"}, {"mov %m, %r", "mov %s, %r"},
+     [](const Bindings& b, const Rest&)
+     { return !mentions(b.at("%m"), b.at("%r")); }},
+    {"self-move", {"mov %r, %r"}, {}, nullptr},
+    // the first of two writes of a register that are not read in between
+    {"dead-move", {"mov %r, %x", "mov %r, %y"}, {"mov %r, %y"},
+     [](const Bindings& b, const Rest&)
+     { return !mentions(b.at("%y"), b.at("%r")); }},
+    // a value copied through a register that is dead afterwards
+    {"copy-through", {"mov %t, %x", "mov %r, %t"}, {"mov %r, %x"},
+     [](const Bindings& b, const Rest& rest)
+     { return b.at("%r") != b.at("%t") && dead_at(rest, b.at("%t")); }},
+    {"copy-to-memory", {"mov %t, %r", "mov %m, %t"}, {"mov %m, %r"},
+     [](const Bindings& b, const Rest& rest)
+     { return !mentions(b.at("%m"), b.at("%t")) && dead_at(rest, b.at("%t")); }},
+    // writing the 32-bit register clears the upper half
+    {"zero-idiom", {"mov %r, 0"}, {"xor %r:32, %r:32"},
+     [](const Bindings& b, const Rest& rest)
+     { return full_register(b.at("%r")) == b.at("%r") && flags_dead_at(rest); }},
+    {"narrow-xor", {"xor %r, %r"}, {"xor %r:32, %r:32"},
+     [](const Bindings& b, const Rest&)
+     { return full_register(b.at("%r")) == b.at("%r"); }},
+    {"test-zero", {"cmp %r, 0"}, {"test %r, %r"}, nullptr},
+    // argument passing: a push matched with its pop becomes a mov, and a
+    // push sinks past movs that do not affect it to meet its pop
+    {"push-pop", {"push %x", "pop %r"}, {"mov %r, %x"}, nullptr},
+    {"push-sink", {"push %x", "mov %r, %y"}, {"mov %r, %y", "push %x"},
+     [](const Bindings& b, const Rest&)
+     {
+         return b.at("%r") != "rsp" && !mentions(b.at("%x"), b.at("%r")) &&
+                !mentions(b.at("%y"), "rsp");
+     }},
+    {"jump-to-next", {"jmp %l", "%l:"}, {"%l:"}, nullptr},
+};
+
+bool is_variable(const std::string& text)
+{
+    return text.size() > 1 && text.front() == '%';
+}
+
+bool bind(Bindings& bindings, const std::string& variable, const std::string& text)
+{
+    char kind = variable[1];
+    if ((kind == 'r' || kind == 's' || kind == 't') && !is_register(text))
+        return false;
+    if (kind == 'm' && !is_memory(text))
+        return false;
+    auto [it, inserted] = bindings.emplace(variable, text);
+    return inserted || it->second == text;
+}
+
+bool match(const Line& pattern, const Line& line, Bindings& bindings)
+{
+    if (pattern.is_label)
+        return line.is_label && bind(bindings, pattern.text, line.text);
+    if (!line.is_instruction || pattern.mnemonic != line.mnemonic ||
+        pattern.operands.size() != line.operands.size())
+        return false;
+    for (size_t k = 0; k < pattern.operands.size(); ++k)
+    {
+        const std::string& operand = pattern.operands[k];
+        if (is_variable(operand) ? !bind(bindings, operand, line.operands[k])
+                                 : operand != line.operands[k])
+            return false;
+    }
+    return true;
+}
+
+std::string substitute(const std::string& operand, const Bindings& bindings)
+{
+    if (!is_variable(operand))
+        return operand;
+    if (operand.ends_with(":32"))
+        return low_dword(bindings.at(operand.substr(0, operand.size() - 3)));
+    return bindings.at(operand);
+}
+
+Line instantiate(const Line& pattern, const Bindings& bindings)
+{
+    Line line = pattern;
+    if (line.is_label)
+        line.text = substitute(line.text, bindings);
+    for (std::string& operand : line.operands)
+    {
+        operand = substitute(operand, bindings);
+    }
+    return line;
+}
+
+// patterns are written like generated lines, without the indentation
+Line pattern_line(const char* text)
+{
+    std::string line = text;
+    return parse_line(line.ends_with(":") ? line : "    " + line);
+}
+
+// a rule with its pattern and replacement parsed
+struct CompiledRule {
+    const PeepholeRule& rule;
+    std::vector<Line> pattern;
+    std::vector<Line> replacement;
+};
+
+std::vector<CompiledRule> compile_rules()
+{
+    std::vector<CompiledRule> compiled;
+    for (const PeepholeRule& rule : rules)
+    {
+        compiled.push_back({rule, {}, {}});
+        std::transform(rule.pattern.begin(), rule.pattern.end(),
+                       std::back_inserter(compiled.back().pattern), pattern_line);
+        std::transform(rule.replacement.begin(), rule.replacement.end(),
+                       std::back_inserter(compiled.back().replacement), pattern_line);
+    }
+    return compiled;
+}
+
+// Tries `rule` on the window that starts with the last line of `done` and
+// goes on into `rest`. When it applies, the window is taken out and its
+// replacement goes onto `rest`, to be read next.
+bool apply(const CompiledRule& rule, std::vector<Line>& done, std::vector<Line>& rest)
+{
+    size_t size = rule.pattern.size();
+    if (size - 1 > rest.size())
+        return false;
+    Bindings bindings;
+    for (size_t k = 0; k < size; ++k)
+    {
+        const Line& line = k == 0 ? done.back() : rest[rest.size() - k];
+        if (!match(rule.pattern[k], line, bindings))
+            return false;
+    }
+    if (rule.rule.condition &&
+        !rule.rule.condition(bindings, {rest, rest.size() - (size - 1)}))
+        return false;
+
+    done.pop_back();
+    rest.resize(rest.size() - (size - 1));
+    for (auto line = rule.replacement.rbegin(); line != rule.replacement.rend(); ++line)
+    {
+        rest.push_back(instantiate(*line, bindings));
+    }
+    return true;
+}
+
+} // namespace
+
+void Peephole::run(std::vector<std::string>& lines)
+{
+    fired.resize(std::size(rules));
+
+    // the lines still to be read, last first
+    std::vector<Line> rest;
+    rest.reserve(lines.size());
+    std::transform(lines.rbegin(), lines.rend(), std::back_inserter(rest), parse_line);
+
+    static const std::vector<CompiledRule> compiled = compile_rules();
+    std::vector<Line> done;
+    done.reserve(lines.size());
+    while (!rest.empty())
+    {
+        done.push_back(std::move(rest.back()));
+        rest.pop_back();
+        for (size_t r = 0; r < compiled.size(); ++r)
+        {
+            if (apply(compiled[r], done, rest))
+            {
+                fired[r]++;
+                // the line before may now start a window of its own, as no
+                // pattern is longer than two lines
+                if (!done.empty())
+                {
+                    rest.push_back(std::move(done.back()));
+                    done.pop_back();
+                }
+                break;
+            }
+        }
+    }
+
+    lines.clear();
+    std::transform(done.begin(), done.end(), std::back_inserter(lines), format_line);
+}
+
+void Peephole::merge(const Peephole& other)
+{
+    fired.resize(std::size(rules));
+    for (size_t r = 0; r < other.fired.size(); ++r)
+    {
+        fired[r] += other.fired[r];
+    }
+}
+
+std::vector<std::pair<std::string, int>> Peephole::statistics() const
+{
+    std::vector<std::pair<std::string, int>> counts;
+    for (size_t r = 0; r < std::size(rules); ++r)
+    {
+        counts.emplace_back(rules[r].name, r < fired.size() ? fired[r] : 0);
+    }
+    return counts;
+}
+
+} // namespace codegen
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace codegen {
+
+// Window-based peephole optimization of generated assembly.
+//
+// The rules are a table of instruction patterns and their replacements, with
+// pattern variables for registers, memory operands and any operand, and an
+// optional condition on the code that follows (a register or the flags being
+// dead). The code is read once, front to back, and the rules are tried in
+// order on the window that starts at each line; after a rewrite, the line
+// before and the replacement are read again, so that rewrites chain without
+// going over the code more than once. A window never spans a label unless the
+// pattern names it. How often each rule fired is kept for statistics.
+class Peephole {
+  public:
+    // rewrites `lines`, code of the text section, one line of assembly each
+    void run(std::vector<std::string>& lines);
+
+    // adds the counts of `other`, which ran on other code of the program
+    void merge(const Peephole& other);
+
+    // number of times each rule fired so far, by rule name in table order
+    std::vector<std::pair<std::string, int>> statistics() const;
+
+  private:
+    std::vector<int> fired;
+};
+
+} // namespace codegen
@@ -0,0 +1,442 @@
+#include "register_allocator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace codegen {
+
+namespace {
+
+// in order of preference; the argument registers come last because incoming
+// arguments and calls tie them up
+const char* const caller_saved[] = {"r10", "r11", "r8", "r9", "rsi", "rdi"};
+const char* const callee_saved[] = {"rbx", "r12", "r13", "r14", "r15"};
+const char* const argument_registers[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+constexpr size_t none = std::numeric_limits<size_t>::max();
+
+struct Interval {
+    std::string name;
+    size_t start;
+    size_t end;
+    double weight = 0; // definitions and uses, weighted by loop depth
+    bool crosses_call = false;
+    std::string reg; // empty when spilled
+};
+
+double spill_cost(const Interval& interval)
+{
+    return interval.weight / double(interval.end - interval.start + 1);
+}
+
+// disjoint sets of definitions, merged when they reach a common use
+struct Webs {
+    std::vector<size_t> parent;
+
+    size_t add()
+    {
+        parent.push_back(parent.size());
+        return parent.size() - 1;
+    }
+
+    size_t find(size_t x)
+    {
+        while (parent[x] != x)
+        {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    void unite(size_t a, size_t b) { parent[find(a)] = find(b); }
+};
+
+// instructions after which the caller-saved registers no longer hold their values
+bool clobbers_registers(const ir::Instruction& inst)
+{
+    return inst.op == ir::OpCode::CALL || inst.op == ir::OpCode::PRINT;
+}
+
+// number of loops around each instruction, from the backward jumps
+std::vector<int> loop_depths(const std::vector<ir::Instruction>& code)
+{
+    std::unordered_map<std::string, size_t> label_at;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].op == ir::OpCode::LABEL)
+            label_at[code[i].arg1->name] = i;
+    }
+
+    std::vector<int> delta(code.size() + 1, 0);
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        const ir::Operand* target = code[i].jump_target();
+        if (!target)
+            continue;
+        auto header = label_at.find(target->name);
+        if (header != label_at.end() && header->second <= i)
+        {
+            delta[header->second]++;
+            delta[i + 1]--;
+        }
+    }
+
+    std::vector<int> depth(code.size());
+    int current = 0;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        current += delta[i];
+        depth[i] = current;
+    }
+    return depth;
+}
+
+} // namespace
+
+bool RegisterAllocator::is_local(const ir::Operand& op) const
+{
+    return (op.type == ir::OperandType::VARIABLE ||
+            op.type == ir::OperandType::TEMPORARY) &&
+           !globals.count(op.name);
+}
+
+void RegisterAllocator::split_webs(std::vector<ir::Instruction>& code,
+                                   const std::vector<BasicBlock>& blocks)
+{
+    // every definition of a local is a node, numbered in code order
+    std::vector<size_t> site_at(code.size(), none);
+    std::unordered_map<std::string, std::vector<size_t>> sites_of;
+    Webs webs;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (const ir::Operand* def = code[i].def(); def && is_local(*def))
+        {
+            site_at[i] = webs.add();
+            sites_of[def->name].push_back(site_at[i]);
+        }
+    }
+    size_t site_count = webs.parent.size();
+
+    // reaching definitions
+    auto transfer = [&](const BasicBlock& block, std::vector<bool>& reaching)
+    {
+        for (size_t i = block.begin; i < block.end; ++i)
+        {
+            if (site_at[i] == none)
+                continue;
+            for (size_t site : sites_of[code[i].def()->name])
+            {
+                reaching[site] = false;
+            }
+            reaching[site_at[i]] = true;
+        }
+    };
+
+    std::vector<std::vector<size_t>> predecessors(blocks.size());
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        for (size_t successor : blocks[b].successors)
+        {
+            predecessors[successor].push_back(b);
+        }
+    }
+
+    std::vector<std::vector<bool>> reach_in(blocks.size(),
+                                            std::vector<bool>(site_count));
+    std::vector<std::vector<bool>> reach_out = reach_in;
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            std::vector<bool> in(site_count);
+            for (size_t predecessor : predecessors[b])
+            {
+                for (size_t s = 0; s < site_count; ++s)
+                {
+                    if (reach_out[predecessor][s])
+                        in[s] = true;
+                }
+            }
+            std::vector<bool> out = in;
+            transfer(blocks[b], out);
+            reach_in[b] = std::move(in);
+            if (out != reach_out[b])
+            {
+                reach_out[b] = std::move(out);
+                changed = true;
+            }
+        }
+    }
+
+    // join the definitions reaching each use; reads that no definition
+    // reaches share one extra node per name
+    std::unordered_map<std::string, size_t> undefined;
+    std::vector<std::unordered_map<std::string, size_t>> web_of_use(code.size());
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        std::vector<bool> reaching = reach_in[b];
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i)
+        {
+            for (const ir::Operand* use : code[i].uses())
+            {
+                if (!is_local(*use))
+                    continue;
+                size_t web = none;
+                for (size_t site : sites_of[use->name])
+                {
+                    if (!reaching[site])
+                        continue;
+                    if (web == none)
+                        web = site;
+                    else
+                        webs.unite(site, web);
+                }
+                if (web == none)
+                {
+                    auto [it, inserted] = undefined.try_emplace(use->name, none);
+                    if (inserted)
+                        it->second = webs.add();
+                    web = it->second;
+                }
+                web_of_use[i][use->name] = web;
+            }
+
+            if (site_at[i] != none)
+            {
+                for (size_t site : sites_of[code[i].def()->name])
+                {
+                    reaching[site] = false;
+                }
+                reaching[site_at[i]] = true;
+            }
+        }
+    }
+
+    // the first web of each name keeps it, later ones are numbered
+    std::unordered_map<size_t, std::string> web_names;
+    std::unordered_map<std::string, int> webs_per_name;
+    auto name_of = [&](const std::string& name, size_t node)
+    {
+        size_t root = webs.find(node);
+        auto [it, inserted] = web_names.try_emplace(root);
+        if (inserted)
+        {
+            int index = webs_per_name[name]++;
+            it->second = index == 0 ? name : name + "#" + std::to_string(index);
+        }
+        return it->second;
+    };
+
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        for (ir::Operand* use : code[i].uses())
+        {
+            if (is_local(*use))
+                use->name = name_of(use->name, web_of_use[i].at(use->name));
+        }
+        if (site_at[i] != none)
+        {
+            ir::Operand& def = code[i].op == ir::OpCode::PARAM_BIND ? *code[i].arg1
+                                                                    : *code[i].result;
+            def.name = name_of(def.name, site_at[i]);
+        }
+    }
+}
+
+Allocation RegisterAllocator::run(std::vector<ir::Instruction>& code,
+                                  const std::vector<size_t>& evaluated_at)
+{
+    Allocation allocation;
+    std::vector<BasicBlock> blocks = build_cfg(code);
+    if (blocks.empty())
+        return allocation;
+
+    split_webs(code, blocks);
+    Liveness liveness = compute_liveness(
+        code, blocks, [this](const ir::Operand& op) { return is_local(op); });
+    std::vector<int> depth = loop_depths(code);
+
+    std::unordered_set<std::string> in_trees;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (evaluated_at[i] != i && code[i].result)
+            in_trees.insert(code[i].result->name);
+    }
+
+    std::unordered_map<std::string, Interval> by_name;
+    auto extend = [&](const std::string& name, size_t position, double weight)
+    {
+        auto [it, inserted] = by_name.try_emplace(
+            name, Interval{name, position, position, 0, false, {}});
+        Interval& interval = it->second;
+        interval.start = std::min(interval.start, position);
+        interval.end = std::max(interval.end, position);
+        interval.weight += weight;
+    };
+
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        for (const std::string& name : liveness.live_in[b])
+        {
+            extend(name, blocks[b].begin, 0);
+        }
+        for (const std::string& name : liveness.live_out[b])
+        {
+            extend(name, blocks[b].end - 1, 0);
+        }
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i)
+        {
+            double weight = std::pow(8.0, std::min(depth[i], 4));
+            for (const ir::Operand* use : code[i].uses())
+            {
+                if (is_local(*use) && !in_trees.count(use->name))
+                    extend(use->name, evaluated_at[i], weight);
+            }
+            if (const ir::Operand* def = code[i].def();
+                def && is_local(*def) && !in_trees.count(def->name))
+                extend(def->name, i, weight);
+        }
+    }
+
+    std::vector<size_t> calls;
+    // incoming arguments, until they are bound
+    std::unordered_map<std::string, size_t> busy_until;
+    // parameters and arguments, preferably kept in the register they arrive
+    // or leave in so that no move is needed
+    std::unordered_map<std::string, std::string> hints;
+    size_t param_index = 0;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (clobbers_registers(code[i]))
+            calls.push_back(i);
+        if (code[i].op == ir::OpCode::PARAM_BIND)
+        {
+            size_t index = std::stoul(code[i].arg2->value);
+            if (index < 6)
+            {
+                busy_until[argument_registers[index]] = i;
+                hints.try_emplace(code[i].arg1->name, argument_registers[index]);
+            }
+        }
+        if (code[i].op == ir::OpCode::PARAM)
+        {
+            bool follows_param = i > 0 && code[i - 1].op == ir::OpCode::PARAM;
+            param_index = follows_param ? param_index + 1 : 0;
+            if (param_index < 6 && is_local(*code[i].arg1))
+                hints.try_emplace(code[i].arg1->name, argument_registers[param_index]);
+        }
+    }
+
+    std::vector<Interval> intervals;
+    intervals.reserve(by_name.size());
+    for (auto& [name, interval] : by_name)
+    {
+        auto call = std::upper_bound(calls.begin(), calls.end(), interval.start);
+        interval.crosses_call = call != calls.end() && *call < interval.end;
+        intervals.push_back(std::move(interval));
+    }
+    std::sort(intervals.begin(),
+              intervals.end(),
+              [](const Interval& a, const Interval& b)
+              { return a.start != b.start ? a.start < b.start : a.name < b.name; });
+
+    std::vector<Interval*> active;
+    for (Interval& current : intervals)
+    {
+        std::erase_if(active,
+                      [&](const Interval* a) { return a->end <= current.start; });
+
+        std::vector<const char*> allowed;
+        if (!current.crosses_call)
+            allowed.assign(std::begin(caller_saved), std::end(caller_saved));
+        allowed.insert(allowed.end(), std::begin(callee_saved), std::end(callee_saved));
+
+        auto usable = [&](const std::string& reg)
+        {
+            auto busy = busy_until.find(reg);
+            return busy == busy_until.end() || current.start >= busy->second;
+        };
+        auto allows = [&](const std::string& reg)
+        {
+            return std::find(allowed.begin(), allowed.end(), reg) != allowed.end() &&
+                   usable(reg);
+        };
+
+        auto free = [&](const std::string& reg)
+        {
+            return usable(reg) &&
+                   std::none_of(active.begin(),
+                                active.end(),
+                                [&](const Interval* a) { return a->reg == reg; });
+        };
+
+        auto hint = hints.find(current.name);
+        if (hint != hints.end() && allows(hint->second) && free(hint->second))
+            current.reg = hint->second;
+        for (auto reg = allowed.begin(); current.reg.empty() && reg != allowed.end();
+             ++reg)
+        {
+            if (free(*reg))
+                current.reg = *reg;
+        }
+
+        if (current.reg.empty())
+        {
+            // take the register of the active interval that is cheapest to
+            // spill, unless that is the current one
+            Interval* victim = nullptr;
+            for (Interval* candidate : active)
+            {
+                if (allows(candidate->reg) &&
+                    (!victim || spill_cost(*candidate) < spill_cost(*victim)))
+                    victim = candidate;
+            }
+            if (!victim || spill_cost(*victim) >= spill_cost(current))
+                continue;
+
+            current.reg = victim->reg;
+            victim->reg.clear();
+            std::erase(active, victim);
+        }
+        active.push_back(&current);
+    }
+
+    // spilled intervals share slots whenever their lifetimes do not overlap
+    std::vector<size_t> slot_end;
+    for (const Interval& interval : intervals)
+    {
+        if (!interval.reg.empty())
+        {
+            allocation.registers[interval.name] = interval.reg;
+            continue;
+        }
+
+        size_t slot = 0;
+        while (slot < slot_end.size() && slot_end[slot] >= interval.start)
+        {
+            ++slot;
+        }
+        if (slot == slot_end.size())
+            slot_end.push_back(interval.end);
+        else
+            slot_end[slot] = interval.end;
+        allocation.slots[interval.name] = int(slot);
+    }
+    allocation.slot_count = int(slot_end.size());
+
+    for (const char* reg : callee_saved)
+    {
+        bool used = std::any_of(intervals.begin(),
+                                intervals.end(),
+                                [&](const Interval& interval)
+                                { return interval.reg == reg; });
+        if (used)
+            allocation.saved_registers.push_back(reg);
+    }
+    return allocation;
+}
+
+} // namespace codegen
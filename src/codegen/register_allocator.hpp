@@ -0,0 +1,55 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+#include "liveness.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace codegen {
+
+// Where the values of one function live: each one is either in a register or
+// in a stack slot for its whole lifetime. Slots are numbered from 0 and shared
+// by values whose lifetimes do not overlap.
+struct Allocation {
+    std::unordered_map<std::string, std::string> registers;
+    std::unordered_map<std::string, int> slots;
+    int slot_count = 0;
+    std::vector<std::string> saved_registers; // callee-saved registers in use
+};
+
+// Linear-scan register allocation over a single function body.
+//
+// Each variable is first split into its webs: definitions that reach a common
+// use belong together, and unrelated reuses of a name are renamed apart
+// (`x#1`, `x#2`, ...) so that each gets its own register or slot. The lifetime
+// of a value is approximated by one interval of the code, taken from liveness.
+// Intervals are then visited by start; when no register is free, the interval
+// with the lowest spill cost (uses weighted by loop depth, per instruction
+// covered) goes to the stack. Values live across a call only get callee-saved
+// registers. rax, rcx and rdx are never allocated: the code generator uses
+// them as scratch registers.
+class RegisterAllocator {
+  public:
+    explicit RegisterAllocator(const std::unordered_set<std::string>& globals)
+        : globals(globals)
+    {
+    }
+
+    // Renames the webs of `code` in place. The reads of instruction i happen
+    // at instruction evaluated_at[i], where its expression tree is computed;
+    // the temporaries inside a tree never leave the scratch registers.
+    Allocation run(std::vector<ir::Instruction>& code,
+                   const std::vector<size_t>& evaluated_at);
+
+  private:
+    const std::unordered_set<std::string>& globals;
+
+    bool is_local(const ir::Operand& op) const;
+    void split_webs(std::vector<ir::Instruction>& code,
+                    const std::vector<BasicBlock>& blocks);
+};
+
+} // namespace codegen
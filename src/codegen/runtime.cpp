@@ -0,0 +1,141 @@
+#include "runtime.hpp"
+
+#include <iterator>
+
+namespace codegen {
+
+namespace {
+
+const char* const runtime[] = {
+    "section .data",
+    "    neko.newline: db 10",
+    "",
+    "section .bss",
+    "    neko.buffer: resq 8192",
+    "    neko.buffered: resq 1",
+    "    neko.digits: resq 3",
+    "",
+    "section .text",
+    "_start:",
+    "    xor ebp, ebp",
+    "    call main",
+    "    mov rdi, rax",
+    "    jmp neko.exit",
+    "",
+    // the digits are produced backwards at the end of neko.digits, from the
+    // newline on; q = n / 10 is the high half of n * ceil(2^67 / 10) >> 3
+    "neko.print_int:",
+    "    mov rsi, neko.digits",
+    "    add rsi, 23",
+    "    mov byte [rsi], 10",
+    "    mov r9, rdi",
+    "    test r9, r9",
+    "    jns neko.print_int.next",
+    "    neg r9",
+    "neko.print_int.next:",
+    "    mov r10, -3689348814741910323",
+    "    mov rax, r9",
+    "    mul r10",
+    "    shr rdx, 3",
+    "    lea rax, [rdx + rdx*4]",
+    "    add rax, rax",
+    "    mov rcx, r9",
+    "    sub rcx, rax",
+    "    add rcx, 48",
+    "    dec rsi",
+    "    mov byte [rsi], cl",
+    "    mov r9, rdx",
+    "    test r9, r9",
+    "    jne neko.print_int.next",
+    "    test rdi, rdi",
+    "    jns neko.print_int.done",
+    "    dec rsi",
+    "    mov byte [rsi], 45",
+    "neko.print_int.done:",
+    "    mov rdx, neko.digits",
+    "    add rdx, 24",
+    "    sub rdx, rsi",
+    "    jmp neko.write",
+    "",
+    "neko.print_str:",
+    "    mov rsi, rdi",
+    "    xor edx, edx",
+    "neko.print_str.length:",
+    "    cmp byte [rdi + rdx], 0",
+    "    je neko.print_str.write",
+    "    inc rdx",
+    "    jmp neko.print_str.length",
+    "neko.print_str.write:",
+    "    call neko.write",
+    "    mov rsi, neko.newline",
+    "    mov edx, 1",
+    "    jmp neko.write",
+    "",
+    // appends the rdx bytes at rsi to the buffer, flushing it first if they
+    // do not fit; what is larger than the buffer is written out directly
+    "neko.write:",
+    "    mov rax, [neko.buffered]",
+    "    lea rcx, [rax + rdx]",
+    "    cmp rcx, 65536",
+    "    jbe neko.write.copy",
+    "    mov r8, rsi",
+    "    mov r9, rdx",
+    "    call neko.flush",
+    "    mov rsi, r8",
+    "    mov rdx, r9",
+    "    cmp rdx, 65536",
+    "    ja neko.write_all",
+    "    xor eax, eax",
+    "neko.write.copy:",
+    "    mov rdi, neko.buffer",
+    "    add rdi, rax",
+    "    add rax, rdx",
+    "    mov [neko.buffered], rax",
+    "neko.write.byte:",
+    "    test rdx, rdx",
+    "    je neko.write.done",
+    "    movzx ecx, byte [rsi]",
+    "    mov byte [rdi], cl",
+    "    inc rsi",
+    "    inc rdi",
+    "    dec rdx",
+    "    jmp neko.write.byte",
+    "neko.write.done:",
+    "    ret",
+    "",
+    "neko.flush:",
+    "    mov rsi, neko.buffer",
+    "    mov rdx, [neko.buffered]",
+    "    mov qword [neko.buffered], 0",
+    // writes the rdx bytes at rsi to stdout, however many calls that takes
+    "neko.write_all:",
+    "    test rdx, rdx",
+    "    jle neko.write_all.done",
+    "    mov eax, 1",
+    "    mov edi, 1",
+    "    syscall",
+    "    test rax, rax",
+    "    jle neko.write_all.done",
+    "    add rsi, rax",
+    "    sub rdx, rax",
+    "    jmp neko.write_all",
+    "neko.write_all.done:",
+    "    ret",
+    "",
+    "neko.exit:",
+    "    mov r8, rdi",
+    "    call neko.flush",
+    "    mov rdi, r8",
+    "    mov eax, 231",
+    "    syscall",
+};
+
+} // namespace
+
+void emit_runtime(std::vector<std::string>& output)
+{
+    output.push_back("");
+    output.insert(output.end(), std::begin(runtime), std::end(runtime));
+}
+
+} // namespace codegen
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace codegen {
+
+// The runtime every program carries along, so that it needs nothing from
+// libc. Its routines keep to the caller-saved registers, as calls to them
+// are treated like any other:
+//
+//   _start          calls main and exits with its result
+//   neko.print_int  prints rdi in decimal and a newline
+//   neko.print_str  prints the zero-terminated string at rdi and a newline
+//   neko.exit       flushes the output and ends the process with status rdi
+//
+// Output collects in a 64 KiB buffer that is written out with one write
+// system call when it fills up and at exit. Decimal digits come from a
+// multiplication by the reciprocal of 10 rather than a division. The names
+// contain a dot, which no name of the program can.
+void emit_runtime(std::vector<std::string>& output);
+
+} // namespace codegen
@@ -0,0 +1,396 @@
+#include "scheduler.hpp"
+
+#include "assembly.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
+
+namespace codegen {
+
+namespace {
+
+// execution ports
+constexpr unsigned p0 = 1 << 0;
+constexpr unsigned p1 = 1 << 1;
+constexpr unsigned p2 = 1 << 2;
+constexpr unsigned p3 = 1 << 3;
+constexpr unsigned p4 = 1 << 4;
+constexpr unsigned p5 = 1 << 5;
+constexpr unsigned p6 = 1 << 6;
+constexpr unsigned p7 = 1 << 7;
+constexpr unsigned alu = p0 | p1 | p5 | p6;
+
+constexpr int issue_width = 4;
+constexpr int load_latency = 5; // an L1 hit
+constexpr int store_forwarding = 5; // from a store to a load of the same place
+// blocks are scheduled in pieces of at most this many instructions
+constexpr size_t max_region = 256;
+
+// The latency of an operation on registers and the ports each of its uops
+// can go to, after the published measurements of Skylake-class cores. A
+// memory operand adds a load or store on top.
+struct Timing {
+    const char* mnemonic;
+    int operands; // 0 for any number
+    int latency;
+    std::vector<unsigned> uops;
+};
+
+const Timing timings[] = {
+    {"mov", 0, 1, {alu}},
+    {"movzx", 0, 1, {alu}},
+    {"lea", 0, 1, {p1 | p5}},
+    {"add", 0, 1, {alu}},
+    {"sub", 0, 1, {alu}},
+    {"and", 0, 1, {alu}},
+    {"or", 0, 1, {alu}},
+    {"xor", 0, 1, {alu}},
+    {"cmp", 0, 1, {alu}},
+    {"test", 0, 1, {alu}},
+    {"inc", 0, 1, {alu}},
+    {"dec", 0, 1, {alu}},
+    {"neg", 0, 1, {alu}},
+    {"shl", 0, 1, {p0 | p6}},
+    {"sar", 0, 1, {p0 | p6}},
+    {"shr", 0, 1, {p0 | p6}},
+    {"cmov", 0, 1, {p0 | p6}},
+    {"set", 0, 1, {p0 | p6}},
+    {"cqo", 0, 1, {p0 | p6}},
+    {"imul", 1, 4, {p1, p5}},
+    {"imul", 0, 3, {p1}},
+    {"div", 0, 35, {p0, p1, p5, p6}},
+    {"idiv", 0, 42, {p0, p1, p5, p6}},
+};
+
+const Timing& timing_of(const Line& line)
+{
+    static const Timing fallback = {"", 0, 1, {alu}};
+    for (const Timing& timing : timings)
+    {
+        bool same = line.mnemonic == timing.mnemonic ||
+                    ((timing.mnemonic == std::string("cmov") ||
+                      timing.mnemonic == std::string("set")) &&
+                     line.mnemonic.starts_with(timing.mnemonic));
+        if (same &&
+            (timing.operands == 0 || timing.operands == int(line.operands.size())))
+            return timing;
+    }
+    return fallback;
+}
+
+// where a memory operand points: a base register or symbol and a displacement
+struct Address {
+    bool known = false;
+    std::string base;
+    long offset = 0;
+};
+
+Address address_of(const std::string& operand)
+{
+    size_t open = operand.find('[');
+    size_t close = operand.find(']');
+    if (open == std::string::npos || close == std::string::npos)
+        return {};
+
+    Address address;
+    std::istringstream in(operand.substr(open + 1, close - open - 1));
+    in >> address.base;
+    char sign;
+    while (in >> sign)
+    {
+        long value;
+        if ((sign != '+' && sign != '-') || !(in >> value))
+            return {};
+        address.offset += sign == '-' ? -value : value;
+    }
+    address.known = !address.base.empty();
+    return address;
+}
+
+// Frame slots are told apart by their offsets from rbp or rsp, which only
+// the prologue and epilogue change, and globals by name; anything else may
+// be anywhere.
+bool may_alias(const std::string& a, const std::string& b)
+{
+    Address x = address_of(a);
+    Address y = address_of(b);
+    if (!x.known || !y.known)
+        return true;
+    bool x_register = is_register(x.base);
+    bool y_register = is_register(y.base);
+    if (x.base == y.base)
+        return (x.base != "rbp" && x.base != "rsp") ||
+               std::labs(x.offset - y.offset) < 8;
+    return x_register && y_register;
+}
+
+struct Node {
+    Line line;
+    Effects effects;
+    int latency = 0;
+    std::vector<unsigned> uops;
+    std::vector<std::pair<size_t, int>> successors; // with the latency in between
+    int predecessors = 0;
+    int priority = 0; // the longest path from here to the end of the region
+};
+
+Node node_of(const Line& line)
+{
+    Node node;
+    node.line = line;
+    node.effects = effects_of(line);
+    const Timing& timing = timing_of(line);
+    bool loads = !node.effects.loads.empty();
+    bool stores = !node.effects.stores.empty();
+    bool plain_move = line.mnemonic == "mov" && (loads || stores);
+
+    node.latency = plain_move ? 0 : timing.latency;
+    if (!plain_move)
+        node.uops = timing.uops;
+    // a shift by cl takes two uops
+    if (line.operands.size() == 2 && line.operands[1] == "cl")
+    {
+        node.latency = 2;
+        node.uops.push_back(p0 | p6);
+    }
+    if (loads)
+    {
+        node.latency += load_latency;
+        node.uops.push_back(p2 | p3);
+    }
+    if (stores)
+    {
+        node.latency = std::max(node.latency, 1);
+        node.uops.insert(node.uops.end(), {p4, p2 | p3 | p7});
+    }
+
+    // nothing may move across a change of the stack pointer that touches memory
+    if (std::count(node.effects.writes.begin(), node.effects.writes.end(), "rsp"))
+        node.effects.stores.push_back("*");
+    return node;
+}
+
+bool schedulable(const Line& line)
+{
+    if (!line.is_instruction || line.mnemonic == "call" || line.mnemonic == "push" ||
+        line.mnemonic == "pop")
+        return false;
+    Effects effects = effects_of(line);
+    return !effects.opaque && !effects.returns;
+}
+
+// the order to issue `nodes` in; `flags_live_out` when what follows reads the flags
+std::vector<size_t> schedule(std::vector<Node>& nodes, bool flags_live_out)
+{
+    size_t n = nodes.size();
+    auto depend = [&](size_t from, size_t to, int latency)
+    {
+        if (from == to)
+            return;
+        nodes[from].successors.emplace_back(to, latency);
+        nodes[to].predecessors++;
+    };
+
+    // registers: reads after writes wait for the result, the rest only keep
+    // their order
+    std::unordered_map<std::string, size_t> last_writer;
+    std::unordered_map<std::string, std::vector<size_t>> readers;
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (const std::string& reg : nodes[i].effects.reads)
+        {
+            if (auto writer = last_writer.find(reg); writer != last_writer.end())
+                depend(writer->second, i, nodes[writer->second].latency);
+            readers[reg].push_back(i);
+        }
+        for (const std::string& reg : nodes[i].effects.writes)
+        {
+            if (auto writer = last_writer.find(reg); writer != last_writer.end())
+                depend(writer->second, i, 0);
+            for (size_t reader : readers[reg])
+            {
+                depend(reader, i, 0);
+            }
+            readers[reg].clear();
+            last_writer[reg] = i;
+        }
+    }
+
+    // memory
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = 0; j < i; ++j)
+        {
+            const Effects& before = nodes[j].effects;
+            const Effects& after = nodes[i].effects;
+            auto overlap = [](const std::vector<std::string>& a,
+                              const std::vector<std::string>& b)
+            {
+                return std::any_of(a.begin(),
+                                   a.end(),
+                                   [&](const std::string& x)
+                                   {
+                                       return std::any_of(b.begin(),
+                                                          b.end(),
+                                                          [&](const std::string& y)
+                                                          { return may_alias(x, y); });
+                                   });
+            };
+            if (overlap(before.stores, after.loads))
+                depend(j, i, store_forwarding);
+            else if (overlap(before.stores, after.stores) ||
+                     overlap(before.loads, after.stores))
+                depend(j, i, 0);
+        }
+    }
+
+    // Flags: nearly every instruction writes them, but few of those values
+    // are read. Only a value that is read ties the other writers down, to
+    // before it is set or after its last reader. Readers with no writer in
+    // the region read the flags it starts with.
+    std::vector<size_t> writers;
+    std::map<long, std::vector<size_t>> readers_of;
+    long current = -1;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (nodes[i].effects.reads_flags)
+        {
+            readers_of[current].push_back(i);
+            if (current >= 0)
+                depend(current, i, nodes[current].latency);
+        }
+        if (nodes[i].effects.writes_flags)
+        {
+            writers.push_back(i);
+            current = long(i);
+        }
+    }
+    if (flags_live_out && current >= 0)
+    {
+        for (size_t writer : writers)
+        {
+            depend(writer, current, 0);
+        }
+    }
+    for (const auto& [definition, reading] : readers_of)
+    {
+        for (size_t writer : writers)
+        {
+            if (long(writer) < definition)
+                depend(writer, definition, 0);
+            else if (writer > reading.back())
+            {
+                for (size_t reader : reading)
+                {
+                    depend(reader, writer, 0);
+                }
+            }
+        }
+    }
+
+    for (size_t i = n; i-- > 0;)
+    {
+        nodes[i].priority = nodes[i].latency;
+        for (const auto& [successor, latency] : nodes[i].successors)
+        {
+            nodes[i].priority =
+                std::max(nodes[i].priority, latency + nodes[successor].priority);
+        }
+    }
+
+    // issue cycle by cycle, at most issue_width instructions and one uop per
+    // port each
+    std::vector<size_t> order;
+    std::vector<int> earliest(n, 0);
+    std::vector<bool> issued(n, false);
+    int cycle = 0;
+    int issued_now = 0;
+    unsigned busy = 0;
+    auto assign = [](const Node& node, unsigned busy) -> std::optional<unsigned>
+    {
+        for (unsigned ports : node.uops)
+        {
+            unsigned free = ports & ~busy;
+            if (!free)
+                return std::nullopt;
+            busy |= free & -free;
+        }
+        return busy;
+    };
+    while (order.size() < n)
+    {
+        size_t best = n;
+        if (issued_now < issue_width)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (issued[i] || nodes[i].predecessors > 0 || earliest[i] > cycle ||
+                    !assign(nodes[i], busy))
+                    continue;
+                if (best == n || nodes[i].priority > nodes[best].priority)
+                    best = i;
+            }
+        }
+        if (best == n)
+        {
+            cycle++;
+            issued_now = 0;
+            busy = 0;
+            continue;
+        }
+
+        busy = *assign(nodes[best], busy);
+        issued_now++;
+        issued[best] = true;
+        order.push_back(best);
+        for (const auto& [successor, latency] : nodes[best].successors)
+        {
+            nodes[successor].predecessors--;
+            earliest[successor] = std::max(earliest[successor], cycle + latency);
+        }
+    }
+    return order;
+}
+
+} // namespace
+
+void Scheduler::run(std::vector<std::string>& lines)
+{
+    std::vector<Line> code;
+    std::transform(lines.begin(), lines.end(), std::back_inserter(code), parse_line);
+
+    std::vector<Line> scheduled;
+    std::vector<Node> region;
+    auto flush = [&](bool flags_live_out)
+    {
+        for (size_t i : schedule(region, flags_live_out))
+        {
+            scheduled.push_back(std::move(region[i].line));
+        }
+        region.clear();
+    };
+    for (Line& line : code)
+    {
+        if (schedulable(line))
+        {
+            region.push_back(node_of(line));
+            if (region.size() == max_region)
+                flush(true);
+            continue;
+        }
+        flush(line.is_instruction && effects_of(line).reads_flags);
+        scheduled.push_back(std::move(line));
+    }
+    flush(false);
+
+    lines.clear();
+    std::transform(
+        scheduled.begin(), scheduled.end(), std::back_inserter(lines), format_line);
+}
+
+} // namespace codegen
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace codegen {
+
+// List scheduling of generated assembly, one basic block at a time.
+//
+// The instructions between two labels, jumps or calls are reordered along
+// their dependences on registers, flags and memory, so that independent work
+// fills the time a multiply, a division or a load takes to deliver its
+// result. The timing comes from a table of latencies and execution ports of
+// a current x86-64 core: each cycle, the ready instruction on the longest
+// path to the end of the block is issued, as long as a port it can run on is
+// still free. Ties keep the original order, so the result is deterministic.
+class Scheduler {
+  public:
+    // reorders `lines`, code of the text section, one line of assembly each
+    void run(std::vector<std::string>& lines);
+};
+
+} // namespace codegen
@@ -0,0 +1,85 @@
+#include "function.hpp"
+
+#include <iterator>
+
+namespace ir {
+
+std::vector<std::string> Function::parameters() const
+{
+    std::vector<std::string> params;
+    for (const Instruction& inst : body)
+    {
+        if (inst.op == OpCode::PARAM_BIND)
+        {
+            size_t index = std::stoul(inst.arg2->value);
+            if (params.size() <= index)
+                params.resize(index + 1);
+            params[index] = inst.arg1->name;
+        }
+    }
+    return params;
+}
+
+bool is_function_entry(const std::vector<Instruction>& code, size_t index)
+{
+    return code[index].op == OpCode::LABEL && index + 1 < code.size() &&
+           code[index + 1].op == OpCode::PROLOGUE;
+}
+
+std::vector<Function> split_functions(const Program& program)
+{
+    const auto& code = program.get_instructions();
+    std::vector<Function> functions;
+    functions.push_back({"main", {}});
+
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (is_function_entry(code, i))
+        {
+            functions.push_back({code[i].arg1->name, {}});
+        }
+        functions.back().body.push_back(code[i]);
+    }
+    return functions;
+}
+
+void join_functions(Program& program, std::vector<Function> functions)
+{
+    auto& code = program.get_instructions();
+    code.clear();
+    for (Function& function : functions)
+    {
+        code.insert(code.end(),
+                    std::make_move_iterator(function.body.begin()),
+                    std::make_move_iterator(function.body.end()));
+    }
+}
+
+std::vector<Program> split_parts(const Program& program)
+{
+    std::vector<Function> functions = split_functions(program);
+    std::vector<Program> parts;
+    parts.reserve(functions.size());
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        parts.push_back(
+            program.part(std::move(functions[i].body), int(i), int(functions.size())));
+    }
+    return parts;
+}
+
+void merge_parts(Program& program, std::vector<Program> parts)
+{
+    auto& code = program.get_instructions();
+    code.clear();
+    for (Program& part : parts)
+    {
+        auto& body = part.get_instructions();
+        code.insert(code.end(),
+                    std::make_move_iterator(body.begin()),
+                    std::make_move_iterator(body.end()));
+        program.adopt_names(part);
+    }
+}
+
+} // namespace ir
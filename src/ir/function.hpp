@@ -0,0 +1,36 @@
+#pragma once
+
+#include "tac.hpp"
+
+#include <string>
+#include <vector>
+
+namespace ir {
+
+// One unit of the flat program: either the top-level code, which becomes
+// `main`, or a single function from its entry label to the next function.
+struct Function {
+    std::string name;
+    std::vector<Instruction> body;
+
+    bool is_main() const { return name == "main"; }
+
+    // names bound by the PARAM_BIND instructions, in parameter order
+    std::vector<std::string> parameters() const;
+};
+
+// an entry label is the LABEL immediately followed by PROLOGUE
+bool is_function_entry(const std::vector<Instruction>& code, size_t index);
+
+// Splits the program into its top-level code and its functions, in program
+// order. join_functions() reverses this.
+std::vector<Function> split_functions(const Program& program);
+void join_functions(Program& program, std::vector<Function> functions);
+
+// Splits the program into one part per function, main first, for the
+// functions to be optimized independently of each other. merge_parts()
+// joins the parts back in the same order.
+std::vector<Program> split_parts(const Program& program);
+void merge_parts(Program& program, std::vector<Program> parts);
+
+} // namespace ir
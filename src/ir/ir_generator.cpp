@@ -18,9 +18,13 @@ Program IRGenerator::generate(const std::vector<Stmt*>& statements)
         else
         {
             globals.push_back(stmt);
+            if (auto* var = dynamic_cast<VarStmt*>(stmt))
+                global_names.insert(var->name.value.value());
         }
     }
 
+    scopes.emplace_back();
+
     // emit globals first
     for (Stmt* stmt : globals)
     {
@@ -42,6 +46,40 @@ Program IRGenerator::generate(const std::vector<Stmt*>& statements)
     return std::move(program);
 }
 
+Operand IRGenerator::declare(const std::string& name)
+{
+    if (block_depth == 0)
+    {
+        program.add_global(name);
+        scopes.front()[name] = name;
+        return Operand::variable(name);
+    }
+
+    // a local is renamed when it shares its name with a global or shadows a
+    // variable of an enclosing block
+    bool taken = global_names.count(name) > 0;
+    for (const auto& scope : scopes)
+    {
+        taken |= scope.count(name) > 0;
+    }
+
+    Operand var = taken ? program.new_variable(name) : Operand::variable(name);
+    scopes.back()[name] = var.name;
+    return var;
+}
+
+Operand IRGenerator::resolve(const std::string& name) const
+{
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+    {
+        auto found = scope->find(name);
+        if (found != scope->end())
+            return Operand::variable(found->second);
+    }
+    // functions are not tracked in scopes
+    return Operand::variable(name);
+}
+
 void IRGenerator::visitBinaryExpr(BinaryExpr* expr)
 {
     Operand left = gen(expr->left);
@@ -97,6 +135,8 @@ void IRGenerator::visitUnaryExpr(UnaryExpr* expr)
     OpCode op;
     if (expr->op.type == TokenType::BANG)
         op = OpCode::NOT;
+    else if (expr->op.type == TokenType::MINUS)
+        op = OpCode::NEG;
     else
         return;
 
@@ -121,14 +161,15 @@ void IRGenerator::visitLiteralExpr(LiteralExpr* expr)
 
 void IRGenerator::visitVariableExpr(VariableExpr* expr)
 {
-    last_expr_result = Operand::variable(expr->name.value.value());
+    last_expr_result = resolve(expr->name.value.value());
 }
 
 void IRGenerator::visitAssignmentExpr(AssignmentExpr* expr)
 {
     Operand value = gen(expr->value);
-    emit(OpCode::ASSIGN, Operand::variable(expr->name.value.value()), value);
-    last_expr_result = Operand::variable(expr->name.value.value());
+    Operand var = resolve(expr->name.value.value());
+    emit(OpCode::ASSIGN, var, value);
+    last_expr_result = var;
 }
 
 void IRGenerator::visitCallExpr(CallExpr* expr)
@@ -165,28 +206,39 @@ void IRGenerator::visitPrintStmt(PrintStmt* stmt)
 
 void IRGenerator::visitBlockStmt(BlockStmt* stmt)
 {
+    block_depth++;
+    scopes.emplace_back();
     for (Stmt* s : stmt->statements)
     {
         gen(s);
     }
+    scopes.pop_back();
+    block_depth--;
 }
 
 void IRGenerator::visitIfStmt(IfStmt* stmt)
 {
     Operand condition = gen(stmt->condition);
-    Operand else_label = new_label("else");
-    Operand end_label = new_label("endif");
+    Operand else_label = new_label(stmt->elseBranch ? "else" : "endif");
 
     emit(OpCode::JUMP_IF_FALSE, std::nullopt, condition, else_label);
     gen(stmt->thenBranch);
-    emit(OpCode::JUMP, std::nullopt, end_label);
-
-    emit(OpCode::LABEL, std::nullopt, else_label);
-    if (stmt->elseBranch)
+    if (!stmt->elseBranch)
     {
-        gen(stmt->elseBranch);
+        emit(OpCode::LABEL, std::nullopt, else_label);
+        return;
     }
-    emit(OpCode::LABEL, std::nullopt, end_label);
+
+    // a then branch that ends in a return does not need to skip the else branch
+    Operand end_label = new_label("endif");
+    bool skip_else = !ends_in_jump();
+    if (skip_else)
+        emit(OpCode::JUMP, std::nullopt, end_label);
+
+    emit(OpCode::LABEL, std::nullopt, else_label);
+    gen(stmt->elseBranch);
+    if (skip_else)
+        emit(OpCode::LABEL, std::nullopt, end_label);
 }
 
 void IRGenerator::visitWhileStmt(WhileStmt* stmt)
@@ -203,6 +255,41 @@ void IRGenerator::visitWhileStmt(WhileStmt* stmt)
     emit(OpCode::JUMP_IF_TRUE, std::nullopt, condition, start_label);
 }
 
+void IRGenerator::visitSwitchStmt(SwitchStmt* stmt)
+{
+    // the value is tested against every case in turn; the code generator
+    // turns such a run of tests into a jump table or a binary search
+    Operand subject = gen(stmt->subject);
+
+    std::vector<Operand> case_labels;
+    for (const SwitchStmt::Case& c : stmt->cases)
+    {
+        case_labels.push_back(new_label("case"));
+        emit(OpCode::JUMP_IF_EQ,
+             case_labels.back(),
+             subject,
+             Operand::integer(c.value));
+    }
+    Operand end_label = new_label("endswitch");
+    Operand default_label = stmt->defaultBranch ? new_label("default") : end_label;
+    emit(OpCode::JUMP, std::nullopt, default_label);
+
+    // no case falls through into the next
+    for (size_t i = 0; i < stmt->cases.size(); ++i)
+    {
+        emit(OpCode::LABEL, std::nullopt, case_labels[i]);
+        gen(stmt->cases[i].body);
+        if (!ends_in_jump())
+            emit(OpCode::JUMP, std::nullopt, end_label);
+    }
+    if (stmt->defaultBranch)
+    {
+        emit(OpCode::LABEL, std::nullopt, default_label);
+        gen(stmt->defaultBranch);
+    }
+    emit(OpCode::LABEL, std::nullopt, end_label);
+}
+
 void IRGenerator::visitReturnStmt(ReturnStmt* stmt)
 {
     if (stmt->value)
@@ -218,11 +305,14 @@ void IRGenerator::visitReturnStmt(ReturnStmt* stmt)
 
 void IRGenerator::visitVarStmt(VarStmt* stmt)
 {
+    // the initializer still sees the variable the declaration shadows
+    std::optional<Operand> value;
     if (stmt->initializer)
-    {
-        Operand value = gen(stmt->initializer);
-        emit(OpCode::ASSIGN, Operand::variable(stmt->name.value.value()), value);
-    }
+        value = gen(stmt->initializer);
+
+    Operand var = declare(stmt->name.value.value());
+    if (value)
+        emit(OpCode::ASSIGN, var, *value);
 }
 
 void IRGenerator::visitFunctionStmt(FunctionStmt* stmt)
@@ -230,15 +320,19 @@ void IRGenerator::visitFunctionStmt(FunctionStmt* stmt)
     emit(OpCode::LABEL, std::nullopt, Operand::label(stmt->name.value.value()));
     emit(OpCode::PROLOGUE);
 
+    block_depth++;
+    scopes.emplace_back();
     for (size_t i = 0; i < stmt->parameters.size(); ++i)
     {
         emit(OpCode::PARAM_BIND,
              std::nullopt,
-             Operand::variable(stmt->parameters[i].value.value()),
+             declare(stmt->parameters[i].value.value()),
              Operand::constant(std::to_string(i)));
     }
 
     gen(stmt->body);
+    scopes.pop_back();
+    block_depth--;
 
     // only emit implicit return if the last instruction wasn't already a return
     const Instruction* last = program.get_last_instruction();
@@ -5,6 +5,8 @@
 #include "tac.hpp"
 
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace ir {
@@ -28,20 +30,29 @@ class IRGenerator : public ExprVisitor, public StmtVisitor {
     void visitBlockStmt(BlockStmt* stmt) override;
     void visitIfStmt(IfStmt* stmt) override;
     void visitWhileStmt(WhileStmt* stmt) override;
+    void visitSwitchStmt(SwitchStmt* stmt) override;
     void visitReturnStmt(ReturnStmt* stmt) override;
     void visitVarStmt(VarStmt* stmt) override;
     void visitFunctionStmt(FunctionStmt* stmt) override;
 
   private:
     Program program;
-    int next_temp = 0;
-    int next_label = 0;
     Operand last_expr_result = Operand::constant("null");
+    int block_depth = 0; // 0 while emitting top-level statements
 
-    Operand new_temp() { return Operand::temporary(next_temp++); }
+    // IR name of each variable in scope, innermost scope last. Locals that
+    // would share a name with a global or with a variable they shadow are
+    // renamed, so that every name denotes a single storage location.
+    std::vector<std::unordered_map<std::string, std::string>> scopes;
+    std::unordered_set<std::string> global_names;
+
+    Operand declare(const std::string& name);
+    Operand resolve(const std::string& name) const;
+
+    Operand new_temp() { return program.new_temp(); }
     Operand new_label(const std::string& prefix = "L")
     {
-        return Operand::label(prefix + std::to_string(next_label++));
+        return program.new_label(prefix);
     }
 
     void emit(OpCode op,
@@ -52,6 +63,15 @@ class IRGenerator : public ExprVisitor, public StmtVisitor {
         program.add_instruction({op, res, a1, a2});
     }
 
+    // true when control cannot fall out of the code emitted last
+    bool ends_in_jump() const
+    {
+        const auto& code = program.get_instructions();
+        return !code.empty() &&
+               (code.back().op == OpCode::JUMP || code.back().op == OpCode::RETURN ||
+                code.back().op == OpCode::HALT);
+    }
+
     void gen(Stmt* stmt) { stmt->accept(*this); }
     Operand gen(Expr* expr)
     {
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
@@ -28,6 +32,10 @@ struct Operand {
     {
         return {OperandType::CONSTANT, "", std::move(value)};
     }
+    static Operand integer(int64_t value)
+    {
+        return {OperandType::CONSTANT, "", std::to_string(value)};
+    }
     static Operand label(std::string name)
     {
         return {OperandType::LABEL, std::move(name), ""};
@@ -39,6 +47,32 @@ struct Operand {
             return value;
         return name;
     }
+
+    // integer value of a numeric/boolean/null constant, nullopt for anything else
+    std::optional<int64_t> as_integer() const
+    {
+        if (type != OperandType::CONSTANT)
+            return std::nullopt;
+        if (value == "true")
+            return 1;
+        if (value == "false" || value == "null")
+            return 0;
+
+        int64_t result = 0;
+        const char* first = value.data();
+        const char* last = value.data() + value.size();
+        auto [ptr, ec] = std::from_chars(first, last, result);
+        if (ec != std::errc() || ptr != last)
+            return std::nullopt;
+        return result;
+    }
+
+    bool is_integer() const { return as_integer().has_value(); }
+
+    bool operator==(const Operand& other) const
+    {
+        return type == other.type && name == other.name && value == other.value;
+    }
 };
 
 enum class OpCode {
@@ -46,6 +80,12 @@ enum class OpCode {
     SUB,
     MUL,
     DIV,
+    UDIV, // division known to have a non-negative dividend and a positive divisor
+    MULHI, // high 64 bits of the signed 128-bit product
+    SHL,
+    SAR, // arithmetic shift right
+    SHR, // logical shift right
+    NEG,
     NOT,
     ASSIGN,
     JUMP,
@@ -53,6 +93,7 @@ enum class OpCode {
     JUMP_IF_TRUE,
     LABEL,
     CALL,
+    TAIL_CALL, // call whose result is returned directly, lowered to a jmp
     RETURN,
     PARAM,
     PARAM_BIND,
@@ -64,14 +105,220 @@ enum class OpCode {
     LE,
     GE,
     EQ,
-    NE
+    NE,
+    // compare-and-branch: jump to the label in `result` when the comparison
+    // of arg1 with arg2 holds
+    JUMP_IF_LT,
+    JUMP_IF_GT,
+    JUMP_IF_LE,
+    JUMP_IF_GE,
+    JUMP_IF_EQ,
+    JUMP_IF_NE,
+    SELECT // result = arg1 != 0 ? arg2 : arg3
 };
 
+inline bool is_comparison(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::LT:
+    case OpCode::GT:
+    case OpCode::LE:
+    case OpCode::GE:
+    case OpCode::EQ:
+    case OpCode::NE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool is_compare_branch(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::JUMP_IF_LT:
+    case OpCode::JUMP_IF_GT:
+    case OpCode::JUMP_IF_LE:
+    case OpCode::JUMP_IF_GE:
+    case OpCode::JUMP_IF_EQ:
+    case OpCode::JUMP_IF_NE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the compare-and-branch taken exactly when `comparison` holds
+inline OpCode branch_on(OpCode comparison)
+{
+    switch (comparison)
+    {
+    case OpCode::LT:
+        return OpCode::JUMP_IF_LT;
+    case OpCode::GT:
+        return OpCode::JUMP_IF_GT;
+    case OpCode::LE:
+        return OpCode::JUMP_IF_LE;
+    case OpCode::GE:
+        return OpCode::JUMP_IF_GE;
+    case OpCode::EQ:
+        return OpCode::JUMP_IF_EQ;
+    default:
+        return OpCode::JUMP_IF_NE;
+    }
+}
+
+// the comparison a compare-and-branch tests
+inline OpCode compared_by(OpCode branch)
+{
+    switch (branch)
+    {
+    case OpCode::JUMP_IF_LT:
+        return OpCode::LT;
+    case OpCode::JUMP_IF_GT:
+        return OpCode::GT;
+    case OpCode::JUMP_IF_LE:
+        return OpCode::LE;
+    case OpCode::JUMP_IF_GE:
+        return OpCode::GE;
+    case OpCode::JUMP_IF_EQ:
+        return OpCode::EQ;
+    default:
+        return OpCode::NE;
+    }
+}
+
+// the comparison that holds exactly when `comparison` does not
+inline OpCode negate(OpCode comparison)
+{
+    switch (comparison)
+    {
+    case OpCode::LT:
+        return OpCode::GE;
+    case OpCode::GT:
+        return OpCode::LE;
+    case OpCode::LE:
+        return OpCode::GT;
+    case OpCode::GE:
+        return OpCode::LT;
+    case OpCode::EQ:
+        return OpCode::NE;
+    default:
+        return OpCode::EQ;
+    }
+}
+
+// the comparison that holds for (b, a) exactly when `comparison` holds for (a, b)
+inline OpCode mirror(OpCode comparison)
+{
+    switch (comparison)
+    {
+    case OpCode::LT:
+        return OpCode::GT;
+    case OpCode::GT:
+        return OpCode::LT;
+    case OpCode::LE:
+        return OpCode::GE;
+    case OpCode::GE:
+        return OpCode::LE;
+    default:
+        return comparison;
+    }
+}
+
+inline std::string comparison_symbol(OpCode comparison)
+{
+    switch (comparison)
+    {
+    case OpCode::LT:
+        return "<";
+    case OpCode::GT:
+        return ">";
+    case OpCode::LE:
+        return "<=";
+    case OpCode::GE:
+        return ">=";
+    case OpCode::EQ:
+        return "==";
+    default:
+        return "!=";
+    }
+}
+
 struct Instruction {
     OpCode op;
     std::optional<Operand> result;
     std::optional<Operand> arg1;
     std::optional<Operand> arg2;
+    std::optional<Operand> arg3 = std::nullopt; // only SELECT has a third operand
+
+    bool is_jump() const
+    {
+        return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE ||
+               op == OpCode::JUMP_IF_TRUE || is_compare_branch(op);
+    }
+
+    bool is_call() const { return op == OpCode::CALL || op == OpCode::TAIL_CALL; }
+
+    // label operand of a jump, nullptr for every other instruction
+    const Operand* jump_target() const
+    {
+        if (op == OpCode::JUMP)
+            return &*arg1;
+        if (op == OpCode::JUMP_IF_FALSE || op == OpCode::JUMP_IF_TRUE)
+            return &*arg2;
+        if (is_compare_branch(op))
+            return &*result;
+        return nullptr;
+    }
+
+    // the variable or temporary written by this instruction, if any
+    const Operand* def() const
+    {
+        if (op == OpCode::PARAM_BIND)
+            return &*arg1;
+        if (is_compare_branch(op))
+            return nullptr;
+        return result ? &*result : nullptr;
+    }
+
+    // operands read by this instruction; labels, call targets and the
+    // bookkeeping constants of CALL and PARAM_BIND are not values
+    std::vector<Operand*> uses()
+    {
+        switch (op)
+        {
+        case OpCode::LABEL:
+        case OpCode::JUMP:
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::PARAM_BIND:
+        case OpCode::PROLOGUE:
+        case OpCode::HALT:
+            return {};
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::JUMP_IF_TRUE:
+            return {&*arg1};
+        default:
+            break;
+        }
+
+        std::vector<Operand*> operands;
+        if (arg1)
+            operands.push_back(&*arg1);
+        if (arg2)
+            operands.push_back(&*arg2);
+        if (arg3)
+            operands.push_back(&*arg3);
+        return operands;
+    }
+
+    std::vector<const Operand*> uses() const
+    {
+        auto operands = const_cast<Instruction*>(this)->uses();
+        return {operands.begin(), operands.end()};
+    }
 
     std::string to_string() const
     {
@@ -89,6 +336,23 @@ struct Instruction {
         case OpCode::DIV:
             return result->to_string() + " = " + arg1->to_string() + " / " +
                    arg2->to_string();
+        case OpCode::UDIV:
+            return result->to_string() + " = " + arg1->to_string() + " u/ " +
+                   arg2->to_string();
+        case OpCode::MULHI:
+            return result->to_string() + " = " + arg1->to_string() + " mulhi " +
+                   arg2->to_string();
+        case OpCode::SHL:
+            return result->to_string() + " = " + arg1->to_string() + " << " +
+                   arg2->to_string();
+        case OpCode::SAR:
+            return result->to_string() + " = " + arg1->to_string() + " >> " +
+                   arg2->to_string();
+        case OpCode::SHR:
+            return result->to_string() + " = " + arg1->to_string() +
+                   " >>> " + arg2->to_string();
+        case OpCode::NEG:
+            return result->to_string() + " = -" + arg1->to_string();
         case OpCode::NOT:
             return result->to_string() + " = !" + arg1->to_string();
         case OpCode::ASSIGN:
@@ -104,6 +368,8 @@ struct Instruction {
         case OpCode::CALL:
             return (result ? result->to_string() + " = " : "") + "call " +
                    arg1->to_string() + ", " + arg2->to_string();
+        case OpCode::TAIL_CALL:
+            return "tailcall " + arg1->to_string() + ", " + arg2->to_string();
         case OpCode::RETURN:
             return "return " + (arg1 ? arg1->to_string() : "");
         case OpCode::PARAM:
@@ -134,6 +400,18 @@ struct Instruction {
         case OpCode::NE:
             return result->to_string() + " = " + arg1->to_string() +
                    " != " + arg2->to_string();
+        case OpCode::JUMP_IF_LT:
+        case OpCode::JUMP_IF_GT:
+        case OpCode::JUMP_IF_LE:
+        case OpCode::JUMP_IF_GE:
+        case OpCode::JUMP_IF_EQ:
+        case OpCode::JUMP_IF_NE:
+            return "if " + arg1->to_string() + " " +
+                   comparison_symbol(compared_by(op)) + " " + arg2->to_string() +
+                   " goto " + result->to_string();
+        case OpCode::SELECT:
+            return result->to_string() + " = " + arg1->to_string() + " ? " +
+                   arg2->to_string() + " : " + arg3->to_string();
         default:
             return "unknown";
         }
@@ -144,6 +422,51 @@ class Program {
   public:
     void add_instruction(Instruction inst) { instructions.push_back(std::move(inst)); }
     const std::vector<Instruction>& get_instructions() const { return instructions; }
+    std::vector<Instruction>& get_instructions() { return instructions; }
+
+    // temporaries and labels are numbered program-wide so that optimization
+    // passes can introduce new ones without clashing with the generator's
+    Operand new_temp() { return Operand::temporary(next(next_temp)); }
+    Operand new_label(const std::string& prefix = "L")
+    {
+        return Operand::label(prefix + std::to_string(next(next_label)));
+    }
+
+    // fresh variable derived from `base`; the '.' keeps it apart from source names
+    Operand new_variable(const std::string& base)
+    {
+        return Operand::variable(base + "." + std::to_string(next(next_variable)));
+    }
+
+    // Part `index` of `count` parts of the program that are optimized apart,
+    // holding `code` and sharing the globals. The parts number new names in
+    // interleaved sequences, so that those stay unique across all of them;
+    // adopt_names() takes the numbering over again once they are joined.
+    Program part(std::vector<Instruction> code, int index, int count) const
+    {
+        Program part;
+        part.instructions = std::move(code);
+        part.globals = globals;
+        part.next_temp = next_temp + index;
+        part.next_label = next_label + index;
+        part.next_variable = next_variable + index;
+        part.step = count;
+        return part;
+    }
+
+    void adopt_names(const Program& part)
+    {
+        next_temp = std::max(next_temp, part.next_temp);
+        next_label = std::max(next_label, part.next_label);
+        next_variable = std::max(next_variable, part.next_variable);
+    }
+
+    // variables declared at the top level of the program; everything else is
+    // local to the function (or top-level block) that declares it
+    void add_global(const std::string& name) { globals.insert(name); }
+    void remove_global(const std::string& name) { globals.erase(name); }
+    bool is_global(const std::string& name) const { return globals.count(name) > 0; }
+    const std::unordered_set<std::string>& get_globals() const { return globals; }
 
     const Instruction* get_last_instruction() const
     {
@@ -152,23 +475,35 @@ class Program {
         return &instructions.back();
     }
 
-    void print() const
+    void print(std::ostream& out = std::cout) const
     {
         for (const auto& inst : instructions)
         {
             if (inst.op == OpCode::LABEL)
             {
-                std::cout << inst.to_string() << std::endl;
+                out << inst.to_string() << '\n';
             }
             else
             {
-                std::cout << "  " << inst.to_string() << std::endl;
+                out << "  " << inst.to_string() << '\n';
             }
         }
     }
 
   private:
     std::vector<Instruction> instructions;
+    std::unordered_set<std::string> globals;
+    int next_temp = 0;
+    int next_label = 0;
+    int next_variable = 0;
+    int step = 1; // between the numbers of successive names
+
+    int next(int& counter)
+    {
+        int number = counter;
+        counter += step;
+        return number;
+    }
 };
 
 } // namespace ir
@@ -8,6 +8,9 @@ const std::unordered_map<std::string, TokenType> Lexer::keywords = {
     {"while", TokenType::WHILE},
     {"if", TokenType::IF},
     {"else", TokenType::ELSE},
+    {"switch", TokenType::SWITCH},
+    {"case", TokenType::CASE},
+    {"default", TokenType::DEFAULT},
     {"true", TokenType::TRUE},
     {"false", TokenType::FALSE},
     {"null", TokenType::NULL_TOK}};
@@ -241,7 +244,8 @@ const std::string& Lexer::tokenToString(TokenType type) const
         "IDENTIFIER", "STRING",      "NUMBER",
 
         "VAR",        "FUNCTION",    "RETURN",     "PRINT",         "WHILE",
-        "IF",         "ELSE",        "TRUE",       "FALSE",         "NULL_TOK",
+        "IF",         "ELSE",        "SWITCH",     "CASE",          "DEFAULT",
+        "TRUE",       "FALSE",       "NULL_TOK",
 
         "EOF_TOK",    "INVALID"};
 
@@ -40,6 +40,9 @@ enum class TokenType {
     WHILE,
     IF,
     ELSE,
+    SWITCH,
+    CASE,
+    DEFAULT,
     TRUE,
     FALSE,
     NULL_TOK,
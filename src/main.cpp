@@ -1,10 +1,19 @@
+#include "codegen/c_generator.hpp"
 #include "codegen/codegen.hpp"
+#include "codegen/elf_writer.hpp"
+#include "codegen/encoder.hpp"
+#include "codegen/jit.hpp"
 #include "ir/ir_generator.hpp"
 #include "lexer/lexer.hpp"
+#include "opt/optimizer.hpp"
 #include "parser/ast_printer.hpp"
 #include "parser/parser.hpp"
 #include "sema/semantic_analyzer.hpp"
+#include "support/output_file.hpp"
+#include "support/thread_pool.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
@@ -14,12 +23,101 @@
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    const char* source_arg = nullptr;
+    int opt_level = 1;
+    bool peephole_stats = false;
+    bool run = false;
+    std::string target = "x86-64";
+    // what to stop at: ast, ir, asm or obj; empty for the final form of the target
+    std::string emit;
+    std::string output_path;
+    unsigned threads = 0; // one per hardware thread
+    bool valid = true;
+
+    for (int i = 1; i < argc && valid; ++i)
     {
-        std::cout << "Usage: neko <source-file>.js" << std::endl;
+        std::string arg = argv[i];
+        if (arg.size() == 3 && arg.starts_with("-O") && std::isdigit(arg[2]))
+        {
+            opt_level = arg[2] - '0';
+        }
+        else if (arg.size() > 2 && arg.size() < 6 && arg.starts_with("-j") &&
+                 std::all_of(arg.begin() + 2,
+                             arg.end(),
+                             [](char c) { return std::isdigit(c); }))
+        {
+            // -j0 picks the number of hardware threads, as without -j
+            threads = unsigned(std::stoul(arg.substr(2)));
+        }
+        else if (arg == "--peephole-stats")
+        {
+            peephole_stats = true;
+        }
+        else if (arg == "--emit=ast" || arg == "--emit=ir" || arg == "--emit=asm" ||
+                 arg == "--emit=obj")
+        {
+            emit = arg.substr(7);
+        }
+        else if (arg == "--asm")
+        {
+            emit = "asm";
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (arg == "--run")
+        {
+            run = true;
+        }
+        else if (arg == "--target=x86-64" || arg == "--target=c")
+        {
+            target = arg.substr(9);
+        }
+        else if (!source_arg && !arg.starts_with("-"))
+        {
+            source_arg = argv[i];
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    // a running program writes nothing but its own output, and C is neither
+    // assembled nor run
+    if (run && (!emit.empty() || !output_path.empty()))
+        valid = false;
+    if (target == "c" && (run || emit == "asm" || emit == "obj"))
+        valid = false;
+
+    if (!source_arg || !valid)
+    {
+        std::cout << "Usage: neko [-O0|-O1|-O2] [-j<threads>] [--peephole-stats] "
+                     "[--emit=ast|ir|asm|obj] [-o <file>] [--run] [--target=x86-64|c] "
+                     "<source-file>"
+                  << std::endl;
         return EXIT_FAILURE;
     }
 
+    if (emit.empty())
+        emit = target == "c" ? "c" : "obj";
+    if (output_path.empty())
+    {
+        // the dumps of the compiler's own data structures go to the terminal
+        output_path = emit == "ast" || emit == "ir" ? "-"
+                      : emit == "asm"               ? "output.asm"
+                      : emit == "c"                 ? "output.c"
+                                                    : "output.o";
+    }
+    else if (output_path != "-")
+    {
+        // a path given with -o is relative to where neko was started
+        output_path = std::filesystem::absolute(output_path).string();
+    }
+    // and so is the source file
+    std::filesystem::path sourcePath = std::filesystem::absolute(source_arg);
+
     try
     {
         std::filesystem::current_path("build");
@@ -30,17 +128,13 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
-    std::cout << "Reading source file: " << argv[1] << std::endl;
-    std::cout << std::endl;
-
-    std::filesystem::path sourcePath = argv[1];
     std::string sourceCode;
 
     {
         std::ifstream sourceFile(sourcePath, std::ios::in);
         if (!sourceFile.is_open())
         {
-            std::cerr << "Error: Could not open file " << argv[1] << std::endl;
+            std::cerr << "Error: Could not open file " << source_arg << std::endl;
             return EXIT_FAILURE;
         }
 
@@ -49,9 +143,6 @@ int main(int argc, char* argv[])
         sourceCode = buffer.str();
     }
 
-    std::cout << "Tokenizing source code..." << std::endl;
-    std::cout << std::endl;
-
     Lexer lexer(sourceCode);
     std::vector<Token> tokens;
 
@@ -62,14 +153,10 @@ int main(int argc, char* argv[])
         tokens.push_back(token);
     } while (token.type != TokenType::EOF_TOK);
 
-    std::cout << "Parsing tokens into AST..." << std::endl;
-    std::cout << std::endl;
-
     Parser parser(tokens);
     std::vector<Stmt*> statements = parser.parse();
-
-    std::cout << "Performing semantic analysis..." << std::endl;
-    std::cout << std::endl;
+    if (parser.has_errors())
+        return EXIT_FAILURE;
 
     ErrorHandler semaErrorHandler;
     SemanticAnalyzer analyzer(semaErrorHandler);
@@ -82,44 +169,126 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
-    std::cout << "Printing AST..." << std::endl;
-    std::cout << std::endl;
-
-    AstPrinter printer;
-    printer.print(statements);
+    // the output is written through one large buffer; `write` is given what
+    // to put into it
+    auto write_text = [&output_path](const auto& write)
+    {
+        support::OutputFile file(output_path);
+        if (file.is_open())
+            write(file);
+        if (!file.close())
+        {
+            std::cerr << "Error: Could not write to " << output_path << std::endl;
+            return false;
+        }
+        return true;
+    };
 
-    std::cout << std::endl;
-    std::cout << "Generating Intermediate Representation (3AC - Three-Address Code)..."
-              << std::endl;
-    std::cout << std::endl;
+    if (emit == "ast")
+    {
+        bool written = write_text(
+            [&](support::OutputFile& file)
+            {
+                support::OutputFileBuffer buffer(file);
+                std::ostream out(&buffer);
+                AstPrinter printer(out);
+                printer.print(statements);
+            });
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     ir::IRGenerator ir_gen;
     ir::Program ir_program = ir_gen.generate(statements);
 
-    std::cout << "Instructions:" << std::endl;
-    ir_program.print();
+    support::ThreadPool pool(threads);
+    opt::Optimizer optimizer(opt_level, pool);
+    optimizer.run(ir_program);
+
+    if (emit == "ir")
+    {
+        bool written = write_text(
+            [&](support::OutputFile& file)
+            {
+                support::OutputFileBuffer buffer(file);
+                std::ostream out(&buffer);
+                ir_program.print(out);
+            });
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // writes the lines of a backend to `file` as they come
+    auto lines_to = [](support::OutputFile& file)
+    {
+        return [&file](const std::vector<std::string>& lines)
+        {
+            for (const std::string& line : lines)
+            {
+                file.write_line(line);
+            }
+        };
+    };
 
-    std::cout << std::endl;
-    std::cout << "Generating Target Code (Assembly)..." << std::endl;
-    std::cout << std::endl;
+    if (target == "c")
+    {
+        codegen::CGenerator c_gen;
+        bool written = write_text([&](support::OutputFile& file)
+                                  { c_gen.generate(ir_program, lines_to(file)); });
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    codegen::CodeGenerator code_gen;
-    std::string assembly = code_gen.generate(ir_program);
+    codegen::CodeGenerator code_gen(opt_level, pool);
+    auto print_statistics = [&]()
+    {
+        if (!peephole_stats)
+            return;
+        std::cerr << "Peephole rules fired:" << std::endl;
+        for (const auto& [rule, count] : code_gen.get_peephole().statistics())
+        {
+            std::cerr << "  " << rule << ": " << count << std::endl;
+        }
+    };
 
-    std::cout << "Target Assembly:" << std::endl;
-    std::cout << assembly << std::endl;
+    if (emit == "asm")
+    {
+        bool written = write_text([&](support::OutputFile& file)
+                                  { code_gen.generate(ir_program, lines_to(file)); });
+        print_statistics();
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    std::ofstream outFile("output.asm");
-    if (outFile.is_open())
+    // the assembly goes straight into the encoder, as it is generated
+    codegen::ObjectCode object;
+    try
+    {
+        codegen::Encoder encoder;
+        object = encoder.encode([&](const codegen::LineSink& sink)
+                                { code_gen.generate(ir_program, sink); });
+    } catch (const std::exception& e)
     {
-        outFile << assembly;
-        outFile.close();
-        std::cout << "Assembly saved to output.asm" << std::endl;
+        std::cerr << "Error: Could not assemble the program: " << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
-    else
+    print_statistics();
+
+    if (run)
     {
-        std::cerr << "Error: Could not write to output.asm" << std::endl;
+        try
+        {
+            codegen::Jit jit;
+            return jit.run(object);
+        } catch (const std::exception& e)
+        {
+            std::cerr << "Error: Could not run the program: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
     }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    bool written = write_text(
+        [&](support::OutputFile& file)
+        {
+            support::OutputFileBuffer buffer(file);
+            std::ostream out(&buffer);
+            codegen::write_elf_object(object, out);
+        });
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
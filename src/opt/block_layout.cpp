@@ -0,0 +1,380 @@
+#include "block_layout.hpp"
+
+#include "loop_info.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace opt {
+
+namespace {
+
+// upper bound on the jumps followed when threading a single branch
+constexpr int max_thread_length = 8;
+
+// the comparison on which a conditional branch jumps
+struct Condition {
+    ir::OpCode cmp;
+    ir::Operand lhs;
+    ir::Operand rhs;
+};
+
+struct Block {
+    std::vector<ir::Instruction> code;
+    int loop; // innermost loop containing the block, -1 outside loops
+};
+
+bool is_conditional(const ir::Instruction& inst)
+{
+    return inst.is_jump() && inst.op != ir::OpCode::JUMP;
+}
+
+bool can_fall_through(const ir::Instruction& inst)
+{
+    return inst.op != ir::OpCode::JUMP && inst.op != ir::OpCode::RETURN &&
+           inst.op != ir::OpCode::HALT && inst.op != ir::OpCode::TAIL_CALL;
+}
+
+bool ends_block(const ir::Instruction& inst)
+{
+    return inst.is_jump() || !can_fall_through(inst);
+}
+
+Condition condition_of(const ir::Instruction& branch)
+{
+    if (branch.op == ir::OpCode::JUMP_IF_FALSE)
+        return {ir::OpCode::EQ, *branch.arg1, ir::Operand::integer(0)};
+    if (branch.op == ir::OpCode::JUMP_IF_TRUE)
+        return {ir::OpCode::NE, *branch.arg1, ir::Operand::integer(0)};
+    return {ir::compared_by(branch.op), *branch.arg1, *branch.arg2};
+}
+
+void set_target(ir::Instruction& jump, const ir::Operand& label)
+{
+    if (jump.op == ir::OpCode::JUMP)
+        jump.arg1 = label;
+    else if (jump.op == ir::OpCode::JUMP_IF_FALSE ||
+             jump.op == ir::OpCode::JUMP_IF_TRUE)
+        jump.arg2 = label;
+    else
+        jump.result = label;
+}
+
+// turns `branch` into the branch taken exactly when it is not
+void invert(ir::Instruction& branch)
+{
+    if (branch.op == ir::OpCode::JUMP_IF_FALSE)
+        branch.op = ir::OpCode::JUMP_IF_TRUE;
+    else if (branch.op == ir::OpCode::JUMP_IF_TRUE)
+        branch.op = ir::OpCode::JUMP_IF_FALSE;
+    else
+        branch.op = ir::branch_on(ir::negate(ir::compared_by(branch.op)));
+}
+
+bool has_label(const Block& block, const std::string& name)
+{
+    for (const ir::Instruction& inst : block.code)
+    {
+        if (inst.op != ir::OpCode::LABEL)
+            break;
+        if (inst.arg1->name == name)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+bool BlockLayout::run(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    bool changed = false;
+    for (ir::Function& function : functions)
+    {
+        changed |= thread_jumps(function.body);
+        changed |= place_blocks(program, function.body);
+    }
+
+    if (changed)
+        ir::join_functions(program, std::move(functions));
+    return changed;
+}
+
+bool BlockLayout::thread_jumps(std::vector<ir::Instruction>& code)
+{
+    // where control lands on reaching a label: the first instruction after
+    // its run of labels
+    std::unordered_map<std::string, size_t> landing;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].op != ir::OpCode::LABEL)
+            continue;
+        size_t j = i;
+        while (j < code.size() && code[j].op == ir::OpCode::LABEL)
+        {
+            ++j;
+        }
+        landing[code[i].arg1->name] = j;
+    }
+
+    auto landing_at = [&](const std::string& label) -> const ir::Instruction*
+    {
+        auto it = landing.find(label);
+        return it == landing.end() || it->second == code.size() ? nullptr
+                                                                : &code[it->second];
+    };
+
+    bool changed = false;
+    for (ir::Instruction& inst : code)
+    {
+        if (!inst.is_jump())
+            continue;
+
+        ir::Operand target = *inst.jump_target();
+        for (int step = 0; step < max_thread_length; ++step)
+        {
+            const ir::Instruction* next = landing_at(target.name);
+            if (!next)
+                break;
+            if (next->op == ir::OpCode::JUMP)
+            {
+                target = *next->arg1;
+                continue;
+            }
+
+            // a block that only re-tests the condition we branched on
+            if (!is_conditional(inst) || !is_conditional(*next) || next == &inst)
+                break;
+            Condition ours = condition_of(inst);
+            Condition theirs = condition_of(*next);
+            if (!(ours.lhs == theirs.lhs) || !(ours.rhs == theirs.rhs))
+                break;
+
+            if (theirs.cmp == ours.cmp)
+            {
+                target = *next->jump_target();
+                continue;
+            }
+
+            size_t after = landing[target.name] + 1;
+            if (theirs.cmp == ir::negate(ours.cmp) && after < code.size() &&
+                code[after].op == ir::OpCode::LABEL)
+            {
+                target = *code[after].arg1;
+                continue;
+            }
+            break;
+        }
+
+        if (!(target == *inst.jump_target()))
+        {
+            set_target(inst, target);
+            changed = true;
+        }
+
+        // a jump to a return may as well return
+        const ir::Instruction* next = landing_at(target.name);
+        if (inst.op == ir::OpCode::JUMP && next &&
+            (next->op == ir::OpCode::RETURN || next->op == ir::OpCode::HALT))
+        {
+            inst = *next;
+            changed = true;
+        }
+    }
+
+    auto labels_at = [&code](size_t index, const std::string& name)
+    {
+        for (; index < code.size() && code[index].op == ir::OpCode::LABEL; ++index)
+        {
+            if (code[index].arg1->name == name)
+                return true;
+        }
+        return false;
+    };
+
+    std::vector<ir::Instruction> rewritten;
+    rewritten.reserve(code.size());
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        ir::Instruction& inst = code[i];
+        if (is_conditional(inst))
+        {
+            const std::string& target = inst.jump_target()->name;
+
+            // both ways lead to the next instruction
+            if (labels_at(i + 1, target))
+            {
+                changed = true;
+                continue;
+            }
+
+            // branching over a jump is branching the other way to its target
+            if (i + 1 < code.size() && code[i + 1].op == ir::OpCode::JUMP &&
+                labels_at(i + 2, target))
+            {
+                invert(inst);
+                set_target(inst, *code[i + 1].arg1);
+                rewritten.push_back(std::move(inst));
+                ++i;
+                changed = true;
+                continue;
+            }
+        }
+        rewritten.push_back(std::move(inst));
+    }
+
+    code = std::move(rewritten);
+    return changed;
+}
+
+bool BlockLayout::place_blocks(ir::Program& program, std::vector<ir::Instruction>& code)
+{
+    if (code.empty())
+        return false;
+
+    std::vector<Loop> loops = find_loops(code);
+    std::unordered_map<std::string, int> references;
+    std::vector<Block> blocks;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (const ir::Operand* target = code[i].jump_target())
+            references[target->name]++;
+
+        bool starts_block = i == 0 || ends_block(code[i - 1]) ||
+                            (code[i].op == ir::OpCode::LABEL &&
+                             code[i - 1].op != ir::OpCode::LABEL);
+        if (starts_block)
+        {
+            int loop = -1;
+            for (size_t l = 0; l < loops.size() && loop < 0; ++l)
+            {
+                if (loops[l].contains(i))
+                    loop = int(l);
+            }
+            blocks.push_back({{}, loop});
+        }
+        blocks.back().code.push_back(std::move(code[i]));
+    }
+
+    bool changed = false;
+
+    // A block that returns and that the preceding branch skips is predicted
+    // cold: the branch is inverted to reach it, and it moves to the end of the
+    // function. That needs the function not to fall off its last block.
+    std::vector<bool> cold(blocks.size(), false);
+    if (!can_fall_through(blocks.back().code.back()))
+    {
+        for (size_t b = 1; b + 1 < blocks.size(); ++b)
+        {
+            Block& block = blocks[b];
+            ir::Instruction& branch = blocks[b - 1].code.back();
+            if ((block.code.back().op != ir::OpCode::RETURN &&
+                 block.code.back().op != ir::OpCode::HALT) ||
+                !is_conditional(branch) ||
+                !has_label(blocks[b + 1], branch.jump_target()->name))
+                continue;
+
+            bool entered = false;
+            for (size_t i = 0;
+                 i < block.code.size() && block.code[i].op == ir::OpCode::LABEL;
+                 ++i)
+            {
+                entered |= references.count(block.code[i].arg1->name) > 0;
+            }
+            if (entered)
+                continue;
+
+            ir::Operand label = program.new_label("cold");
+            block.code.insert(block.code.begin(),
+                              {ir::OpCode::LABEL, std::nullopt, label, std::nullopt});
+            invert(branch);
+            set_target(branch, label);
+            cold[b] = true;
+            changed = true;
+        }
+
+        std::vector<Block> hot;
+        std::vector<Block> sunk;
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            (cold[b] ? sunk : hot).push_back(std::move(blocks[b]));
+        }
+        blocks = std::move(hot);
+        for (Block& block : sunk)
+        {
+            blocks.push_back(std::move(block));
+        }
+    }
+
+    // Pulls the blocks a `goto` leads to up behind it when nothing falls into
+    // them, so that the jump goes away. Each move removes a jump.
+    for (bool moved = true; moved;)
+    {
+        moved = false;
+
+        std::unordered_map<std::string, size_t> block_of;
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            for (size_t i = 0;
+                 i < blocks[b].code.size() && blocks[b].code[i].op == ir::OpCode::LABEL;
+                 ++i)
+            {
+                block_of[blocks[b].code[i].arg1->name] = b;
+            }
+        }
+
+        for (size_t b = 0; b < blocks.size() && !moved; ++b)
+        {
+            const ir::Instruction& jump = blocks[b].code.back();
+            if (jump.op != ir::OpCode::JUMP || blocks[b].code.size() < 2)
+                continue;
+
+            auto target = block_of.find(jump.arg1->name);
+            if (target == block_of.end())
+                continue;
+            size_t first = target->second;
+            if (first == 0 || can_fall_through(blocks[first - 1].code.back()))
+                continue;
+
+            // the run of blocks falling into each other from the target
+            size_t last = first;
+            while (last < blocks.size() && can_fall_through(blocks[last].code.back()))
+            {
+                ++last;
+            }
+            if (last == blocks.size() || (b >= first && b <= last))
+                continue;
+
+            bool same_loop = true;
+            for (size_t k = first; k <= last; ++k)
+            {
+                same_loop &= blocks[k].loop == blocks[b].loop;
+            }
+            if (!same_loop)
+                continue;
+
+            blocks[b].code.pop_back();
+            std::vector<Block> run(std::make_move_iterator(blocks.begin() + first),
+                                   std::make_move_iterator(blocks.begin() + last + 1));
+            blocks.erase(blocks.begin() + first, blocks.begin() + last + 1);
+            size_t position = b < first ? b + 1 : b - run.size() + 1;
+            blocks.insert(blocks.begin() + position,
+                          std::make_move_iterator(run.begin()),
+                          std::make_move_iterator(run.end()));
+            moved = true;
+            changed = true;
+        }
+    }
+
+    code.clear();
+    for (Block& block : blocks)
+    {
+        code.insert(code.end(),
+                    std::make_move_iterator(block.code.begin()),
+                    std::make_move_iterator(block.code.end()));
+    }
+    return changed;
+}
+
+} // namespace opt
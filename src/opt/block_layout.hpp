@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../ir/function.hpp"
+
+#include <vector>
+
+namespace opt {
+
+// Control-flow tidying and block placement, one function at a time.
+//
+// Jumps are threaded: a jump to a block that only jumps on goes straight to
+// the final target, a conditional branch to a block that re-tests the same
+// condition goes to wherever that test leads, and a jump to a return becomes
+// the return. A conditional branch over an unconditional jump is inverted.
+//
+// Blocks are then reordered so that more edges fall through: a block that
+// only returns and is branched around is predicted cold and moved to the end
+// of the function, and a block reached by a `goto` that nothing falls into is
+// moved up behind the jump. Blocks never move into or out of a loop, so loop
+// bodies stay contiguous.
+class BlockLayout {
+  public:
+    bool run(ir::Program& program);
+
+  private:
+    bool thread_jumps(std::vector<ir::Instruction>& code);
+    bool place_blocks(ir::Program& program, std::vector<ir::Instruction>& code);
+};
+
+} // namespace opt
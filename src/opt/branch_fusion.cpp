@@ -0,0 +1,134 @@
+#include "branch_fusion.hpp"
+
+#include <string>
+#include <unordered_map>
+
+namespace opt {
+
+namespace {
+
+std::unordered_map<std::string, int>
+count_temp_uses(const std::vector<ir::Instruction>& code)
+{
+    std::unordered_map<std::string, int> counts;
+    for (const ir::Instruction& inst : code)
+    {
+        for (const ir::Operand* use : inst.uses())
+        {
+            if (use->type == ir::OperandType::TEMPORARY)
+                counts[use->name]++;
+        }
+    }
+    return counts;
+}
+
+// true when `inst` computes `value` and nothing else reads it
+bool defines_single_use(const ir::Instruction& inst,
+                        const ir::Operand& value,
+                        const std::unordered_map<std::string, int>& uses)
+{
+    if (value.type != ir::OperandType::TEMPORARY || !inst.def() ||
+        !(*inst.def() == value))
+        return false;
+    auto it = uses.find(value.name);
+    return it != uses.end() && it->second == 1;
+}
+
+} // namespace
+
+bool BranchFusion::run(ir::Program& program)
+{
+    bool changed = false;
+    for (;;)
+    {
+        bool progress = fuse_negations(program);
+        progress |= fuse_branches(program);
+        if (!progress)
+            break;
+        changed = true;
+    }
+    return changed;
+}
+
+bool BranchFusion::fuse_negations(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+    auto uses = count_temp_uses(code);
+    std::vector<ir::Instruction> fused;
+    fused.reserve(code.size());
+    bool changed = false;
+
+    for (ir::Instruction& inst : code)
+    {
+        if (inst.op == ir::OpCode::NOT && !fused.empty() &&
+            defines_single_use(fused.back(), *inst.arg1, uses))
+        {
+            ir::Instruction prev = fused.back();
+
+            // t = a < b; u = !t  =>  u = a >= b
+            if (ir::is_comparison(prev.op))
+            {
+                fused.back() = {ir::negate(prev.op), inst.result, prev.arg1, prev.arg2};
+                changed = true;
+                continue;
+            }
+            // t = !x; u = !t  =>  u = x != 0
+            if (prev.op == ir::OpCode::NOT)
+            {
+                fused.back() = {
+                    ir::OpCode::NE, inst.result, prev.arg1, ir::Operand::integer(0)};
+                changed = true;
+                continue;
+            }
+        }
+        fused.push_back(std::move(inst));
+    }
+
+    code = std::move(fused);
+    return changed;
+}
+
+bool BranchFusion::fuse_branches(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+    auto uses = count_temp_uses(code);
+    std::vector<ir::Instruction> fused;
+    fused.reserve(code.size());
+    bool changed = false;
+
+    for (ir::Instruction& inst : code)
+    {
+        bool if_true = inst.op == ir::OpCode::JUMP_IF_TRUE;
+        if ((if_true || inst.op == ir::OpCode::JUMP_IF_FALSE) && !fused.empty() &&
+            defines_single_use(fused.back(), *inst.arg1, uses))
+        {
+            ir::Instruction prev = fused.back();
+            ir::Operand target = *inst.arg2;
+
+            // t = a < b; ifFalse t goto L  =>  if a >= b goto L
+            if (ir::is_comparison(prev.op))
+            {
+                ir::OpCode comparison = if_true ? prev.op : ir::negate(prev.op);
+                fused.back() = {
+                    ir::branch_on(comparison), target, prev.arg1, prev.arg2};
+                changed = true;
+                continue;
+            }
+            // t = !x; ifFalse t goto L  =>  ifTrue x goto L
+            if (prev.op == ir::OpCode::NOT)
+            {
+                ir::OpCode flipped =
+                    if_true ? ir::OpCode::JUMP_IF_FALSE : ir::OpCode::JUMP_IF_TRUE;
+                fused.back() = {flipped, std::nullopt, prev.arg1, target};
+                changed = true;
+                continue;
+            }
+        }
+        fused.push_back(std::move(inst));
+    }
+
+    code = std::move(fused);
+    return changed;
+}
+
+} // namespace opt
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+namespace opt {
+
+// Folds comparisons into the branches that test them: `t = a < b` followed by
+// `ifFalse t goto L` becomes `if a >= b goto L`, which the backend lowers to a
+// single cmp and jcc instead of materializing a boolean. Logical negation of a
+// comparison or of a branch condition flips the condition instead.
+class BranchFusion {
+  public:
+    bool run(ir::Program& program);
+
+  private:
+    bool fuse_negations(ir::Program& program);
+    bool fuse_branches(ir::Program& program);
+};
+
+} // namespace opt
@@ -0,0 +1,163 @@
+#include "call_graph.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace opt {
+
+CallGraph::CallGraph(const std::vector<ir::Function>& functions)
+{
+    for (size_t f = 0; f < functions.size(); ++f)
+    {
+        const ir::Function& function = functions[f];
+        names.push_back(function.name);
+        auto& targets = edges[function.name];
+
+        for (size_t i = 0; i < function.body.size(); ++i)
+        {
+            const ir::Instruction& inst = function.body[i];
+            if (!inst.is_call())
+                continue;
+
+            // the first call from this caller adds the edge
+            std::vector<CallSite>& callee_sites = sites[inst.arg1->name];
+            if (callee_sites.empty() || callee_sites.back().caller != f)
+                targets.push_back(inst.arg1->name);
+            callee_sites.push_back({f, i});
+        }
+    }
+
+    find_recursion();
+}
+
+const std::vector<std::string>& CallGraph::callees(const std::string& caller) const
+{
+    static const std::vector<std::string> none;
+    auto it = edges.find(caller);
+    return it == edges.end() ? none : it->second;
+}
+
+int CallGraph::call_sites(const std::string& callee) const
+{
+    return int(calls_to(callee).size());
+}
+
+const std::vector<CallGraph::CallSite>&
+CallGraph::calls_to(const std::string& callee) const
+{
+    static const std::vector<CallSite> none;
+    auto it = sites.find(callee);
+    return it == sites.end() ? none : it->second;
+}
+
+bool CallGraph::is_recursive(const std::string& name) const
+{
+    return recursive.count(name) > 0;
+}
+
+bool CallGraph::is_mutually_recursive(const std::string& name) const
+{
+    return mutually_recursive.count(name) > 0;
+}
+
+std::unordered_set<std::string> CallGraph::reachable_from_main() const
+{
+    std::unordered_set<std::string> seen{"main"};
+    std::vector<std::string> worklist{"main"};
+    while (!worklist.empty())
+    {
+        std::string current = worklist.back();
+        worklist.pop_back();
+        for (const std::string& callee : callees(current))
+        {
+            if (seen.insert(callee).second)
+                worklist.push_back(callee);
+        }
+    }
+    return seen;
+}
+
+std::vector<std::string> CallGraph::bottom_up_order() const
+{
+    std::vector<std::string> order;
+    std::unordered_set<std::string> visited;
+
+    std::function<void(const std::string&)> visit = [&](const std::string& name)
+    {
+        if (!visited.insert(name).second)
+            return;
+        for (const std::string& callee : callees(name))
+        {
+            if (edges.count(callee))
+                visit(callee);
+        }
+        order.push_back(name);
+    };
+
+    for (const std::string& name : names)
+    {
+        visit(name);
+    }
+    return order;
+}
+
+// Tarjan's strongly connected components; a function is recursive when its
+// component has more than one member or it calls itself directly.
+void CallGraph::find_recursion()
+{
+    std::unordered_map<std::string, int> index;
+    std::unordered_map<std::string, int> lowlink;
+    std::unordered_set<std::string> on_stack;
+    std::vector<std::string> stack;
+    int next_index = 0;
+
+    std::function<void(const std::string&)> connect = [&](const std::string& name)
+    {
+        index[name] = lowlink[name] = next_index++;
+        stack.push_back(name);
+        on_stack.insert(name);
+
+        for (const std::string& callee : callees(name))
+        {
+            if (!edges.count(callee))
+                continue;
+            if (!index.count(callee))
+            {
+                connect(callee);
+                lowlink[name] = std::min(lowlink[name], lowlink[callee]);
+            }
+            else if (on_stack.count(callee))
+            {
+                lowlink[name] = std::min(lowlink[name], index[callee]);
+            }
+        }
+
+        if (lowlink[name] != index[name])
+            return;
+
+        std::vector<std::string> component;
+        std::string member;
+        do
+        {
+            member = stack.back();
+            stack.pop_back();
+            on_stack.erase(member);
+            component.push_back(member);
+        } while (member != name);
+
+        const auto& own = callees(name);
+        bool self_call = std::find(own.begin(), own.end(), name) != own.end();
+        if (component.size() > 1 || self_call)
+            recursive.insert(component.begin(), component.end());
+        if (component.size() > 1)
+            mutually_recursive.insert(component.begin(), component.end());
+    };
+
+    for (const std::string& name : names)
+    {
+        if (!index.count(name))
+            connect(name);
+    }
+}
+
+} // namespace opt
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../ir/function.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace opt {
+
+// Static call graph built from the CALL instructions of each function.
+class CallGraph {
+  public:
+    struct CallSite {
+        size_t caller; // index into the functions the graph was built from
+        size_t call;   // index of the call in the caller's body
+    };
+
+    explicit CallGraph(const std::vector<ir::Function>& functions);
+
+    // distinct functions called from `caller`
+    const std::vector<std::string>& callees(const std::string& caller) const;
+
+    // number of CALL instructions targeting `callee` across the program
+    int call_sites(const std::string& callee) const;
+
+    // those calls, in program order
+    const std::vector<CallSite>& calls_to(const std::string& callee) const;
+
+    // true when `name` can reach itself through calls
+    bool is_recursive(const std::string& name) const;
+
+    // true when `name` is on a call cycle through some other function
+    bool is_mutually_recursive(const std::string& name) const;
+
+    // functions reachable from main, main included
+    std::unordered_set<std::string> reachable_from_main() const;
+
+    // callees before their callers; members of a cycle appear in any order
+    std::vector<std::string> bottom_up_order() const;
+
+  private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, std::vector<std::string>> edges;
+    std::unordered_map<std::string, std::vector<CallSite>> sites;
+    std::unordered_set<std::string> recursive;
+    std::unordered_set<std::string> mutually_recursive;
+
+    void find_recursion();
+};
+
+} // namespace opt
@@ -0,0 +1,431 @@
+#include "cleanup.hpp"
+
+#include "../ir/function.hpp"
+
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace opt {
+
+namespace {
+
+// upper bound on cleanup rounds; each round is linear in the program size
+constexpr int max_rounds = 16;
+
+bool is_value(const ir::Operand& op)
+{
+    return op.type == ir::OperandType::VARIABLE ||
+           op.type == ir::OperandType::TEMPORARY;
+}
+
+bool is_unary(ir::OpCode op) { return op == ir::OpCode::NEG || op == ir::OpCode::NOT; }
+
+ir::Instruction assign(const ir::Operand& result, ir::Operand value)
+{
+    return {ir::OpCode::ASSIGN, result, std::move(value), std::nullopt};
+}
+
+} // namespace
+
+std::optional<int64_t> evaluate(ir::OpCode op, int64_t lhs, int64_t rhs)
+{
+    uint64_t a = uint64_t(lhs);
+    uint64_t b = uint64_t(rhs);
+
+    switch (op)
+    {
+    case ir::OpCode::ADD:
+        return int64_t(a + b);
+    case ir::OpCode::SUB:
+        return int64_t(a - b);
+    case ir::OpCode::MUL:
+        return int64_t(a * b);
+    case ir::OpCode::DIV:
+        if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1))
+            return std::nullopt;
+        return lhs / rhs;
+    case ir::OpCode::UDIV:
+        if (rhs == 0)
+            return std::nullopt;
+        return int64_t(a / b);
+    case ir::OpCode::MULHI:
+        return int64_t((__int128(lhs) * __int128(rhs)) >> 64);
+    case ir::OpCode::SHL:
+        return int64_t(a << (b & 63));
+    case ir::OpCode::SAR:
+        return lhs >> (b & 63);
+    case ir::OpCode::SHR:
+        return int64_t(a >> (b & 63));
+    case ir::OpCode::NEG:
+        return int64_t(uint64_t(0) - a);
+    case ir::OpCode::NOT:
+        return lhs == 0 ? 1 : 0;
+    case ir::OpCode::LT:
+        return lhs < rhs;
+    case ir::OpCode::GT:
+        return lhs > rhs;
+    case ir::OpCode::LE:
+        return lhs <= rhs;
+    case ir::OpCode::GE:
+        return lhs >= rhs;
+    case ir::OpCode::EQ:
+        return lhs == rhs;
+    case ir::OpCode::NE:
+        return lhs != rhs;
+    default:
+        return std::nullopt;
+    }
+}
+
+bool is_pure(const ir::Instruction& inst)
+{
+    switch (inst.op)
+    {
+    case ir::OpCode::ADD:
+    case ir::OpCode::SUB:
+    case ir::OpCode::MUL:
+    case ir::OpCode::MULHI:
+    case ir::OpCode::SHL:
+    case ir::OpCode::SAR:
+    case ir::OpCode::SHR:
+    case ir::OpCode::NEG:
+    case ir::OpCode::NOT:
+    case ir::OpCode::ASSIGN:
+    case ir::OpCode::LT:
+    case ir::OpCode::GT:
+    case ir::OpCode::LE:
+    case ir::OpCode::GE:
+    case ir::OpCode::EQ:
+    case ir::OpCode::NE:
+    case ir::OpCode::UDIV: // only ever created with a divisor known to be positive
+    case ir::OpCode::SELECT:
+        return true;
+    case ir::OpCode::DIV: {
+        // a division that may fault has to stay
+        auto divisor = inst.arg2->as_integer();
+        return divisor && *divisor != 0 && *divisor != -1;
+    }
+    default:
+        return false;
+    }
+}
+
+bool Cleanup::run(ir::Program& program)
+{
+    bool changed = false;
+    for (int round = 0; round < max_rounds; ++round)
+    {
+        bool progress = fold_constants(program);
+        progress |= propagate_copies(program);
+        progress |= remove_dead_code(program);
+        progress |= remove_unreachable_code(program);
+        if (!progress)
+            break;
+        changed = true;
+    }
+    return changed;
+}
+
+bool Cleanup::fold_constants(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+    std::vector<ir::Instruction> folded;
+    folded.reserve(code.size());
+    bool changed = false;
+
+    for (ir::Instruction& inst : code)
+    {
+        if (inst.op == ir::OpCode::JUMP_IF_FALSE || inst.op == ir::OpCode::JUMP_IF_TRUE)
+        {
+            if (auto condition = inst.arg1->as_integer())
+            {
+                bool taken = (*condition != 0) == (inst.op == ir::OpCode::JUMP_IF_TRUE);
+                if (taken)
+                    folded.push_back(
+                        {ir::OpCode::JUMP, std::nullopt, inst.arg2, std::nullopt});
+                changed = true;
+                continue;
+            }
+        }
+        else if (ir::is_compare_branch(inst.op))
+        {
+            auto lhs = inst.arg1->as_integer();
+            auto rhs = inst.arg2->as_integer();
+            if (lhs && rhs)
+            {
+                if (*evaluate(ir::compared_by(inst.op), *lhs, *rhs))
+                    folded.push_back(
+                        {ir::OpCode::JUMP, std::nullopt, inst.result, std::nullopt});
+                changed = true;
+                continue;
+            }
+        }
+        else if (inst.op == ir::OpCode::SELECT)
+        {
+            auto condition = inst.arg1->as_integer();
+            if (condition || *inst.arg2 == *inst.arg3)
+            {
+                folded.push_back(
+                    assign(*inst.result, condition == 0 ? *inst.arg3 : *inst.arg2));
+                changed = true;
+                continue;
+            }
+        }
+        else if (inst.result && inst.arg1 && is_pure(inst) &&
+                 inst.op != ir::OpCode::ASSIGN)
+        {
+            auto lhs = inst.arg1->as_integer();
+            auto rhs = inst.arg2 ? inst.arg2->as_integer() : std::optional<int64_t>();
+
+            if (lhs && (rhs || is_unary(inst.op)))
+            {
+                if (auto value = evaluate(inst.op, *lhs, rhs.value_or(0)))
+                {
+                    folded.push_back(
+                        assign(*inst.result, ir::Operand::integer(*value)));
+                    changed = true;
+                    continue;
+                }
+            }
+
+            // identities that leave the other operand unchanged
+            bool identity = false;
+            switch (inst.op)
+            {
+            case ir::OpCode::ADD:
+                if (lhs == 0)
+                {
+                    std::swap(inst.arg1, inst.arg2);
+                    identity = true;
+                }
+                else
+                {
+                    identity = rhs == 0;
+                }
+                break;
+            case ir::OpCode::SUB:
+            case ir::OpCode::SHL:
+            case ir::OpCode::SAR:
+            case ir::OpCode::SHR:
+                identity = rhs == 0;
+                break;
+            case ir::OpCode::MUL:
+            case ir::OpCode::DIV:
+            case ir::OpCode::UDIV:
+                identity = rhs == 1;
+                break;
+            default:
+                break;
+            }
+
+            if (identity)
+            {
+                folded.push_back(assign(*inst.result, *inst.arg1));
+                changed = true;
+                continue;
+            }
+        }
+
+        folded.push_back(std::move(inst));
+    }
+
+    code = std::move(folded);
+    return changed;
+}
+
+bool Cleanup::propagate_copies(ir::Program& program)
+{
+    struct Copy {
+        ir::Operand target;
+        ir::Operand source;
+    };
+
+    // copies[x] holds `x = y` while that is the latest write to x and y is unchanged
+    std::unordered_map<std::string, Copy> copies;
+    bool changed = false;
+
+    auto kill = [&copies](const std::string& name)
+    {
+        for (auto it = copies.begin(); it != copies.end();)
+        {
+            const ir::Operand& source = it->second.source;
+            if (it->first == name || (is_value(source) && source.name == name))
+                it = copies.erase(it);
+            else
+                ++it;
+        }
+    };
+
+    for (ir::Instruction& inst : program.get_instructions())
+    {
+        if (inst.op == ir::OpCode::LABEL)
+        {
+            copies.clear();
+            continue;
+        }
+
+        for (ir::Operand* use : inst.uses())
+        {
+            if (!is_value(*use))
+                continue;
+
+            auto it = copies.find(use->name);
+            if (it != copies.end())
+            {
+                *use = it->second.source;
+                changed = true;
+            }
+        }
+
+        if (inst.is_call())
+        {
+            // the callee may write any variable it can name
+            for (auto it = copies.begin(); it != copies.end();)
+            {
+                if (it->second.target.type == ir::OperandType::VARIABLE ||
+                    it->second.source.type == ir::OperandType::VARIABLE)
+                    it = copies.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        if (const ir::Operand* def = inst.def())
+        {
+            kill(def->name);
+            if (inst.op == ir::OpCode::ASSIGN && !(*inst.arg1 == *def) &&
+                (is_value(*inst.arg1) || inst.arg1->is_integer()))
+            {
+                copies.emplace(def->name, Copy{*def, *inst.arg1});
+            }
+        }
+
+        if (inst.op == ir::OpCode::JUMP || inst.op == ir::OpCode::RETURN ||
+            inst.op == ir::OpCode::HALT)
+        {
+            copies.clear();
+        }
+    }
+
+    return changed;
+}
+
+bool Cleanup::remove_dead_code(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+
+    std::unordered_map<std::string, int> use_counts;
+    for (const ir::Instruction& inst : code)
+    {
+        for (const ir::Operand* use : inst.uses())
+        {
+            if (is_value(*use))
+                use_counts[use->name]++;
+        }
+    }
+
+    auto is_dead = [&](const ir::Operand& def)
+    {
+        if (def.type == ir::OperandType::VARIABLE && program.is_global(def.name))
+            return false;
+        return use_counts.find(def.name) == use_counts.end();
+    };
+
+    std::vector<ir::Instruction> live;
+    live.reserve(code.size());
+    bool changed = false;
+
+    for (ir::Instruction& inst : code)
+    {
+        if (inst.op == ir::OpCode::CALL && inst.result && is_dead(*inst.result))
+        {
+            inst.result.reset();
+            changed = true;
+        }
+        else if (inst.result && is_pure(inst) && is_dead(*inst.result))
+        {
+            changed = true;
+            continue;
+        }
+        else if (inst.op == ir::OpCode::ASSIGN && *inst.arg1 == *inst.result)
+        {
+            changed = true;
+            continue;
+        }
+
+        live.push_back(std::move(inst));
+    }
+
+    code = std::move(live);
+    return changed;
+}
+
+bool Cleanup::remove_unreachable_code(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+
+    std::unordered_set<std::string> targets;
+    for (const ir::Instruction& inst : code)
+    {
+        if (const ir::Operand* target = inst.jump_target())
+            targets.insert(target->name);
+    }
+
+    std::vector<ir::Instruction> reachable;
+    reachable.reserve(code.size());
+    bool changed = false;
+    bool dead = false;
+
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        ir::Instruction& inst = code[i];
+
+        if (inst.op == ir::OpCode::LABEL)
+        {
+            if (!ir::is_function_entry(code, i) && !targets.count(inst.arg1->name))
+            {
+                changed = true;
+                continue;
+            }
+            dead = false;
+        }
+        else if (dead)
+        {
+            changed = true;
+            continue;
+        }
+
+        // a jump to a label that directly follows it (possibly among other
+        // labels) is a no-op
+        if (inst.op == ir::OpCode::JUMP)
+        {
+            bool falls_into_target = false;
+            for (size_t j = i + 1; j < code.size() && code[j].op == ir::OpCode::LABEL;
+                 ++j)
+            {
+                if (code[j].arg1->name == inst.arg1->name)
+                    falls_into_target = true;
+            }
+            if (falls_into_target)
+            {
+                changed = true;
+                continue;
+            }
+        }
+
+        if (inst.op == ir::OpCode::JUMP || inst.op == ir::OpCode::RETURN ||
+            inst.op == ir::OpCode::TAIL_CALL || inst.op == ir::OpCode::HALT)
+        {
+            dead = true;
+        }
+
+        reachable.push_back(std::move(inst));
+    }
+
+    code = std::move(reachable);
+    return changed;
+}
+
+} // namespace opt
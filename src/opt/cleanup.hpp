@@ -0,0 +1,34 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+#include <cstdint>
+#include <optional>
+
+namespace opt {
+
+// Value of `op` applied to constant operands (`rhs` is ignored by unary
+// operations), or nullopt when the operation is not foldable, such as a
+// division that would fault at runtime.
+std::optional<int64_t> evaluate(ir::OpCode op, int64_t lhs, int64_t rhs = 0);
+
+// true when `inst` only computes its result, so that it can be removed when
+// the result is unused
+bool is_pure(const ir::Instruction& inst);
+
+// Scalar cleanups that other passes rely on to tidy up after themselves:
+// constant folding, block-local copy and constant propagation, dead code
+// removal and removal of unreachable code, redundant jumps and unused labels.
+// run() repeats them until nothing changes.
+class Cleanup {
+  public:
+    bool run(ir::Program& program);
+
+  private:
+    bool fold_constants(ir::Program& program);
+    bool propagate_copies(ir::Program& program);
+    bool remove_dead_code(ir::Program& program);
+    bool remove_unreachable_code(ir::Program& program);
+};
+
+} // namespace opt
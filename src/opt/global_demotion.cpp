@@ -0,0 +1,115 @@
+#include "global_demotion.hpp"
+
+#include "../ir/function.hpp"
+#include "call_graph.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+
+namespace opt {
+
+namespace {
+
+bool is_variable(const ir::Operand* op, const std::string& name)
+{
+    return op && op->type == ir::OperandType::VARIABLE && op->name == name;
+}
+
+// true when the straight-line code at the start of `body` writes `name`
+// before anything reads it, for a global no other function refers to
+bool set_before_read(const std::vector<ir::Instruction>& body, const std::string& name)
+{
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+        const ir::Instruction& inst = body[i];
+        // a label other than the entry may be reached from further down
+        if (inst.op == ir::OpCode::LABEL && !ir::is_function_entry(body, i))
+            return false;
+
+        const auto uses = inst.uses();
+        if (std::any_of(uses.begin(), uses.end(),
+                        [&](const ir::Operand* use) { return is_variable(use, name); }))
+            return false;
+        if (is_variable(inst.def(), name))
+            return true;
+
+        // calls do not count: no other function refers to the global
+        if (inst.is_jump() || inst.op == ir::OpCode::TAIL_CALL ||
+            inst.op == ir::OpCode::RETURN || inst.op == ir::OpCode::HALT)
+            return false;
+    }
+    return false;
+}
+
+} // namespace
+
+bool GlobalDemotion::run(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+
+    // the functions referring to each global, by index; ordered so that the
+    // result does not depend on hashing
+    std::map<std::string, std::set<size_t>> referrers;
+    for (const std::string& name : program.get_globals())
+    {
+        referrers[name];
+    }
+    for (size_t f = 0; f < functions.size(); ++f)
+    {
+        for (const ir::Instruction& inst : functions[f].body)
+        {
+            std::vector<const ir::Operand*> operands = inst.uses();
+            operands.push_back(inst.def());
+            for (const ir::Operand* op : operands)
+            {
+                if (op && op->type == ir::OperandType::VARIABLE &&
+                    program.is_global(op->name))
+                    referrers[op->name].insert(f);
+            }
+        }
+    }
+
+    CallGraph graph(functions);
+    bool changed = false;
+    bool main_changed = false;
+    for (const auto& [name, users] : referrers)
+    {
+        if (users.size() > 1)
+            continue;
+
+        if (!users.empty())
+        {
+            ir::Function& function = functions[*users.begin()];
+            bool initialized = set_before_read(function.body, name);
+            if (function.is_main())
+            {
+                // globals start out as zero; a local has to be set to it
+                if (!initialized)
+                {
+                    function.body.insert(function.body.begin(),
+                                         ir::Instruction{ir::OpCode::ASSIGN,
+                                                         ir::Operand::variable(name),
+                                                         ir::Operand::integer(0),
+                                                         std::nullopt});
+                    main_changed = true;
+                }
+            }
+            else if (!initialized || graph.is_recursive(function.name))
+            {
+                continue;
+            }
+        }
+
+        // locals never share a name with a global, so the name can stay
+        program.remove_global(name);
+        changed = true;
+    }
+
+    if (main_changed)
+        ir::join_functions(program, std::move(functions));
+    return changed;
+}
+
+} // namespace opt
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+namespace opt {
+
+// Turns globals that a single function refers to into locals of it, where
+// they can live in registers and the scalar passes can see through them:
+//  - a global only the top-level code uses becomes a local of main, set to
+//    zero first unless main sets it before reading it,
+//  - a global only one other function uses becomes a local of it when that
+//    function is not recursive and sets the global before reading it, so no
+//    value is carried over from one call to the next,
+//  - a global that no code refers to any more is dropped.
+class GlobalDemotion {
+  public:
+    bool run(ir::Program& program);
+};
+
+} // namespace opt
@@ -0,0 +1,263 @@
+#include "if_conversion.hpp"
+
+#include "cleanup.hpp"
+
+#include <string>
+#include <utility>
+
+namespace opt {
+
+namespace {
+
+// upper bound on rounds; each round converts the innermost remaining branches
+constexpr int max_rounds = 4;
+
+struct Arm {
+    // with every assignment going to a fresh temporary
+    std::vector<ir::Instruction> code;
+    // the last temporary assigned per name
+    std::unordered_map<std::string, ir::Operand> values;
+    // reads of each name in the arm
+    std::unordered_map<std::string, int> uses;
+};
+
+bool is_value(const ir::Operand& op)
+{
+    return op.type == ir::OperandType::VARIABLE ||
+           op.type == ir::OperandType::TEMPORARY;
+}
+
+// true when `inst` may run even though its arm would not have
+bool can_speculate(const ir::Instruction& inst)
+{
+    if (!inst.result || !is_value(*inst.result))
+        return false;
+    // the divisor may only be known to be positive inside the arm
+    if (inst.op == ir::OpCode::UDIV)
+        return inst.arg2->is_integer();
+    return is_pure(inst);
+}
+
+// end of the straight-line run of instructions starting at `first`
+size_t arm_end(const std::vector<ir::Instruction>& code, size_t first)
+{
+    size_t end = first;
+    while (end < code.size() && code[end].op != ir::OpCode::LABEL &&
+           !code[end].is_jump())
+    {
+        ++end;
+    }
+    return end;
+}
+
+// Copies code[first, last) with every assignment redirected to a fresh
+// temporary, collecting the names it assigns in `assigned`. Returns nullopt
+// when some instruction cannot be speculated.
+std::optional<Arm> speculate(ir::Program& program,
+                             const std::vector<ir::Instruction>& code,
+                             size_t first,
+                             size_t last,
+                             std::vector<ir::Operand>& assigned)
+{
+    Arm arm;
+    for (size_t i = first; i < last; ++i)
+    {
+        ir::Instruction inst = code[i];
+        if (!can_speculate(inst))
+            return std::nullopt;
+
+        for (ir::Operand* use : inst.uses())
+        {
+            if (!is_value(*use))
+                continue;
+            arm.uses[use->name]++;
+            auto value = arm.values.find(use->name);
+            if (value != arm.values.end())
+                *use = value->second;
+        }
+
+        const ir::Operand& target = *inst.result;
+        bool seen = false;
+        for (const ir::Operand& name : assigned)
+        {
+            seen |= name == target;
+        }
+        if (!seen)
+            assigned.push_back(target);
+
+        ir::Operand fresh = program.new_temp();
+        arm.values.insert_or_assign(target.name, fresh);
+        inst.result = fresh;
+        arm.code.push_back(std::move(inst));
+    }
+    return arm;
+}
+
+} // namespace
+
+bool IfConversion::run(ir::Program& program)
+{
+    bool changed = false;
+    for (int round = 0; round < max_rounds; ++round)
+    {
+        auto& code = program.get_instructions();
+
+        std::unordered_map<std::string, int> label_uses;
+        std::unordered_map<std::string, int> value_uses;
+        for (const ir::Instruction& inst : code)
+        {
+            if (const ir::Operand* target = inst.jump_target())
+                label_uses[target->name]++;
+            for (const ir::Operand* use : inst.uses())
+            {
+                if (is_value(*use))
+                    value_uses[use->name]++;
+            }
+        }
+
+        std::vector<ir::Instruction> rewritten;
+        rewritten.reserve(code.size());
+        bool progress = false;
+
+        for (size_t i = 0; i < code.size();)
+        {
+            if (auto next =
+                    convert(program, code, i, label_uses, value_uses, rewritten))
+            {
+                i = *next;
+                progress = true;
+            }
+            else
+            {
+                rewritten.push_back(code[i++]);
+            }
+        }
+
+        if (!progress)
+            break;
+        code = std::move(rewritten);
+        changed = true;
+    }
+    return changed;
+}
+
+std::optional<size_t> IfConversion::convert(
+    ir::Program& program,
+    const std::vector<ir::Instruction>& code,
+    size_t index,
+    const std::unordered_map<std::string, int>& label_uses,
+    const std::unordered_map<std::string, int>& value_uses,
+    std::vector<ir::Instruction>& out)
+{
+    const ir::Instruction& branch = code[index];
+    if (branch.op != ir::OpCode::JUMP_IF_FALSE &&
+        branch.op != ir::OpCode::JUMP_IF_TRUE && !ir::is_compare_branch(branch.op))
+        return std::nullopt;
+
+    // the labels of the shape must not be reachable from anywhere else
+    auto only_used_here = [&](const ir::Instruction& label, const ir::Operand& target)
+    {
+        return label.op == ir::OpCode::LABEL && label.arg1->name == target.name &&
+               label_uses.at(target.name) == 1;
+    };
+
+    const ir::Operand& skip = *branch.jump_target();
+    size_t then_begin = index + 1;
+    size_t then_end = arm_end(code, then_begin);
+    size_t else_begin = then_end;
+    size_t else_end = then_end;
+    size_t end;
+
+    if (then_end < code.size() && only_used_here(code[then_end], skip))
+    {
+        end = then_end + 1;
+    }
+    else if (then_end + 1 < code.size() && code[then_end].op == ir::OpCode::JUMP &&
+             only_used_here(code[then_end + 1], skip))
+    {
+        else_begin = then_end + 2;
+        else_end = arm_end(code, else_begin);
+        if (else_end == code.size() ||
+            !only_used_here(code[else_end], *code[then_end].arg1))
+            return std::nullopt;
+        end = else_end + 1;
+    }
+    else
+    {
+        return std::nullopt;
+    }
+
+    size_t arm_size = (then_end - then_begin) + (else_end - else_begin);
+    if (arm_size == 0 || arm_size > max_cost)
+        return std::nullopt;
+
+    std::vector<ir::Operand> assigned;
+    auto then_arm = speculate(program, code, then_begin, then_end, assigned);
+    auto else_arm = then_arm ? speculate(program, code, else_begin, else_end, assigned)
+                             : std::nullopt;
+    if (!else_arm)
+        return std::nullopt;
+
+    // a temporary only needs its value selected when it is read after the
+    // shape; variables always do
+    std::vector<ir::Operand> selected;
+    for (const ir::Operand& name : assigned)
+    {
+        auto uses = value_uses.find(name.name);
+        int outside = uses == value_uses.end() ? 0 : uses->second;
+        outside -= then_arm->uses[name.name] + else_arm->uses[name.name];
+        if (name.type == ir::OperandType::VARIABLE || outside > 0)
+            selected.push_back(name);
+    }
+
+    if (arm_size + selected.size() > max_cost)
+        return std::nullopt;
+
+    out.insert(out.end(), then_arm->code.begin(), then_arm->code.end());
+    out.insert(out.end(), else_arm->code.begin(), else_arm->code.end());
+
+    // the condition under which the then arm runs, or under which it does not
+    // when `inverted`
+    ir::Operand condition = *branch.arg1;
+    bool inverted = branch.op == ir::OpCode::JUMP_IF_TRUE;
+    if (ir::is_compare_branch(branch.op))
+    {
+        condition = program.new_temp();
+        out.push_back(
+            {ir::compared_by(branch.op), condition, branch.arg1, branch.arg2});
+        inverted = true;
+    }
+    else if (is_value(condition))
+    {
+        // the selects below may assign the condition itself
+        for (const ir::Operand& name : selected)
+        {
+            if (name == condition)
+            {
+                condition = program.new_temp();
+                out.push_back(
+                    {ir::OpCode::ASSIGN, condition, branch.arg1, std::nullopt});
+                break;
+            }
+        }
+    }
+
+    for (const ir::Operand& name : selected)
+    {
+        auto value_in = [&name](const Arm& arm)
+        {
+            auto value = arm.values.find(name.name);
+            return value == arm.values.end() ? name : value->second;
+        };
+
+        ir::Operand if_true = value_in(*then_arm);
+        ir::Operand if_false = value_in(*else_arm);
+        if (inverted)
+            std::swap(if_true, if_false);
+        out.push_back({ir::OpCode::SELECT, name, condition, if_true, if_false});
+    }
+
+    return end;
+}
+
+} // namespace opt
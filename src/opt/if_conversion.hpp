@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace opt {
+
+// Replaces short branches by SELECTs, which the backend lowers to cmov. Both
+// shapes the generator emits for `if` qualify:
+//
+//     triangle                    diamond
+//     ifFalse c goto L            ifFalse c goto L
+//     then                        then
+//   L:                            goto E
+//                               L:
+//                                 else
+//                               E:
+//
+// as long as neither arm can fault or has side effects. The arms are executed
+// unconditionally into fresh temporaries, and each value they assign is then
+// selected on the branch condition. Conversion only pays off for small arms:
+// at most `max_cost` instructions are executed in place of the branch.
+class IfConversion {
+  public:
+    explicit IfConversion(size_t max_cost) : max_cost(max_cost) {}
+
+    bool run(ir::Program& program);
+
+  private:
+    // Converts the branch at `index` if it starts one of the shapes above,
+    // appending the replacement to `out`. Returns the index just past the
+    // shape, or nullopt when it does not qualify.
+    std::optional<size_t>
+    convert(ir::Program& program,
+            const std::vector<ir::Instruction>& code,
+            size_t index,
+            const std::unordered_map<std::string, int>& label_uses,
+            const std::unordered_map<std::string, int>& value_uses,
+            std::vector<ir::Instruction>& out);
+
+    size_t max_cost;
+};
+
+} // namespace opt
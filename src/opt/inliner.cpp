@@ -0,0 +1,237 @@
+#include "inliner.hpp"
+
+#include <unordered_set>
+
+namespace opt {
+
+namespace {
+
+// a caller is not grown past this many instructions by inlining into it
+constexpr size_t max_caller_size = 4000;
+
+// cost of the call sequence itself: PARAM and PARAM_BIND per argument plus
+// CALL, PROLOGUE and RETURN
+int call_overhead(size_t args) { return int(2 * args + 3); }
+
+bool is_bookkeeping(const ir::Instruction& inst)
+{
+    return inst.op == ir::OpCode::LABEL || inst.op == ir::OpCode::PROLOGUE ||
+           inst.op == ir::OpCode::PARAM_BIND;
+}
+
+// instructions that remain once the body is inlined
+size_t body_size(const ir::Function& function)
+{
+    size_t size = 0;
+    for (const ir::Instruction& inst : function.body)
+    {
+        if (!is_bookkeeping(inst))
+            size++;
+    }
+    return size;
+}
+
+} // namespace
+
+bool Inliner::run(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    std::unordered_map<std::string, size_t> index;
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        index[functions[i].name] = i;
+    }
+
+    CallGraph graph(functions);
+    call_sites.clear();
+    for (const ir::Function& function : functions)
+    {
+        for (const ir::Instruction& inst : function.body)
+        {
+            if (inst.is_call())
+                call_sites[inst.arg1->name]++;
+        }
+    }
+
+    std::unordered_set<std::string> inlined;
+
+    // callees first, so that what gets copied is already inlined itself
+    for (const std::string& name : graph.bottom_up_order())
+    {
+        ir::Function& caller = functions[index[name]];
+        std::vector<ir::Instruction> body;
+        body.reserve(caller.body.size());
+
+        for (size_t position = 0; position < caller.body.size(); ++position)
+        {
+            ir::Instruction& inst = caller.body[position];
+            auto callee_it = inst.op == ir::OpCode::CALL ? index.find(inst.arg1->name)
+                                                         : index.end();
+            if (callee_it == index.end() || callee_it->first == name)
+            {
+                body.push_back(std::move(inst));
+                continue;
+            }
+
+            // the arguments are the PARAMs emitted right before the CALL
+            size_t count = std::stoul(inst.arg2->value);
+            bool has_params = body.size() >= count;
+            for (size_t i = 0; has_params && i < count; ++i)
+            {
+                has_params = body[body.size() - 1 - i].op == ir::OpCode::PARAM;
+            }
+
+            const ir::Function& callee = functions[callee_it->second];
+            std::vector<ir::Operand> args;
+            if (has_params)
+            {
+                for (size_t i = body.size() - count; i < body.size(); ++i)
+                    args.push_back(*body[i].arg1);
+            }
+
+            size_t caller_size = body.size() + caller.body.size() - position;
+            if (!has_params || !should_inline(callee, args, caller_size, graph))
+            {
+                body.push_back(std::move(inst));
+                continue;
+            }
+
+            body.resize(body.size() - count);
+            expand(program, callee, args, inst.result, body);
+            call_sites[callee.name]--;
+            inlined.insert(callee.name);
+        }
+
+        caller.body = std::move(body);
+    }
+
+    if (inlined.empty())
+        return false;
+
+    std::vector<ir::Function> remaining;
+    for (ir::Function& function : functions)
+    {
+        if (inlined.count(function.name) && call_sites[function.name] == 0)
+            continue;
+        remaining.push_back(std::move(function));
+    }
+
+    ir::join_functions(program, std::move(remaining));
+    return true;
+}
+
+bool Inliner::should_inline(const ir::Function& callee,
+                            const std::vector<ir::Operand>& args,
+                            size_t caller_size,
+                            const CallGraph& graph) const
+{
+    if (callee.is_main() || graph.is_recursive(callee.name))
+        return false;
+
+    // a tail call would leave the caller's frame rather than the callee's
+    for (const ir::Instruction& inst : callee.body)
+    {
+        if (inst.op == ir::OpCode::TAIL_CALL)
+            return false;
+    }
+    if (callee.parameters().size() != args.size())
+        return false;
+
+    size_t size = body_size(callee);
+    if (caller_size + size > max_caller_size)
+        return false;
+
+    // constant arguments usually fold away a good part of the body
+    int constant_args = 0;
+    for (const ir::Operand& arg : args)
+    {
+        if (arg.is_integer())
+            constant_args++;
+    }
+
+    int cost = int(size) - call_overhead(args.size()) - 2 * constant_args;
+    if (cost <= small_size)
+        return true;
+
+    auto sites = call_sites.find(callee.name);
+    return sites != call_sites.end() && sites->second == 1 &&
+           size <= size_t(single_site_size);
+}
+
+void Inliner::expand(ir::Program& program,
+                     const ir::Function& callee,
+                     const std::vector<ir::Operand>& args,
+                     const std::optional<ir::Operand>& result,
+                     std::vector<ir::Instruction>& out)
+{
+    // every local, temporary and label of the callee gets a fresh name
+    std::unordered_map<std::string, ir::Operand> renamed;
+    auto rename = [&](ir::Operand& op)
+    {
+        bool local = op.type == ir::OperandType::TEMPORARY ||
+                     op.type == ir::OperandType::LABEL ||
+                     (op.type == ir::OperandType::VARIABLE &&
+                      !program.is_global(op.name));
+        if (!local)
+            return;
+
+        auto it = renamed.find(op.name);
+        if (it == renamed.end())
+        {
+            ir::Operand fresh = op.type == ir::OperandType::TEMPORARY
+                                    ? program.new_temp()
+                                : op.type == ir::OperandType::LABEL
+                                    ? program.new_label(op.name + ".")
+                                    : program.new_variable(op.name);
+            it = renamed.emplace(op.name, fresh).first;
+        }
+        op = it->second;
+    };
+
+    ir::Operand end = program.new_label(callee.name + ".ret");
+
+    std::vector<std::string> params = callee.parameters();
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        ir::Operand param = ir::Operand::variable(params[i]);
+        rename(param);
+        out.push_back({ir::OpCode::ASSIGN, param, args[i], std::nullopt});
+    }
+
+    for (size_t i = 0; i < callee.body.size(); ++i)
+    {
+        if (ir::is_function_entry(callee.body, i))
+            continue;
+
+        ir::Instruction inst = callee.body[i];
+        if (inst.op == ir::OpCode::PROLOGUE || inst.op == ir::OpCode::PARAM_BIND)
+            continue;
+
+        if (inst.result)
+            rename(*inst.result);
+        if (inst.arg1 && !inst.is_call())
+            rename(*inst.arg1);
+        if (inst.arg2)
+            rename(*inst.arg2);
+
+        if (inst.op == ir::OpCode::RETURN)
+        {
+            if (result)
+            {
+                ir::Operand value = inst.arg1 ? *inst.arg1 : ir::Operand::integer(0);
+                out.push_back({ir::OpCode::ASSIGN, result, value, std::nullopt});
+            }
+            out.push_back({ir::OpCode::JUMP, std::nullopt, end, std::nullopt});
+            continue;
+        }
+
+        if (inst.is_call())
+            call_sites[inst.arg1->name]++;
+
+        out.push_back(std::move(inst));
+    }
+
+    out.push_back({ir::OpCode::LABEL, std::nullopt, end, std::nullopt});
+}
+
+} // namespace opt
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../ir/function.hpp"
+#include "call_graph.hpp"
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace opt {
+
+// Replaces calls with a renamed copy of the callee's body. Small functions are
+// inlined everywhere and functions with a single call site are inlined into
+// it, as long as the caller stays within its size budget; recursive functions
+// are never inlined. Functions left without callers by inlining are removed.
+class Inliner {
+  public:
+    Inliner(int small_size, int single_site_size)
+        : small_size(small_size), single_site_size(single_site_size)
+    {
+    }
+
+    bool run(ir::Program& program);
+
+  private:
+    int small_size;       // callees up to this cost are inlined at every call
+    int single_site_size; // callees called once are inlined up to this size
+    std::unordered_map<std::string, int> call_sites;
+
+    bool should_inline(const ir::Function& callee,
+                       const std::vector<ir::Operand>& args,
+                       size_t caller_size,
+                       const CallGraph& graph) const;
+
+    void expand(ir::Program& program,
+                const ir::Function& callee,
+                const std::vector<ir::Operand>& args,
+                const std::optional<ir::Operand>& result,
+                std::vector<ir::Instruction>& out);
+};
+
+} // namespace opt
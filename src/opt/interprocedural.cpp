@@ -0,0 +1,469 @@
+#include "interprocedural.hpp"
+
+#include "call_graph.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace opt {
+
+namespace {
+
+// upper bound on whole-program rounds, each linear in the size of the program
+constexpr int max_rounds = 4;
+
+struct CallSite {
+    size_t function;    // index into the split program
+    size_t call;        // index of the CALL in that function's body
+    size_t first_param; // index of the PARAM of its first argument
+};
+
+// Every call of `callee`, or nullopt when one of them does not have exactly
+// `arity` arguments in the PARAMs right above it.
+std::optional<std::vector<CallSite>> find_call_sites(
+    const std::vector<ir::Function>& functions,
+    const CallGraph& graph,
+    const std::string& callee,
+    size_t arity)
+{
+    std::vector<CallSite> sites;
+    for (const CallGraph::CallSite& site : graph.calls_to(callee))
+    {
+        const std::vector<ir::Instruction>& body = functions[site.caller].body;
+        size_t count = std::stoul(body[site.call].arg2->value);
+        if (count != arity || count > site.call)
+            return std::nullopt;
+        for (size_t j = site.call - count; j < site.call; ++j)
+        {
+            if (body[j].op != ir::OpCode::PARAM)
+                return std::nullopt;
+        }
+        sites.push_back({site.caller, site.call, site.call - count});
+    }
+    return sites;
+}
+
+// The parameters to drop from one function, decided before any body changes.
+struct Removal {
+    size_t function;
+    std::vector<bool> removed;
+    // what a dropped parameter is assigned at the entry instead, if anything
+    std::vector<std::optional<ir::Operand>> values;
+    // dropped parameters nothing assigns, whose value replaces their uses
+    std::vector<bool> folded;
+};
+
+// The arguments dropped from the calls in one function's body.
+struct DroppedArguments {
+    std::unordered_set<size_t> params;
+    // the calls they belong to, with the number of arguments left
+    std::unordered_map<size_t, size_t> arities;
+};
+
+void drop_arguments(std::vector<ir::Instruction>& body, const DroppedArguments& dropped)
+{
+    std::vector<ir::Instruction> rewritten;
+    rewritten.reserve(body.size());
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+        if (dropped.params.count(i))
+            continue;
+        auto call = dropped.arities.find(i);
+        if (call != dropped.arities.end())
+            body[i].arg2 = ir::Operand::integer(int64_t(call->second));
+        rewritten.push_back(std::move(body[i]));
+    }
+    body = std::move(rewritten);
+}
+
+// Drops the parameters marked in `removal` from `function`. A dropped
+// parameter with a value is assigned that value at the entry instead.
+void remove_parameters(ir::Function& function, const Removal& removal)
+{
+    // renumber the remaining parameters
+    std::vector<int64_t> position(removal.removed.size());
+    int64_t next = 0;
+    for (size_t j = 0; j < removal.removed.size(); ++j)
+    {
+        position[j] = removal.removed[j] ? -1 : next++;
+    }
+
+    std::vector<ir::Instruction> rewritten;
+    std::vector<ir::Instruction> entry;
+    std::vector<std::string> params = function.parameters();
+    size_t entry_end = 0;
+    for (ir::Instruction& inst : function.body)
+    {
+        if (inst.op == ir::OpCode::PARAM_BIND)
+        {
+            size_t j = std::stoul(inst.arg2->value);
+            if (removal.removed[j])
+            {
+                if (removal.values[j])
+                    entry.push_back({ir::OpCode::ASSIGN,
+                                     inst.arg1,
+                                     removal.values[j],
+                                     std::nullopt});
+                continue;
+            }
+            inst.arg2 = ir::Operand::integer(position[j]);
+        }
+
+        rewritten.push_back(std::move(inst));
+        if (rewritten.back().op == ir::OpCode::PROLOGUE ||
+            rewritten.back().op == ir::OpCode::PARAM_BIND)
+            entry_end = rewritten.size();
+    }
+
+    rewritten.insert(rewritten.begin() + entry_end, entry.begin(), entry.end());
+    function.body = std::move(rewritten);
+
+    // a constant parameter nothing assigns is that constant everywhere
+    std::unordered_map<std::string, ir::Operand> constants;
+    for (size_t j = 0; j < params.size(); ++j)
+    {
+        if (removal.folded[j])
+            constants.emplace(params[j], *removal.values[j]);
+    }
+    if (constants.empty())
+        return;
+
+    for (ir::Instruction& inst : function.body)
+    {
+        for (ir::Operand* use : inst.uses())
+        {
+            if (use->type != ir::OperandType::VARIABLE)
+                continue;
+            auto constant = constants.find(use->name);
+            if (constant != constants.end())
+                *use = constant->second;
+        }
+    }
+}
+
+// true when calling `function` can be observed other than through its result
+bool has_side_effects(const ir::Function& function,
+                      const std::unordered_set<std::string>& pure,
+                      const ir::Program& program)
+{
+    std::unordered_map<std::string, size_t> labels;
+    for (size_t i = 0; i < function.body.size(); ++i)
+    {
+        if (function.body[i].op == ir::OpCode::LABEL)
+            labels[function.body[i].arg1->name] = i;
+    }
+
+    for (size_t i = 0; i < function.body.size(); ++i)
+    {
+        const ir::Instruction& inst = function.body[i];
+        switch (inst.op)
+        {
+        case ir::OpCode::PRINT:
+        case ir::OpCode::HALT:
+        case ir::OpCode::TAIL_CALL:
+            return true;
+        case ir::OpCode::CALL:
+            if (!pure.count(inst.arg1->name))
+                return true;
+            break;
+        case ir::OpCode::DIV: {
+            auto divisor = inst.arg2->as_integer();
+            if (!divisor || *divisor == 0 || *divisor == -1)
+                return true; // may fault
+            break;
+        }
+        default:
+            break;
+        }
+
+        // a loop may never finish
+        if (const ir::Operand* target = inst.jump_target())
+        {
+            auto label = labels.find(target->name);
+            if (label == labels.end() || label->second <= i)
+                return true;
+        }
+
+        const ir::Operand* def = inst.def();
+        if (def && def->type == ir::OperandType::VARIABLE &&
+            program.is_global(def->name))
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+bool InterproceduralPropagation::run(ir::Program& program)
+{
+    bool changed = false;
+    for (int round = 0; round < max_rounds; ++round)
+    {
+        std::vector<ir::Function> functions = ir::split_functions(program);
+        bool progress = propagate_returns(program, functions);
+        progress |= propagate_arguments(program, functions);
+        progress |= remove_dead_functions(functions);
+        if (!progress)
+            break;
+
+        ir::join_functions(program, std::move(functions));
+        changed = true;
+    }
+    return changed;
+}
+
+bool InterproceduralPropagation::remove_dead_functions(
+    std::vector<ir::Function>& functions)
+{
+    std::unordered_set<std::string> reachable =
+        CallGraph(functions).reachable_from_main();
+    size_t before = functions.size();
+    functions.erase(std::remove_if(functions.begin(),
+                                   functions.end(),
+                                   [&](const ir::Function& function)
+                                   { return !reachable.count(function.name); }),
+                    functions.end());
+    return functions.size() != before;
+}
+
+bool InterproceduralPropagation::propagate_arguments(
+    const ir::Program& program,
+    std::vector<ir::Function>& functions)
+{
+    // Every function is looked at against the bodies as they are, and the
+    // bodies are rewritten once at the end. Callers go before their callees,
+    // so that a constant parameter passed on is known to be one.
+    CallGraph graph(functions);
+    std::unordered_map<std::string, size_t> index;
+    for (size_t f = 0; f < functions.size(); ++f)
+    {
+        index[functions[f].name] = f;
+    }
+    std::vector<std::string> order = graph.bottom_up_order();
+
+    std::vector<Removal> removals;
+    std::unordered_map<size_t, DroppedArguments> dropped;
+    // the parameters of each function that become constants
+    std::unordered_map<size_t, std::unordered_map<std::string, ir::Operand>> constants;
+    for (auto name = order.rbegin(); name != order.rend(); ++name)
+    {
+        size_t f = index.at(*name);
+        const ir::Function& function = functions[f];
+        std::vector<std::string> params = function.parameters();
+        if (function.is_main() || params.empty() ||
+            std::find(params.begin(), params.end(), "") != params.end())
+            continue;
+
+        auto sites = find_call_sites(functions, graph, function.name, params.size());
+        if (!sites || sites->empty())
+            continue;
+
+        std::unordered_map<std::string, int> reads;
+        std::unordered_map<std::string, int> writes;
+        for (const ir::Instruction& inst : function.body)
+        {
+            for (const ir::Operand* use : inst.uses())
+            {
+                reads[use->name]++;
+            }
+            if (inst.op != ir::OpCode::PARAM_BIND && inst.def())
+                writes[inst.def()->name]++;
+        }
+
+        Removal removal{f,
+                        std::vector<bool>(params.size(), false),
+                        std::vector<std::optional<ir::Operand>>(params.size()),
+                        std::vector<bool>(params.size(), false)};
+        for (size_t j = 0; j < params.size(); ++j)
+        {
+            ir::Operand param = ir::Operand::variable(params[j]);
+            if (!reads[param.name])
+            {
+                removal.removed[j] = true;
+                continue;
+            }
+
+            // The entry can read the argument itself when it is a constant or
+            // a global: nothing runs between the call and the entry.
+            std::optional<ir::Operand> value;
+            bool same = true;
+            bool passed_on = false;
+            for (const CallSite& site : *sites)
+            {
+                const ir::Instruction& passing =
+                    functions[site.function].body[site.first_param + j];
+                const ir::Operand* arg = &*passing.arg1;
+                if (site.function == f && *arg == param)
+                {
+                    passed_on = true;
+                    continue;
+                }
+
+                // a constant parameter of the caller passes that constant
+                auto caller = constants.find(site.function);
+                if (caller != constants.end() && arg->type == ir::OperandType::VARIABLE)
+                {
+                    auto constant = caller->second.find(arg->name);
+                    if (constant != caller->second.end())
+                        arg = &constant->second;
+                }
+
+                bool invariant = arg->is_integer() ||
+                                 (arg->type == ir::OperandType::VARIABLE &&
+                                  program.is_global(arg->name));
+                if (!invariant || (value && !(*value == *arg)))
+                {
+                    same = false;
+                    break;
+                }
+                value = *arg;
+            }
+
+            // a recursive call passing the parameter on passes the same value
+            // only if the parameter is never assigned, and a global may have
+            // changed by the time of the recursive call
+            if (!same || !value ||
+                (passed_on && (writes[param.name] || !value->is_integer())))
+                continue;
+
+            removal.removed[j] = true;
+            removal.folded[j] = value->is_integer() && !writes[param.name];
+            if (removal.folded[j])
+                constants[f].emplace(param.name, *value);
+            removal.values[j] = std::move(value);
+        }
+
+        if (std::find(removal.removed.begin(), removal.removed.end(), true) ==
+            removal.removed.end())
+            continue;
+
+        size_t remaining =
+            std::count(removal.removed.begin(), removal.removed.end(), false);
+        for (const CallSite& site : *sites)
+        {
+            DroppedArguments& arguments = dropped[site.function];
+            for (size_t j = 0; j < params.size(); ++j)
+            {
+                if (removal.removed[j])
+                    arguments.params.insert(site.first_param + j);
+            }
+            arguments.arities[site.call] = remaining;
+        }
+        removals.push_back(std::move(removal));
+    }
+
+    // the calls first, while the indices of their PARAMs still hold
+    for (const auto& [f, arguments] : dropped)
+    {
+        drop_arguments(functions[f].body, arguments);
+    }
+    for (const Removal& removal : removals)
+    {
+        remove_parameters(functions[removal.function], removal);
+    }
+    return !removals.empty();
+}
+
+bool InterproceduralPropagation::propagate_returns(
+    const ir::Program& program,
+    std::vector<ir::Function>& functions)
+{
+    CallGraph graph(functions);
+    std::unordered_map<std::string, const ir::Function*> by_name;
+    for (const ir::Function& function : functions)
+    {
+        by_name[function.name] = &function;
+    }
+
+    // callees first, so that calls to pure functions are known to be pure
+    std::unordered_set<std::string> pure;
+    for (const std::string& name : graph.bottom_up_order())
+    {
+        auto function = by_name.find(name);
+        if (function != by_name.end() && !graph.is_recursive(name) &&
+            !has_side_effects(*function->second, pure, program))
+            pure.insert(name);
+    }
+
+    std::unordered_map<std::string, ir::Operand> constant_returns;
+    for (const ir::Function& function : functions)
+    {
+        if (function.is_main())
+            continue;
+
+        std::optional<int64_t> value;
+        bool constant = true;
+        for (const ir::Instruction& inst : function.body)
+        {
+            if (inst.op == ir::OpCode::TAIL_CALL)
+                constant = false;
+            if (inst.op != ir::OpCode::RETURN)
+                continue;
+
+            // a bare return yields 0, in the backends as in the inliner
+            auto returned =
+                inst.arg1 ? inst.arg1->as_integer() : std::optional<int64_t>(0);
+            if (!returned || (value && *value != *returned))
+                constant = false;
+            value = returned;
+        }
+
+        if (constant && value)
+            constant_returns.emplace(function.name, ir::Operand::integer(*value));
+    }
+
+    if (constant_returns.empty())
+        return false;
+
+    bool changed = false;
+    for (ir::Function& function : functions)
+    {
+        std::vector<ir::Instruction> rewritten;
+        rewritten.reserve(function.body.size());
+
+        for (ir::Instruction& inst : function.body)
+        {
+            auto constant = inst.op == ir::OpCode::CALL
+                                ? constant_returns.find(inst.arg1->name)
+                                : constant_returns.end();
+            if (constant == constant_returns.end())
+            {
+                rewritten.push_back(std::move(inst));
+                continue;
+            }
+
+            size_t count = std::stoul(inst.arg2->value);
+            bool has_params = rewritten.size() >= count;
+            for (size_t i = 0; has_params && i < count; ++i)
+            {
+                has_params =
+                    rewritten[rewritten.size() - 1 - i].op == ir::OpCode::PARAM;
+            }
+
+            std::optional<ir::Operand> result = inst.result;
+            if (pure.count(inst.arg1->name) && has_params)
+            {
+                rewritten.resize(rewritten.size() - count);
+                changed = true;
+            }
+            else
+            {
+                inst.result.reset();
+                rewritten.push_back(std::move(inst));
+                changed |= result.has_value();
+            }
+
+            if (result)
+                rewritten.push_back(
+                    {ir::OpCode::ASSIGN, result, constant->second, std::nullopt});
+        }
+
+        function.body = std::move(rewritten);
+    }
+    return changed;
+}
+
+} // namespace opt
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../ir/function.hpp"
+
+#include <vector>
+
+namespace opt {
+
+// Whole-program cleanups over the call graph:
+//  - functions that main cannot reach are dropped,
+//  - a parameter that every call passes the same constant (or the same
+//    global) is assigned at the function's entry instead, and parameters the
+//    body never reads are removed, along with their arguments at each call,
+//  - calls to a function that always returns the same constant are replaced
+//    by that constant, or followed by it when the call has side effects.
+class InterproceduralPropagation {
+  public:
+    bool run(ir::Program& program);
+
+  private:
+    bool remove_dead_functions(std::vector<ir::Function>& functions);
+    bool propagate_arguments(const ir::Program& program,
+                             std::vector<ir::Function>& functions);
+    bool propagate_returns(const ir::Program& program,
+                           std::vector<ir::Function>& functions);
+};
+
+} // namespace opt
@@ -0,0 +1,171 @@
+#include "loop_info.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+namespace opt {
+
+namespace {
+
+bool falls_through(const ir::Instruction& inst)
+{
+    return inst.op != ir::OpCode::JUMP && inst.op != ir::OpCode::RETURN &&
+           inst.op != ir::OpCode::TAIL_CALL && inst.op != ir::OpCode::HALT;
+}
+
+} // namespace
+
+std::vector<Loop> find_loops(const std::vector<ir::Instruction>& code)
+{
+    std::unordered_map<std::string, size_t> labels;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].op == ir::OpCode::LABEL)
+        {
+            labels[code[i].arg1->name] = i;
+        }
+    }
+
+    // the furthest backward jump to each header closes its loop
+    std::unordered_map<size_t, size_t> latches;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        const ir::Operand* target = code[i].jump_target();
+        if (!target)
+            continue;
+
+        auto it = labels.find(target->name);
+        if (it != labels.end() && it->second < i)
+        {
+            latches[it->second] = i;
+        }
+    }
+
+    std::vector<Loop> loops;
+    for (auto [header, latch] : latches)
+    {
+        Loop loop{header, latch, header};
+
+        bool valid = true;
+        for (size_t i = header; i <= latch && valid; ++i)
+        {
+            // a loop never spans a function boundary
+            if (code[i].op == ir::OpCode::PROLOGUE || code[i].op == ir::OpCode::HALT)
+                valid = false;
+        }
+
+        // a jump right above the header that lands inside the loop is its
+        // entry; the preheader code then goes in front of that jump
+        const ir::Instruction* above = header > 0 ? &code[header - 1] : nullptr;
+        size_t entry_jump = code.size();
+        if (above && above->op == ir::OpCode::JUMP)
+        {
+            auto it = labels.find(above->arg1->name);
+            if (it == labels.end() || !loop.contains(it->second))
+                valid = false;
+            entry_jump = header - 1;
+            loop.preheader = header - 1;
+        }
+        else if (above && !falls_through(*above))
+        {
+            valid = false;
+        }
+
+        for (size_t i = 0; i < code.size() && valid; ++i)
+        {
+            if (loop.contains(i) || i == entry_jump)
+                continue;
+
+            const ir::Operand* target = code[i].jump_target();
+            if (!target)
+                continue;
+
+            auto it = labels.find(target->name);
+            if (it != labels.end() && loop.contains(it->second))
+                valid = false;
+        }
+
+        if (valid)
+        {
+            loops.push_back(loop);
+        }
+    }
+
+    std::sort(loops.begin(),
+              loops.end(),
+              [](const Loop& a, const Loop& b)
+              {
+                  if (a.latch - a.header != b.latch - b.header)
+                      return a.latch - a.header < b.latch - b.header;
+                  return a.header < b.header;
+              });
+    return loops;
+}
+
+std::optional<int64_t> step_of(const ir::Instruction& inst, const ir::Operand& var)
+{
+    if (inst.op == ir::OpCode::ADD)
+    {
+        if (*inst.arg1 == var && inst.arg2->is_integer())
+            return inst.arg2->as_integer();
+        if (*inst.arg2 == var && inst.arg1->is_integer())
+            return inst.arg1->as_integer();
+    }
+    else if (inst.op == ir::OpCode::SUB)
+    {
+        if (*inst.arg1 == var && inst.arg2->is_integer())
+            return int64_t(uint64_t(0) - uint64_t(*inst.arg2->as_integer()));
+    }
+    return std::nullopt;
+}
+
+std::optional<std::vector<std::pair<size_t, int64_t>>>
+induction_steps(const std::vector<ir::Instruction>& code,
+                const Loop& loop,
+                const ir::Operand& var)
+{
+    std::vector<std::pair<size_t, int64_t>> steps;
+    for (size_t i = loop.header; i <= loop.latch; ++i)
+    {
+        const ir::Operand* def = code[i].def();
+        if (!def || !(*def == var))
+            continue;
+
+        if (auto step = step_of(code[i], var))
+        {
+            steps.push_back({i, *step});
+            continue;
+        }
+
+        if (code[i].op != ir::OpCode::ASSIGN ||
+            code[i].arg1->type != ir::OperandType::TEMPORARY)
+            return std::nullopt;
+
+        // walk back through straight-line code to the temporary's definition
+        const ir::Operand& temp = *code[i].arg1;
+        std::optional<int64_t> step;
+        for (size_t j = i; j-- > loop.header;)
+        {
+            const ir::Instruction& prev = code[j];
+            if (prev.op == ir::OpCode::LABEL || prev.is_jump())
+                break;
+
+            const ir::Operand* prev_def = prev.def();
+            if (prev_def && *prev_def == temp)
+            {
+                step = step_of(prev, var);
+                break;
+            }
+            if (prev_def && *prev_def == var)
+                break;
+        }
+
+        if (!step)
+            return std::nullopt;
+        steps.push_back({i, *step});
+    }
+    return steps;
+}
+
+} // namespace opt
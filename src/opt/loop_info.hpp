@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace opt {
+
+// A loop in the flat instruction list: everything from the header label up to
+// the last backward jump that targets it.
+struct Loop {
+    size_t header;    // index of the header LABEL
+    size_t latch;     // index of the backward jump to the header
+    size_t preheader; // insertion point for code that must run once before the loop
+
+    bool contains(size_t index) const { return index >= header && index <= latch; }
+};
+
+// Finds loops that can only be entered by falling into the header or through a
+// single jump placed right above it, which is the shape IRGenerator emits for
+// `while`. Inner loops come before the loops that enclose them.
+std::vector<Loop> find_loops(const std::vector<ir::Instruction>& code);
+
+// Constant step by which `inst` changes `var`, if it has the form var = var +/- c.
+std::optional<int64_t> step_of(const ir::Instruction& inst, const ir::Operand& var);
+
+// Collects every write to `var` inside the loop as (index, step) pairs. Both
+// `var = var + c` and the generator's `t = var + c; var = t` are accepted; any
+// other write means `var` is not an induction variable.
+std::optional<std::vector<std::pair<size_t, int64_t>>>
+induction_steps(const std::vector<ir::Instruction>& code,
+                const Loop& loop,
+                const ir::Operand& var);
+
+} // namespace opt
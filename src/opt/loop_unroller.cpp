@@ -0,0 +1,395 @@
+#include "loop_unroller.hpp"
+
+#include <limits>
+#include <unordered_map>
+
+namespace opt {
+
+namespace {
+
+// larger steps would make the distance covered by one unrolled iteration an
+// immediate the backend cannot encode
+constexpr int64_t max_step = int64_t(1) << 24;
+
+ir::Instruction make(ir::OpCode op,
+                     std::optional<ir::Operand> result,
+                     std::optional<ir::Operand> arg1,
+                     std::optional<ir::Operand> arg2 = std::nullopt)
+{
+    return {op, std::move(result), std::move(arg1), std::move(arg2)};
+}
+
+// Constant value of `op` when control reaches the loop entry at `entry`, as
+// far as the straight-line code leading up to it tells.
+std::optional<int64_t> value_on_entry(const std::vector<ir::Instruction>& code,
+                                      size_t entry,
+                                      const ir::Operand& op)
+{
+    if (auto value = op.as_integer())
+        return value;
+
+    for (size_t i = entry; i-- > 0;)
+    {
+        const ir::Instruction& inst = code[i];
+        if (inst.op == ir::OpCode::LABEL || inst.op == ir::OpCode::PROLOGUE ||
+            inst.is_jump() || inst.is_call())
+            return std::nullopt;
+
+        const ir::Operand* def = inst.def();
+        if (def && *def == op)
+            return inst.op == ir::OpCode::ASSIGN ? inst.arg1->as_integer()
+                                                 : std::nullopt;
+    }
+    return std::nullopt;
+}
+
+// Number of times the body runs when the counter starts at `start`, or nullopt
+// when the counter would wrap around before the test fails.
+std::optional<int64_t>
+count_trips(ir::OpCode relation, int64_t start, int64_t bound, int64_t step)
+{
+    using Wide = __int128;
+    Wide distance = Wide(bound) - Wide(start);
+    Wide trips = 0;
+
+    switch (relation)
+    {
+    case ir::OpCode::LT:
+        if (distance <= 0)
+            return 0;
+        if (step < 0)
+            return std::nullopt;
+        trips = (distance + step - 1) / step;
+        break;
+    case ir::OpCode::LE:
+        if (distance < 0)
+            return 0;
+        if (step < 0)
+            return std::nullopt;
+        trips = distance / step + 1;
+        break;
+    case ir::OpCode::GT:
+        if (distance >= 0)
+            return 0;
+        if (step > 0)
+            return std::nullopt;
+        trips = (-distance - step - 1) / -Wide(step);
+        break;
+    case ir::OpCode::GE:
+        if (distance > 0)
+            return 0;
+        if (step > 0)
+            return std::nullopt;
+        trips = -distance / -Wide(step) + 1;
+        break;
+    case ir::OpCode::NE:
+        if (distance % step != 0 || distance / step < 0)
+            return std::nullopt;
+        trips = distance / step;
+        break;
+    default:
+        return std::nullopt;
+    }
+
+    Wide last = Wide(start) + trips * step;
+    if (last < std::numeric_limits<int64_t>::min() ||
+        last > std::numeric_limits<int64_t>::max())
+        return std::nullopt;
+    return int64_t(trips);
+}
+
+} // namespace
+
+bool LoopUnroller::run(ir::Program& program)
+{
+    bool changed = false;
+    for (;;)
+    {
+        bool progress = false;
+        for (const Loop& loop : find_loops(program.get_instructions()))
+        {
+            const std::string& header =
+                program.get_instructions()[loop.header].arg1->name;
+            if (!visited.insert(header).second)
+                continue;
+
+            if (unroll(program, loop))
+            {
+                progress = true;
+                break; // indices are stale now, rediscover the loops
+            }
+        }
+
+        if (!progress)
+            break;
+        changed = true;
+    }
+    return changed;
+}
+
+bool LoopUnroller::unroll(ir::Program& program, const Loop& loop)
+{
+    auto counted = analyze(program.get_instructions(), loop);
+    if (!counted)
+        return false;
+
+    size_t body_size = counted->cond - loop.header - 1;
+    if (counted->trip_count && *counted->trip_count <= max_full_trip_count &&
+        size_t(*counted->trip_count) * body_size <= max_size)
+    {
+        unroll_fully(program, *counted, *counted->trip_count);
+        return true;
+    }
+
+    int copies = factor;
+    while (copies > 1 && size_t(copies) * body_size > max_size)
+    {
+        copies /= 2;
+    }
+    if (copies < 2)
+        return false;
+
+    // without a known trip count, only a test that fails once the counter
+    // passes the bound tells how many iterations are left
+    bool exact = counted->trip_count && *counted->trip_count % copies == 0;
+    if (!exact && counted->relation == ir::OpCode::NE)
+        return false;
+
+    unroll_by(program, *counted, copies);
+    return true;
+}
+
+std::optional<CountedLoop>
+LoopUnroller::analyze(const std::vector<ir::Instruction>& code, const Loop& loop)
+{
+    if (loop.header == 0 || loop.latch < loop.header + 2)
+        return std::nullopt;
+
+    size_t entry = loop.header - 1;
+    size_t cond = loop.latch - 1;
+    const ir::Instruction& test = code[loop.latch];
+    if (code[entry].op != ir::OpCode::JUMP || code[cond].op != ir::OpCode::LABEL ||
+        !ir::is_compare_branch(test.op) ||
+        code[entry].arg1->name != code[cond].arg1->name ||
+        test.result->name != code[loop.header].arg1->name)
+        return std::nullopt;
+
+    const std::string& header_label = code[loop.header].arg1->name;
+    const std::string& cond_label = code[cond].arg1->name;
+    size_t last_label = loop.header;
+
+    for (size_t i = loop.header + 1; i < cond; ++i)
+    {
+        const ir::Instruction& inst = code[i];
+
+        // a call may change the counter or the bound behind the loop's back
+        if (inst.is_call() || inst.op == ir::OpCode::PROLOGUE ||
+            inst.op == ir::OpCode::HALT)
+            return std::nullopt;
+
+        if (inst.op == ir::OpCode::LABEL)
+            last_label = i;
+
+        // a jump straight to the test skips the rest of the iteration
+        const ir::Operand* target = inst.jump_target();
+        if (target && (target->name == header_label || target->name == cond_label))
+            return std::nullopt;
+    }
+
+    auto defined_in_body = [&](const ir::Operand& op)
+    {
+        for (size_t i = loop.header + 1; i < cond; ++i)
+        {
+            const ir::Operand* def = code[i].def();
+            if (def && *def == op)
+                return true;
+        }
+        return false;
+    };
+
+    ir::OpCode relation = ir::compared_by(test.op);
+    ir::Operand counter = *test.arg1;
+    ir::Operand bound = *test.arg2;
+    if (!defined_in_body(counter))
+    {
+        std::swap(counter, bound);
+        relation = ir::mirror(relation);
+    }
+
+    if (relation == ir::OpCode::EQ || counter.type == ir::OperandType::CONSTANT ||
+        defined_in_body(bound))
+        return std::nullopt;
+
+    auto steps = induction_steps(code, loop, counter);
+    if (!steps || steps->size() != 1)
+        return std::nullopt;
+
+    // the update has to run on every iteration, so it must come after the
+    // last label of the body
+    auto [update, step] = steps->front();
+    if (update < last_label || step == 0 || step > max_step || step < -max_step)
+        return std::nullopt;
+
+    CountedLoop counted{loop, cond, counter, relation, bound, step, std::nullopt, {}};
+
+    auto start = value_on_entry(code, entry, counter);
+    auto limit = value_on_entry(code, entry, bound);
+    if (start && limit)
+        counted.trip_count = count_trips(relation, *start, *limit, step);
+
+    // The generator computes every temporary afresh in each iteration, so the
+    // copies can get temporaries of their own. A temporary read before it is
+    // written carries a value from the previous iteration and is shared.
+    std::unordered_set<std::string> seen;
+    for (size_t i = loop.header + 1; i < cond; ++i)
+    {
+        for (const ir::Operand* use : code[i].uses())
+        {
+            if (use->type == ir::OperandType::TEMPORARY)
+                seen.insert(use->name);
+        }
+
+        const ir::Operand* def = code[i].def();
+        if (def && def->type == ir::OperandType::TEMPORARY &&
+            seen.insert(def->name).second)
+            counted.local_temps.insert(def->name);
+    }
+
+    // a temporary that outlives the loop, such as an inlined return value,
+    // has to keep its name
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (i == loop.header + 1)
+            i = cond;
+
+        const ir::Operand* def = code[i].def();
+        if (def)
+            counted.local_temps.erase(def->name);
+        for (const ir::Operand* use : code[i].uses())
+        {
+            counted.local_temps.erase(use->name);
+        }
+    }
+
+    return counted;
+}
+
+void LoopUnroller::unroll_fully(ir::Program& program,
+                                const CountedLoop& counted,
+                                int64_t trip_count)
+{
+    const auto& code = program.get_instructions();
+    std::vector<ir::Instruction> out(code.begin(),
+                                     code.begin() + (counted.loop.header - 1));
+
+    for (int64_t trip = 0; trip < trip_count; ++trip)
+    {
+        append_body(program, counted, out);
+    }
+
+    out.insert(out.end(), code.begin() + (counted.loop.latch + 1), code.end());
+    program.get_instructions() = std::move(out);
+}
+
+void LoopUnroller::unroll_by(ir::Program& program,
+                             const CountedLoop& counted,
+                             int copies)
+{
+    const auto& code = program.get_instructions();
+    const Loop& loop = counted.loop;
+    std::vector<ir::Instruction> out(code.begin(), code.begin() + (loop.header - 1));
+
+    if (counted.trip_count && *counted.trip_count % copies == 0)
+    {
+        // the test fails exactly after a multiple of `copies` iterations, so
+        // it only has to run once per round of copies
+        out.insert(out.end(),
+                   code.begin() + (loop.header - 1),
+                   code.begin() + (loop.header + 1));
+        for (int copy = 0; copy < copies; ++copy)
+        {
+            append_body(program, counted, out);
+        }
+        out.insert(out.end(), code.begin() + counted.cond, code.end());
+        program.get_instructions() = std::move(out);
+        return;
+    }
+
+    ir::Operand rounds = program.new_label("unroll_start");
+    ir::Operand rounds_test = program.new_label("unroll_cond");
+    ir::Operand rounds_exit = program.new_label("unroll_exit");
+    ir::Operand remainder = *code[counted.cond].arg1;
+    ir::Operand limit = program.new_temp();
+    visited.insert(rounds.name);
+
+    // A round of copies may start while the counter still passes the test
+    // after its last copy, i.e. while counter + reach does. Moving reach over
+    // to the bound must not wrap around, otherwise no round can run at all.
+    int64_t reach = int64_t(copies - 1) * counted.step;
+    ir::OpCode wrapped = counted.step > 0 ? ir::OpCode::GT : ir::OpCode::LT;
+    out.push_back(
+        make(ir::OpCode::SUB, limit, counted.bound, ir::Operand::integer(reach)));
+    out.push_back(make(ir::branch_on(wrapped), rounds_exit, limit, counted.bound));
+    out.push_back(make(ir::OpCode::JUMP, std::nullopt, rounds_test));
+    out.push_back(make(ir::OpCode::LABEL, std::nullopt, rounds));
+    for (int copy = 0; copy < copies; ++copy)
+    {
+        append_body(program, counted, out);
+    }
+    out.push_back(make(ir::OpCode::LABEL, std::nullopt, rounds_test));
+    out.push_back(
+        make(ir::branch_on(counted.relation), rounds, counted.counter, limit));
+
+    // the original loop runs the iterations that do not fill a round
+    out.push_back(make(ir::OpCode::LABEL, std::nullopt, rounds_exit));
+    out.push_back(make(ir::OpCode::JUMP, std::nullopt, remainder));
+    out.insert(out.end(), code.begin() + loop.header, code.end());
+    program.get_instructions() = std::move(out);
+}
+
+void LoopUnroller::append_body(ir::Program& program,
+                               const CountedLoop& counted,
+                               std::vector<ir::Instruction>& out)
+{
+    const auto& code = program.get_instructions();
+    size_t first = counted.loop.header + 1;
+
+    // labels placed in the body and its own temporaries get fresh names per copy
+    std::unordered_map<std::string, ir::Operand> renamed;
+    for (size_t i = first; i < counted.cond; ++i)
+    {
+        if (code[i].op != ir::OpCode::LABEL)
+            continue;
+
+        const std::string& name = code[i].arg1->name;
+        ir::Operand fresh = program.new_label(name + ".");
+        if (visited.count(name))
+            visited.insert(fresh.name);
+        renamed.emplace(name, fresh);
+    }
+    for (const std::string& temp : counted.local_temps)
+    {
+        renamed.emplace(temp, program.new_temp());
+    }
+
+    auto rename = [&renamed](std::optional<ir::Operand>& op)
+    {
+        if (!op || (op->type != ir::OperandType::LABEL &&
+                    op->type != ir::OperandType::TEMPORARY))
+            return;
+        auto it = renamed.find(op->name);
+        if (it != renamed.end())
+            *op = it->second;
+    };
+
+    for (size_t i = first; i < counted.cond; ++i)
+    {
+        ir::Instruction inst = code[i];
+        rename(inst.result);
+        rename(inst.arg1);
+        rename(inst.arg2);
+        out.push_back(std::move(inst));
+    }
+}
+
+} // namespace opt
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+#include "loop_info.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace opt {
+
+// A `while` loop whose exit test compares an induction variable against a
+// loop-invariant bound:
+//
+//     goto cond
+//   header:
+//     body                 (updates `counter` by `step` exactly once)
+//   cond:
+//     if counter <relation> bound goto header
+struct CountedLoop {
+    Loop loop;
+    size_t cond; // index of the label in front of the exit test
+    ir::Operand counter;
+    ir::OpCode relation; // comparison with the counter on the left
+    ir::Operand bound;
+    int64_t step;
+    std::optional<int64_t> trip_count; // known when start and bound are constants
+    // temporaries computed afresh each iteration
+    std::unordered_set<std::string> local_temps;
+};
+
+// Unrolls counted loops. Loops with a small constant trip count are replaced
+// by that many copies of their body; other loops run `factor` copies of the
+// body per test, followed by the original loop for the remaining iterations.
+// No loop is unrolled beyond `max_size` instructions.
+class LoopUnroller {
+  public:
+    LoopUnroller(int factor, size_t max_size, int64_t max_full_trip_count)
+        : factor(factor), max_size(max_size), max_full_trip_count(max_full_trip_count)
+    {
+    }
+
+    bool run(ir::Program& program);
+
+  private:
+    bool unroll(ir::Program& program, const Loop& loop);
+    std::optional<CountedLoop> analyze(const std::vector<ir::Instruction>& code,
+                                       const Loop& loop);
+
+    void unroll_fully(ir::Program& program,
+                      const CountedLoop& counted,
+                      int64_t trip_count);
+    void unroll_by(ir::Program& program, const CountedLoop& counted, int copies);
+    void append_body(ir::Program& program,
+                     const CountedLoop& counted,
+                     std::vector<ir::Instruction>& out);
+
+    int factor;
+    size_t max_size;
+    int64_t max_full_trip_count;
+
+    // headers of loops that were already considered, including the loops
+    // created by unrolling
+    std::unordered_set<std::string> visited;
+};
+
+} // namespace opt
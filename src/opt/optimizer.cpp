@@ -0,0 +1,104 @@
+#include "optimizer.hpp"
+
+#include "block_layout.hpp"
+#include "branch_fusion.hpp"
+#include "cleanup.hpp"
+#include "global_demotion.hpp"
+#include "if_conversion.hpp"
+#include "inliner.hpp"
+#include "interprocedural.hpp"
+#include "loop_unroller.hpp"
+#include "specializer.hpp"
+#include "strength_reduction.hpp"
+#include "switch_formation.hpp"
+#include "tail_calls.hpp"
+#include "value_ranges.hpp"
+
+#include "../ir/function.hpp"
+
+namespace opt {
+
+void Optimizer::run(ir::Program& program)
+{
+    if (level < 1)
+        return;
+
+    // globals only one function uses are better off as its locals
+    GlobalDemotion global_demotion;
+    global_demotion.run(program);
+
+    Cleanup cleanup;
+    cleanup.run(program);
+
+    InterproceduralPropagation interprocedural;
+    if (interprocedural.run(program))
+        cleanup.run(program);
+
+    // -O1 only inlines bodies about as small as the call sequence they replace
+    Inliner inliner(level >= 2 ? 24 : 4, level >= 2 ? 250 : 0);
+    inliner.run(program);
+    cleanup.run(program);
+
+    if (level >= 2)
+    {
+        Specializer specializer(4, 200, 600);
+        if (specializer.run(program))
+            cleanup.run(program);
+    }
+
+    // inlining and cloning leave calls with fewer distinct arguments, and
+    // globals used by fewer functions
+    if (interprocedural.run(program) | global_demotion.run(program))
+        cleanup.run(program);
+
+    BranchFusion branch_fusion;
+    branch_fusion.run(program);
+
+    // if/else chains on one variable are dispatched on like a switch
+    SwitchFormation switch_formation;
+    if (switch_formation.run(program))
+        cleanup.run(program);
+
+    TailCalls tail_calls;
+    if (tail_calls.eliminate_recursion(program))
+        cleanup.run(program);
+
+    // the rest looks at one function at a time
+    std::vector<ir::Program> parts = ir::split_parts(program);
+    pool.for_each(parts.size(), [&](size_t i) { optimize_function(parts[i]); });
+    ir::merge_parts(program, std::move(parts));
+}
+
+void Optimizer::optimize_function(ir::Program& function)
+{
+    Cleanup cleanup;
+
+    // -O1 only unrolls loops that go away completely in a handful of copies
+    LoopUnroller unroller(level >= 2 ? 4 : 1,
+                          level >= 2 ? 128 : 16,
+                          level >= 2 ? 32 : 8);
+    if (unroller.run(function))
+        cleanup.run(function);
+
+    ValueRanges value_ranges;
+    if (value_ranges.run(function))
+        cleanup.run(function);
+
+    StrengthReduction strength_reduction;
+    strength_reduction.run(function);
+    cleanup.run(function);
+
+    // -O1 only converts branches around a single assignment
+    IfConversion if_conversion(level >= 2 ? 8 : 3);
+    if (if_conversion.run(function))
+        cleanup.run(function);
+
+    BlockLayout block_layout;
+    if (block_layout.run(function))
+        cleanup.run(function);
+
+    TailCalls tail_calls;
+    tail_calls.mark_sibling_calls(function);
+}
+
+} // namespace opt
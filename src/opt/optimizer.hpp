@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+#include "../support/thread_pool.hpp"
+
+namespace opt {
+
+// Runs the IR optimization pipeline selected by an optimization level:
+//   0 - no optimization, the IR is lowered exactly as generated
+//   1 - local rewrites that never grow the program noticeably
+//   2 - everything in level 1 plus the more aggressive transformations
+//
+// The interprocedural passes see the whole program; after them, the
+// functions are optimized independently of each other, in parallel on
+// `pool`. The result does not depend on the number of threads.
+class Optimizer {
+  public:
+    Optimizer(int level, support::ThreadPool& pool) : level(level), pool(pool) {}
+
+    void run(ir::Program& program);
+
+  private:
+    int level;
+    support::ThreadPool& pool;
+
+    // the passes that only look within `function`, a program of its own
+    void optimize_function(ir::Program& function);
+};
+
+} // namespace opt
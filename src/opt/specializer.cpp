@@ -0,0 +1,266 @@
+#include "specializer.hpp"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace opt {
+
+namespace {
+
+// a constant pattern has to recur at this many call sites to get a clone
+constexpr size_t min_sites = 2;
+
+struct Site {
+    size_t function; // index into the split program
+    size_t call;     // index of the CALL in that function's body
+};
+
+struct Candidate {
+    std::string callee;
+    Specializer::Pattern pattern;
+    std::vector<Site> sites;
+};
+
+size_t count_constants(const Specializer::Pattern& pattern)
+{
+    return std::count_if(pattern.begin(),
+                         pattern.end(),
+                         [](const std::optional<int64_t>& arg)
+                         { return arg.has_value(); });
+}
+
+} // namespace
+
+bool Specializer::run(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    std::unordered_map<std::string, size_t> index;
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        index[functions[i].name] = i;
+    }
+
+    // group the calls that pass constants by callee and constant arguments
+    std::map<std::pair<std::string, Pattern>, std::vector<Site>> patterns;
+    for (size_t f = 0; f < functions.size(); ++f)
+    {
+        const std::vector<ir::Instruction>& body = functions[f].body;
+        for (size_t i = 0; i < body.size(); ++i)
+        {
+            const ir::Instruction& inst = body[i];
+            auto callee = inst.op == ir::OpCode::CALL ? index.find(inst.arg1->name)
+                                                      : index.end();
+            if (callee == index.end() || functions[callee->second].is_main())
+                continue;
+
+            std::vector<std::string> params = functions[callee->second].parameters();
+            size_t count = std::stoul(inst.arg2->value);
+            if (count != params.size() || count > i)
+                continue;
+
+            Pattern pattern;
+            bool valid = true;
+            for (size_t arg = 0; arg < count && valid; ++arg)
+            {
+                const ir::Instruction& param = body[i - count + arg];
+                valid = param.op == ir::OpCode::PARAM && !params[arg].empty();
+                pattern.push_back(valid ? param.arg1->as_integer() : std::nullopt);
+            }
+
+            if (valid && count_constants(pattern) > 0)
+                patterns[{callee->first, pattern}].push_back({f, i});
+        }
+    }
+
+    std::vector<Candidate> candidates;
+    for (auto& [key, sites] : patterns)
+    {
+        if (sites.size() >= min_sites)
+            candidates.push_back({key.first, key.second, std::move(sites)});
+    }
+
+    // the most calls with the most constants first
+    std::stable_sort(candidates.begin(),
+                     candidates.end(),
+                     [](const Candidate& a, const Candidate& b)
+                     {
+                         return a.sites.size() * count_constants(a.pattern) >
+                                b.sites.size() * count_constants(b.pattern);
+                     });
+
+    std::unordered_map<std::string, int> clones;
+    std::unordered_map<size_t, std::unordered_map<size_t, const Candidate*>> redirects;
+    std::unordered_map<const Candidate*, std::string> clone_names;
+    std::vector<ir::Function> created;
+    size_t added = 0;
+
+    for (const Candidate& candidate : candidates)
+    {
+        const ir::Function& callee = functions[index[candidate.callee]];
+        size_t size = callee.body.size();
+        if (size > max_function_size || added + size > budget ||
+            clones[candidate.callee] >= max_clones)
+            continue;
+
+        std::string name = program.new_label(candidate.callee + ".spec").name;
+        created.push_back(clone(program, callee, candidate.pattern, name));
+        clone_names[&candidate] = name;
+        clones[candidate.callee]++;
+        added += size;
+
+        for (const Site& site : candidate.sites)
+        {
+            redirects[site.function][site.call] = &candidate;
+        }
+    }
+
+    if (created.empty())
+        return false;
+
+    // the redirected calls no longer pass the constant arguments
+    for (auto& [f, calls] : redirects)
+    {
+        std::vector<ir::Instruction>& body = functions[f].body;
+        std::vector<ir::Instruction> rewritten;
+        rewritten.reserve(body.size());
+
+        for (size_t i = 0; i < body.size(); ++i)
+        {
+            auto redirect = calls.find(i);
+            if (redirect == calls.end())
+            {
+                rewritten.push_back(std::move(body[i]));
+                continue;
+            }
+
+            const Pattern& pattern = redirect->second->pattern;
+            std::vector<ir::Instruction> params(rewritten.end() - pattern.size(),
+                                                rewritten.end());
+            rewritten.resize(rewritten.size() - pattern.size());
+            for (size_t arg = 0; arg < pattern.size(); ++arg)
+            {
+                if (!pattern[arg])
+                    rewritten.push_back(std::move(params[arg]));
+            }
+
+            ir::Instruction call = std::move(body[i]);
+            call.arg1 = ir::Operand::variable(clone_names[redirect->second]);
+            call.arg2 = ir::Operand::integer(
+                int64_t(pattern.size() - count_constants(pattern)));
+            rewritten.push_back(std::move(call));
+        }
+
+        body = std::move(rewritten);
+    }
+
+    for (ir::Function& function : created)
+    {
+        functions.push_back(std::move(function));
+    }
+
+    std::unordered_set<std::string> called;
+    for (const ir::Function& function : functions)
+    {
+        for (const ir::Instruction& inst : function.body)
+        {
+            if (inst.is_call())
+                called.insert(inst.arg1->name);
+        }
+    }
+
+    std::vector<ir::Function> remaining;
+    for (ir::Function& function : functions)
+    {
+        if (clones.count(function.name) && !called.count(function.name))
+            continue;
+        remaining.push_back(std::move(function));
+    }
+
+    ir::join_functions(program, std::move(remaining));
+    return true;
+}
+
+ir::Function Specializer::clone(ir::Program& program,
+                                const ir::Function& callee,
+                                const Pattern& pattern,
+                                const std::string& name)
+{
+    // every local, temporary and label of the clone gets a fresh name
+    std::unordered_map<std::string, ir::Operand> renamed;
+    auto rename = [&](ir::Operand& op)
+    {
+        bool local = op.type == ir::OperandType::TEMPORARY ||
+                     op.type == ir::OperandType::LABEL ||
+                     (op.type == ir::OperandType::VARIABLE &&
+                      !program.is_global(op.name));
+        if (!local)
+            return;
+
+        auto it = renamed.find(op.name);
+        if (it == renamed.end())
+        {
+            ir::Operand fresh = op.type == ir::OperandType::TEMPORARY
+                                    ? program.new_temp()
+                                : op.type == ir::OperandType::LABEL
+                                    ? program.new_label(op.name + ".")
+                                    : program.new_variable(op.name);
+            it = renamed.emplace(op.name, fresh).first;
+        }
+        op = it->second;
+    };
+
+    ir::Function specialized{name, {}};
+    specialized.body.push_back(
+        {ir::OpCode::LABEL, std::nullopt, ir::Operand::label(name), std::nullopt});
+    specialized.body.push_back(
+        {ir::OpCode::PROLOGUE, std::nullopt, std::nullopt, std::nullopt});
+
+    // the remaining parameters are renumbered, the constant ones assigned
+    std::vector<std::string> params = callee.parameters();
+    std::vector<ir::Instruction> constants;
+    int64_t position = 0;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        ir::Operand param = ir::Operand::variable(params[i]);
+        rename(param);
+        if (pattern[i])
+        {
+            constants.push_back({ir::OpCode::ASSIGN,
+                                 param,
+                                 ir::Operand::integer(*pattern[i]),
+                                 std::nullopt});
+        }
+        else
+        {
+            specialized.body.push_back({ir::OpCode::PARAM_BIND,
+                                        std::nullopt,
+                                        param,
+                                        ir::Operand::integer(position++)});
+        }
+    }
+    specialized.body.insert(specialized.body.end(), constants.begin(), constants.end());
+
+    for (size_t i = 0; i < callee.body.size(); ++i)
+    {
+        if (ir::is_function_entry(callee.body, i))
+            continue;
+
+        ir::Instruction inst = callee.body[i];
+        if (inst.op == ir::OpCode::PROLOGUE || inst.op == ir::OpCode::PARAM_BIND)
+            continue;
+
+        if (inst.result)
+            rename(*inst.result);
+        if (inst.arg1 && !inst.is_call())
+            rename(*inst.arg1);
+        if (inst.arg2)
+            rename(*inst.arg2);
+        specialized.body.push_back(std::move(inst));
+    }
+
+    return specialized;
+}
+
+} // namespace opt
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../ir/function.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace opt {
+
+// Clones functions for constant arguments that recur across call sites. The
+// clone assigns the constants to their parameters instead of taking them as
+// arguments, so cleanup can fold them into its body, and every call passing
+// the same constants is redirected to it. A function gets at most
+// `max_clones` clones, only functions up to `max_function_size` instructions
+// are cloned, and cloning stops once `budget` instructions have been added.
+// A function whose calls were all redirected is removed.
+class Specializer {
+  public:
+    // constant value of each argument, nullopt where the argument varies
+    using Pattern = std::vector<std::optional<int64_t>>;
+
+    Specializer(int max_clones, size_t max_function_size, size_t budget)
+        : max_clones(max_clones), max_function_size(max_function_size), budget(budget)
+    {
+    }
+
+    bool run(ir::Program& program);
+
+  private:
+    ir::Function clone(ir::Program& program,
+                       const ir::Function& callee,
+                       const Pattern& pattern,
+                       const std::string& name);
+
+    int max_clones;
+    size_t max_function_size;
+    size_t budget;
+};
+
+} // namespace opt
@@ -0,0 +1,424 @@
+#include "strength_reduction.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace opt {
+
+namespace {
+
+// upper bound on loop rewrites so that pathological nests cannot spin forever
+constexpr int max_induction_rounds = 64;
+
+struct Magic {
+    int64_t multiplier;
+    int shift;
+};
+
+// Magic multiplier and shift for signed division by `divisor` (|divisor| >= 2),
+// computed as in Hacker's Delight, section 10-4.
+Magic signed_magic(int64_t divisor)
+{
+    const uint64_t two63 = uint64_t(1) << 63;
+    uint64_t ad = divisor < 0 ? uint64_t(0) - uint64_t(divisor) : uint64_t(divisor);
+    uint64_t t = two63 + (uint64_t(divisor) >> 63);
+    uint64_t anc = t - 1 - t % ad;
+    int p = 63;
+    uint64_t q1 = two63 / anc;
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad;
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta;
+
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    int64_t multiplier = int64_t(q2 + 1);
+    if (divisor < 0)
+        multiplier = -multiplier;
+    return {multiplier, p - 64};
+}
+
+ir::Instruction make(ir::OpCode op,
+                     ir::Operand result,
+                     ir::Operand arg1,
+                     std::optional<ir::Operand> arg2 = std::nullopt)
+{
+    return {op, std::move(result), std::move(arg1), std::move(arg2)};
+}
+
+bool is_lea_factor(uint64_t factor)
+{
+    return factor == 3 || factor == 5 || factor == 9;
+}
+
+} // namespace
+
+bool StrengthReduction::run(ir::Program& program)
+{
+    bool changed = reduce_induction_variables(program);
+    changed |= reduce_arithmetic(program);
+    return changed;
+}
+
+bool StrengthReduction::reduce_induction_variables(ir::Program& program)
+{
+    bool changed = false;
+    for (int round = 0; round < max_induction_rounds; ++round)
+    {
+        bool progress = false;
+        for (const Loop& loop : find_loops(program.get_instructions()))
+        {
+            if (reduce_loop(program, loop))
+            {
+                progress = true;
+                break; // indices are stale now, rediscover the loops
+            }
+        }
+
+        if (!progress)
+            break;
+        changed = true;
+    }
+    return changed;
+}
+
+bool StrengthReduction::reduce_loop(ir::Program& program, const Loop& loop)
+{
+    auto& code = program.get_instructions();
+
+    // a call may assign any global, so no variable is known to be an induction
+    // variable across one
+    for (size_t i = loop.header; i <= loop.latch; ++i)
+    {
+        if (code[i].is_call())
+            return false;
+    }
+
+    // multiplications of a variable by a constant, grouped by variable
+    std::map<std::string, std::vector<size_t>> candidates;
+    for (size_t i = loop.header; i <= loop.latch; ++i)
+    {
+        const ir::Instruction& inst = code[i];
+        if (inst.op != ir::OpCode::MUL)
+            continue;
+
+        if (inst.arg1->type == ir::OperandType::VARIABLE && inst.arg2->is_integer())
+            candidates[inst.arg1->name].push_back(i);
+        else if (inst.arg2->type == ir::OperandType::VARIABLE &&
+                 inst.arg1->is_integer())
+            candidates[inst.arg2->name].push_back(i);
+    }
+
+    for (const auto& [name, multiplies] : candidates)
+    {
+        ir::Operand var = ir::Operand::variable(name);
+        auto steps = induction_steps(code, loop, var);
+        if (!steps)
+            continue;
+
+        std::vector<std::vector<ir::Instruction>> after(code.size());
+        std::vector<ir::Instruction> preheader;
+        std::unordered_map<int64_t, ir::Operand> recurrences;
+
+        for (size_t index : multiplies)
+        {
+            ir::Instruction& mul = code[index];
+            int64_t factor = mul.arg1->is_integer() ? *mul.arg1->as_integer()
+                                                    : *mul.arg2->as_integer();
+
+            auto it = recurrences.find(factor);
+            if (it == recurrences.end())
+            {
+                ir::Operand iv = program.new_temp();
+                it = recurrences.emplace(factor, iv).first;
+
+                preheader.push_back(
+                    make(ir::OpCode::MUL, iv, var, ir::Operand::integer(factor)));
+                for (auto [def, step] : *steps)
+                {
+                    int64_t delta = int64_t(uint64_t(step) * uint64_t(factor));
+                    after[def].push_back(
+                        make(ir::OpCode::ADD, iv, iv, ir::Operand::integer(delta)));
+                }
+            }
+
+            mul = make(ir::OpCode::ASSIGN, *mul.result, it->second);
+        }
+
+        std::vector<ir::Instruction> rewritten;
+        rewritten.reserve(code.size() + preheader.size() + steps->size());
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (i == loop.preheader)
+                rewritten.insert(rewritten.end(), preheader.begin(), preheader.end());
+            rewritten.push_back(std::move(code[i]));
+            rewritten.insert(rewritten.end(), after[i].begin(), after[i].end());
+        }
+        code = std::move(rewritten);
+        return true;
+    }
+
+    return false;
+}
+
+bool StrengthReduction::reduce_arithmetic(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+    std::vector<ir::Instruction> rewritten;
+    rewritten.reserve(code.size());
+    bool changed = false;
+
+    for (ir::Instruction& inst : code)
+    {
+        if (inst.op == ir::OpCode::MUL)
+        {
+            // keep the constant on the right
+            if (inst.arg1->is_integer() && !inst.arg2->is_integer())
+                std::swap(inst.arg1, inst.arg2);
+
+            if (auto factor = inst.arg2->as_integer();
+                factor && !inst.arg1->is_integer())
+            {
+                changed |= expand_multiply(program, inst, *factor, rewritten);
+                continue;
+            }
+        }
+        else if (inst.op == ir::OpCode::DIV || inst.op == ir::OpCode::UDIV)
+        {
+            if (auto divisor = inst.arg2->as_integer();
+                divisor && !inst.arg1->is_integer())
+            {
+                changed |= expand_divide(program, inst, *divisor, rewritten);
+                continue;
+            }
+        }
+
+        rewritten.push_back(std::move(inst));
+    }
+
+    code = std::move(rewritten);
+    return changed;
+}
+
+bool StrengthReduction::expand_multiply(ir::Program& program,
+                                        const ir::Instruction& inst,
+                                        int64_t factor,
+                                        std::vector<ir::Instruction>& out)
+{
+    const ir::Operand& result = *inst.result;
+    const ir::Operand& x = *inst.arg1;
+    uint64_t magnitude = factor < 0 ? uint64_t(0) - uint64_t(factor) : uint64_t(factor);
+
+    if (factor == 0)
+    {
+        out.push_back(make(ir::OpCode::ASSIGN, result, ir::Operand::integer(0)));
+        return true;
+    }
+    if (factor == 1)
+    {
+        out.push_back(make(ir::OpCode::ASSIGN, result, x));
+        return true;
+    }
+    if (factor == -1)
+    {
+        out.push_back(make(ir::OpCode::NEG, result, x));
+        return true;
+    }
+    if (is_lea_factor(uint64_t(factor)))
+    {
+        out.push_back(inst); // a single lea in the backend
+        return false;
+    }
+
+    // x * 2^s, including x * INT64_MIN, which is x << 63
+    if (std::has_single_bit(uint64_t(factor)))
+    {
+        int shift = std::countr_zero(uint64_t(factor));
+        out.push_back(make(ir::OpCode::SHL, result, x, ir::Operand::integer(shift)));
+        return true;
+    }
+
+    // x * -2^s
+    if (factor < 0 && std::has_single_bit(magnitude))
+    {
+        ir::Operand shifted = program.new_temp();
+        int shift = std::countr_zero(magnitude);
+        out.push_back(make(ir::OpCode::SHL, shifted, x, ir::Operand::integer(shift)));
+        out.push_back(make(ir::OpCode::NEG, result, shifted));
+        return true;
+    }
+
+    if (factor > 0)
+    {
+        // x * (2^s + 1) and x * (2^s - 1)
+        if (std::has_single_bit(magnitude - 1) || std::has_single_bit(magnitude + 1))
+        {
+            bool plus = std::has_single_bit(magnitude - 1);
+            int shift = std::countr_zero(plus ? magnitude - 1 : magnitude + 1);
+            ir::Operand shifted = program.new_temp();
+            out.push_back(
+                make(ir::OpCode::SHL, shifted, x, ir::Operand::integer(shift)));
+            out.push_back(
+                make(plus ? ir::OpCode::ADD : ir::OpCode::SUB, result, shifted, x));
+            return true;
+        }
+
+        // x * (m * 2^s) with m one of the lea factors
+        int shift = std::countr_zero(magnitude);
+        if (is_lea_factor(magnitude >> shift))
+        {
+            ir::Operand scaled = program.new_temp();
+            out.push_back(make(ir::OpCode::MUL,
+                               scaled,
+                               x,
+                               ir::Operand::integer(int64_t(magnitude >> shift))));
+            out.push_back(
+                make(ir::OpCode::SHL, result, scaled, ir::Operand::integer(shift)));
+            return true;
+        }
+    }
+
+    out.push_back(inst);
+    return false;
+}
+
+bool StrengthReduction::expand_divide(ir::Program& program,
+                                      const ir::Instruction& inst,
+                                      int64_t divisor,
+                                      std::vector<ir::Instruction>& out)
+{
+    const ir::Operand& result = *inst.result;
+    const ir::Operand& x = *inst.arg1;
+
+    // division by zero has to keep faulting at runtime, and INT64_MIN has no
+    // positive counterpart to work with
+    if (divisor == 0 || divisor == INT64_MIN)
+    {
+        out.push_back(inst);
+        return false;
+    }
+    if (divisor == 1)
+    {
+        out.push_back(make(ir::OpCode::ASSIGN, result, x));
+        return true;
+    }
+    if (divisor == -1)
+    {
+        out.push_back(make(ir::OpCode::NEG, result, x));
+        return true;
+    }
+
+    uint64_t magnitude =
+        divisor < 0 ? uint64_t(0) - uint64_t(divisor) : uint64_t(divisor);
+
+    // a non-negative dividend needs none of the rounding fixups below
+    bool unsigned_divide = inst.op == ir::OpCode::UDIV;
+
+    if (unsigned_divide && std::has_single_bit(magnitude))
+    {
+        int shift = std::countr_zero(magnitude);
+        out.push_back(make(ir::OpCode::SHR, result, x, ir::Operand::integer(shift)));
+        return true;
+    }
+
+    if (std::has_single_bit(magnitude))
+    {
+        // bias negative dividends by 2^k - 1 so the shift rounds toward zero
+        int shift = std::countr_zero(magnitude);
+        ir::Operand bias = program.new_temp();
+        if (shift == 1)
+        {
+            out.push_back(make(ir::OpCode::SHR, bias, x, ir::Operand::integer(63)));
+        }
+        else
+        {
+            ir::Operand sign = program.new_temp();
+            out.push_back(make(ir::OpCode::SAR, sign, x, ir::Operand::integer(63)));
+            out.push_back(
+                make(ir::OpCode::SHR, bias, sign, ir::Operand::integer(64 - shift)));
+        }
+
+        ir::Operand biased = program.new_temp();
+        out.push_back(make(ir::OpCode::ADD, biased, x, bias));
+
+        if (divisor > 0)
+        {
+            out.push_back(
+                make(ir::OpCode::SAR, result, biased, ir::Operand::integer(shift)));
+        }
+        else
+        {
+            ir::Operand quotient = program.new_temp();
+            out.push_back(
+                make(ir::OpCode::SAR, quotient, biased, ir::Operand::integer(shift)));
+            out.push_back(make(ir::OpCode::NEG, result, quotient));
+        }
+        return true;
+    }
+
+    Magic magic = signed_magic(divisor);
+
+    ir::Operand estimate = program.new_temp();
+    out.push_back(make(ir::OpCode::MULHI,
+                       estimate,
+                       x,
+                       ir::Operand::integer(magic.multiplier)));
+
+    if (divisor > 0 && magic.multiplier < 0)
+    {
+        ir::Operand corrected = program.new_temp();
+        out.push_back(make(ir::OpCode::ADD, corrected, estimate, x));
+        estimate = corrected;
+    }
+    else if (divisor < 0 && magic.multiplier > 0)
+    {
+        ir::Operand corrected = program.new_temp();
+        out.push_back(make(ir::OpCode::SUB, corrected, estimate, x));
+        estimate = corrected;
+    }
+
+    if (magic.shift > 0)
+    {
+        ir::Operand shifted = program.new_temp();
+        out.push_back(make(ir::OpCode::SAR,
+                           shifted,
+                           estimate,
+                           ir::Operand::integer(magic.shift)));
+        estimate = shifted;
+    }
+
+    if (unsigned_divide)
+    {
+        out.push_back(make(ir::OpCode::ASSIGN, result, estimate));
+        return true;
+    }
+
+    // add one when the estimate is negative to truncate toward zero
+    ir::Operand sign = program.new_temp();
+    out.push_back(make(ir::OpCode::SHR, sign, estimate, ir::Operand::integer(63)));
+    out.push_back(make(ir::OpCode::ADD, result, estimate, sign));
+    return true;
+}
+
+} // namespace opt
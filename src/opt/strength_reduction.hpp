@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+#include "loop_info.hpp"
+
+#include <vector>
+
+namespace opt {
+
+// Replaces multiplications and divisions by constants with cheaper shift, add
+// and multiply-high sequences, and turns `i * k` inside a loop into an additive
+// recurrence when `i` only ever changes by a constant step.
+class StrengthReduction {
+  public:
+    bool run(ir::Program& program);
+
+  private:
+    bool reduce_induction_variables(ir::Program& program);
+    bool reduce_loop(ir::Program& program, const Loop& loop);
+    bool reduce_arithmetic(ir::Program& program);
+
+    bool expand_multiply(ir::Program& program,
+                         const ir::Instruction& inst,
+                         int64_t factor,
+                         std::vector<ir::Instruction>& out);
+    bool expand_divide(ir::Program& program,
+                       const ir::Instruction& inst,
+                       int64_t divisor,
+                       std::vector<ir::Instruction>& out);
+};
+
+} // namespace opt
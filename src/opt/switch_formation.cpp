@@ -0,0 +1,137 @@
+#include "switch_formation.hpp"
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace opt {
+
+namespace {
+
+// the variable or temporary `inst` tests for inequality with a constant, as
+// in `if x != 3 goto L`, or nullptr
+const ir::Operand* tested_value(const ir::Instruction& inst)
+{
+    if (inst.op != ir::OpCode::JUMP_IF_NE)
+        return nullptr;
+    for (const auto& [value, constant] : {std::pair{&*inst.arg1, &*inst.arg2},
+                                          std::pair{&*inst.arg2, &*inst.arg1}})
+    {
+        if ((value->type == ir::OperandType::VARIABLE ||
+             value->type == ir::OperandType::TEMPORARY) &&
+            constant->is_integer())
+            return value;
+    }
+    return nullptr;
+}
+
+int64_t tested_constant(const ir::Instruction& inst)
+{
+    return inst.arg2->is_integer() ? *inst.arg2->as_integer()
+                                   : *inst.arg1->as_integer();
+}
+
+bool ends_block(const ir::Instruction& inst)
+{
+    return inst.op == ir::OpCode::JUMP || inst.op == ir::OpCode::RETURN ||
+           inst.op == ir::OpCode::TAIL_CALL || inst.op == ir::OpCode::HALT;
+}
+
+} // namespace
+
+bool SwitchFormation::run(ir::Program& program)
+{
+    auto& code = program.get_instructions();
+
+    std::unordered_map<std::string, size_t> label_at;
+    std::unordered_map<std::string, int> references;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].op == ir::OpCode::LABEL)
+            label_at[code[i].arg1->name] = i;
+        if (const ir::Operand* target = code[i].jump_target())
+            references[target->name]++;
+    }
+
+    // the tests of each chain by the index of its first one
+    std::unordered_map<size_t, std::vector<size_t>> chains;
+    std::unordered_set<size_t> chained;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        const ir::Operand* value = tested_value(code[i]);
+        if (!value || chained.count(i))
+            continue;
+
+        // follow the else branches while each starts with the next test
+        std::vector<size_t> tests = {i};
+        for (;;)
+        {
+            const std::string& target = code[tests.back()].result->name;
+            auto label = label_at.find(target);
+            if (label == label_at.end() || label->second <= tests.back() ||
+                references[target] != 1)
+                break;
+            size_t next = label->second + 1;
+            if (next >= code.size() || !ends_block(code[label->second - 1]))
+                break;
+            const ir::Operand* next_value = tested_value(code[next]);
+            if (!next_value || !(*next_value == *value))
+                break;
+            tests.push_back(next);
+        }
+
+        if (tests.size() < min_tests)
+            continue;
+        chained.insert(tests.begin(), tests.end());
+        chains.emplace(i, std::move(tests));
+    }
+    if (chains.empty())
+        return false;
+
+    std::vector<ir::Instruction> converted;
+    converted.reserve(code.size() + chains.size() * 2);
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        auto chain = chains.find(i);
+        if (chain == chains.end())
+        {
+            // the later tests of a chain go, leaving the else label in front
+            // of the code that ran when the test failed
+            if (!chained.count(i))
+                converted.push_back(std::move(code[i]));
+            continue;
+        }
+
+        const std::vector<size_t>& tests = chain->second;
+        const ir::Operand value = *tested_value(code[i]);
+        ir::Operand first_case = program.new_label("case");
+        converted.push_back(
+            ir::Instruction{ir::OpCode::JUMP_IF_EQ,
+                            first_case,
+                            value,
+                            ir::Operand::integer(tested_constant(code[i]))});
+        for (size_t k = 1; k < tests.size(); ++k)
+        {
+            // reached from the previous test alone, so it now leads to the case
+            const ir::Operand& case_label = *code[tests[k] - 1].arg1;
+            converted.push_back(
+                ir::Instruction{ir::OpCode::JUMP_IF_EQ,
+                                case_label,
+                                value,
+                                ir::Operand::integer(tested_constant(code[tests[k]]))});
+        }
+        const ir::Operand& otherwise = *code[tests.back()].result;
+        converted.push_back(
+            ir::Instruction{ir::OpCode::JUMP, std::nullopt, otherwise, std::nullopt});
+        converted.push_back(
+            ir::Instruction{ir::OpCode::LABEL, std::nullopt, first_case, std::nullopt});
+    }
+
+    code = std::move(converted);
+    return true;
+}
+
+} // namespace opt
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "../ir/tac.hpp"
+
+namespace opt {
+
+// Turns chains of if/else tests of one variable against constants into runs
+// of tests up front, the form a switch statement takes:
+//
+//     if x != 1 goto L1          if x == 1 goto C
+//     A                          if x == 2 goto L1
+//     goto end                   if x == 3 goto L2
+//   L1:                          goto L3
+//     if x != 2 goto L2        C:
+//     B                          A
+//     ...                        goto end
+//                              L1:
+//                                B ...
+//
+// The backend dispatches on such a run with a jump table or a binary search
+// instead of testing the cases one at a time. Only chains of at least
+// `min_tests` tests are converted, and only where each else branch starts
+// with the next test and is reached from nowhere else, so that no code runs
+// between two tests.
+class SwitchFormation {
+  public:
+    explicit SwitchFormation(size_t min_tests = 4) : min_tests(min_tests) {}
+
+    bool run(ir::Program& program);
+
+  private:
+    size_t min_tests;
+};
+
+} // namespace opt
@@ -0,0 +1,323 @@
+#include "tail_calls.hpp"
+
+#include <string>
+#include <unordered_map>
+
+namespace opt {
+
+namespace {
+
+// arguments beyond this are passed on the stack, which a jmp cannot hand over
+constexpr size_t max_register_args = 6;
+
+struct SelfCall {
+    size_t call;                   // index of the CALL
+    size_t resumes;                // index of the first instruction after the site
+    std::optional<ir::OpCode> op;  // accumulating operation, if not a plain tail call
+    std::optional<ir::Operand> operand; // the value combined with the call result
+};
+
+std::unordered_map<std::string, int>
+count_uses(const std::vector<ir::Instruction>& body)
+{
+    std::unordered_map<std::string, int> counts;
+    for (const ir::Instruction& inst : body)
+    {
+        for (const ir::Operand* use : inst.uses())
+        {
+            if (use->type != ir::OperandType::CONSTANT)
+                counts[use->name]++;
+        }
+    }
+    return counts;
+}
+
+int uses_of(const std::unordered_map<std::string, int>& counts, const ir::Operand& op)
+{
+    auto it = counts.find(op.name);
+    return it == counts.end() ? 0 : it->second;
+}
+
+// true when the CALL at `index` has its arguments in the PARAMs right above it
+bool has_params_above(const std::vector<ir::Instruction>& body, size_t index)
+{
+    size_t count = std::stoul(body[index].arg2->value);
+    if (index < count)
+        return false;
+    for (size_t i = index - count; i < index; ++i)
+    {
+        if (body[i].op != ir::OpCode::PARAM)
+            return false;
+    }
+    return true;
+}
+
+// true when the instruction after the call at `index` returns its result
+bool returns_result(const std::vector<ir::Instruction>& body,
+                    size_t index,
+                    const std::unordered_map<std::string, int>& uses)
+{
+    if (index + 1 >= body.size() || body[index + 1].op != ir::OpCode::RETURN)
+        return false;
+
+    const ir::Instruction& call = body[index];
+    const ir::Instruction& ret = body[index + 1];
+    if (!ret.arg1)
+        return !call.result || uses_of(uses, *call.result) == 0;
+    return call.result && *ret.arg1 == *call.result && uses_of(uses, *call.result) == 1;
+}
+
+ir::Instruction make(ir::OpCode op,
+                     std::optional<ir::Operand> result,
+                     std::optional<ir::Operand> arg1,
+                     std::optional<ir::Operand> arg2 = std::nullopt)
+{
+    return {op, std::move(result), std::move(arg1), std::move(arg2)};
+}
+
+} // namespace
+
+bool TailCalls::eliminate_recursion(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    CallGraph graph(functions);
+
+    bool changed = false;
+    for (ir::Function& function : functions)
+    {
+        if (!function.is_main() && graph.is_recursive(function.name))
+            changed |= eliminate(program, function, graph);
+    }
+
+    if (changed)
+        ir::join_functions(program, std::move(functions));
+    return changed;
+}
+
+bool TailCalls::eliminate(ir::Program& program,
+                          ir::Function& function,
+                          const CallGraph& graph)
+{
+    std::vector<ir::Instruction>& body = function.body;
+    std::vector<std::string> params = function.parameters();
+    for (const std::string& param : params)
+    {
+        if (param.empty())
+            return false; // a parameter without a binding cannot be rebound
+    }
+
+    auto uses = count_uses(body);
+    std::vector<SelfCall> sites;
+    bool other_self_calls = false;
+    bool returns_nothing = false;
+
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+        const ir::Instruction& inst = body[i];
+        if (inst.op == ir::OpCode::RETURN && !inst.arg1)
+            returns_nothing = true;
+
+        if (inst.op != ir::OpCode::CALL || inst.arg1->name != function.name)
+            continue;
+
+        if (std::stoul(inst.arg2->value) != params.size() || !has_params_above(body, i))
+        {
+            other_self_calls = true;
+            continue;
+        }
+
+        if (returns_result(body, i, uses))
+        {
+            sites.push_back({i, i + 2, std::nullopt, std::nullopt});
+            continue;
+        }
+
+        // result = value (+|*) f(...); return result
+        const ir::Instruction* combine = i + 1 < body.size() ? &body[i + 1] : nullptr;
+        const ir::Instruction* ret = i + 2 < body.size() ? &body[i + 2] : nullptr;
+        bool accumulates =
+            inst.result && combine && ret &&
+            (combine->op == ir::OpCode::ADD || combine->op == ir::OpCode::MUL) &&
+            ret->op == ir::OpCode::RETURN && ret->arg1 &&
+            *ret->arg1 == *combine->result && uses_of(uses, *inst.result) == 1 &&
+            uses_of(uses, *combine->result) == 1 &&
+            (*combine->arg1 == *inst.result) != (*combine->arg2 == *inst.result);
+
+        if (accumulates)
+        {
+            const ir::Operand& other =
+                *combine->arg1 == *inst.result ? *combine->arg2 : *combine->arg1;
+
+            // the value is read before the recursive call instead of after it,
+            // so it must be something the call cannot change
+            accumulates = other.type != ir::OperandType::VARIABLE ||
+                          !program.is_global(other.name);
+            if (accumulates)
+            {
+                sites.push_back({i, i + 3, combine->op, other});
+                continue;
+            }
+        }
+
+        other_self_calls = true;
+    }
+
+    std::optional<ir::OpCode> accumulator_op;
+    bool consistent = true;
+    for (const SelfCall& site : sites)
+    {
+        if (!site.op)
+            continue;
+        if (accumulator_op && *accumulator_op != *site.op)
+            consistent = false;
+        accumulator_op = site.op;
+    }
+
+    // Accumulating is only sound when no invocation of the function can
+    // observe another one's accumulator, i.e. every self call goes away.
+    bool accumulate = accumulator_op && consistent && !other_self_calls &&
+                      !returns_nothing && !graph.is_mutually_recursive(function.name);
+
+    bool any_tail_call = false;
+    for (const SelfCall& site : sites)
+    {
+        any_tail_call |= !site.op;
+    }
+    if (!any_tail_call && !accumulate)
+        return false;
+
+    size_t entry = 0;
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+        if (body[i].op == ir::OpCode::PROLOGUE || body[i].op == ir::OpCode::PARAM_BIND)
+            entry = i + 1;
+    }
+
+    ir::Operand restart = program.new_label(function.name + ".tail");
+    std::optional<ir::Operand> accumulator;
+    if (accumulate)
+        accumulator = program.new_variable("acc");
+
+    std::unordered_map<size_t, const SelfCall*> site_at;
+    for (const SelfCall& site : sites)
+    {
+        if (!site.op || accumulate)
+            site_at[site.call] = &site;
+    }
+
+    std::vector<ir::Instruction> rewritten;
+    rewritten.reserve(body.size() + 4);
+
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+        if (i == entry)
+        {
+            if (accumulator)
+            {
+                int64_t identity = *accumulator_op == ir::OpCode::MUL ? 1 : 0;
+                rewritten.push_back(make(ir::OpCode::ASSIGN,
+                                         accumulator,
+                                         ir::Operand::integer(identity)));
+            }
+            rewritten.push_back(make(ir::OpCode::LABEL, std::nullopt, restart));
+        }
+
+        auto site = site_at.find(i);
+        if (site != site_at.end())
+        {
+            const SelfCall& call = *site->second;
+
+            // rebind all parameters at once: arguments may read parameters
+            size_t count = params.size();
+            std::vector<ir::Operand> staged;
+            for (size_t j = rewritten.size() - count; j < rewritten.size(); ++j)
+            {
+                staged.push_back(*rewritten[j].arg1);
+            }
+            rewritten.resize(rewritten.size() - count);
+
+            if (call.op)
+            {
+                rewritten.push_back(
+                    make(*call.op, accumulator, accumulator, call.operand));
+            }
+
+            for (ir::Operand& value : staged)
+            {
+                if (value.type == ir::OperandType::CONSTANT)
+                    continue;
+                ir::Operand temp = program.new_temp();
+                rewritten.push_back(make(ir::OpCode::ASSIGN, temp, value));
+                value = temp;
+            }
+            for (size_t j = 0; j < count; ++j)
+            {
+                rewritten.push_back(make(ir::OpCode::ASSIGN,
+                                         ir::Operand::variable(params[j]),
+                                         staged[j]));
+            }
+            rewritten.push_back(make(ir::OpCode::JUMP, std::nullopt, restart));
+
+            i = call.resumes - 1;
+            continue;
+        }
+
+        if (accumulator && body[i].op == ir::OpCode::RETURN)
+        {
+            ir::Operand total = program.new_temp();
+            rewritten.push_back(
+                make(*accumulator_op, total, accumulator, body[i].arg1));
+            rewritten.push_back(make(ir::OpCode::RETURN, std::nullopt, total));
+            continue;
+        }
+
+        rewritten.push_back(body[i]);
+    }
+
+    if (entry == body.size())
+        rewritten.push_back(make(ir::OpCode::LABEL, std::nullopt, restart));
+
+    body = std::move(rewritten);
+    return true;
+}
+
+bool TailCalls::mark_sibling_calls(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    bool changed = false;
+
+    for (ir::Function& function : functions)
+    {
+        if (function.is_main())
+            continue;
+
+        std::vector<ir::Instruction>& body = function.body;
+        auto uses = count_uses(body);
+        std::vector<ir::Instruction> rewritten;
+        rewritten.reserve(body.size());
+
+        for (size_t i = 0; i < body.size(); ++i)
+        {
+            const ir::Instruction& inst = body[i];
+            if (inst.op == ir::OpCode::CALL &&
+                std::stoul(inst.arg2->value) <= max_register_args &&
+                returns_result(body, i, uses))
+            {
+                rewritten.push_back(
+                    make(ir::OpCode::TAIL_CALL, std::nullopt, inst.arg1, inst.arg2));
+                i++; // the RETURN
+                changed = true;
+                continue;
+            }
+            rewritten.push_back(inst);
+        }
+
+        body = std::move(rewritten);
+    }
+
+    if (changed)
+        ir::join_functions(program, std::move(functions));
+    return changed;
+}
+
+} // namespace opt
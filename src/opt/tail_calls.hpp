@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../ir/function.hpp"
+#include "call_graph.hpp"
+
+namespace opt {
+
+// Removes self recursion: a self call in tail position becomes a jump back to
+// the function entry with the parameters rebound, and linear recursion of the
+// form `return x + f(...)` or `return x * f(...)` is first given an
+// accumulator so that its calls are in tail position too.
+//
+// mark_sibling_calls() is meant to run last; it turns the remaining calls in
+// tail position into TAIL_CALL, which the backend lowers to a jmp.
+class TailCalls {
+  public:
+    bool eliminate_recursion(ir::Program& program);
+    bool mark_sibling_calls(ir::Program& program);
+
+  private:
+    bool eliminate(ir::Program& program,
+                   ir::Function& function,
+                   const CallGraph& graph);
+};
+
+} // namespace opt
@@ -0,0 +1,539 @@
+#include "value_ranges.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace opt {
+
+namespace {
+
+constexpr int64_t min_value = std::numeric_limits<int64_t>::min();
+constexpr int64_t max_value = std::numeric_limits<int64_t>::max();
+
+// a block whose entry ranges keep changing has the bounds that still move
+// widened to infinity, so that loops reach a fixed point quickly
+constexpr int widen_after = 3;
+
+struct Range {
+    int64_t lo = min_value;
+    int64_t hi = max_value;
+
+    bool is_full() const { return lo == min_value && hi == max_value; }
+    bool is_constant() const { return lo == hi; }
+    bool operator==(const Range& other) const = default;
+};
+
+// ranges at one program point; a value missing from the map can be anything
+using State = std::unordered_map<std::string, Range>;
+
+struct Block {
+    size_t begin;
+    size_t end; // one past the last instruction
+};
+
+// [lo, hi] when both ends fit in 64 bits; otherwise the computation may wrap
+// around and the result can be anything
+Range clamp(__int128 lo, __int128 hi)
+{
+    if (lo < min_value || hi > max_value)
+        return {};
+    return {int64_t(lo), int64_t(hi)};
+}
+
+bool is_value(const ir::Operand& op)
+{
+    return op.type == ir::OperandType::VARIABLE ||
+           op.type == ir::OperandType::TEMPORARY;
+}
+
+bool ends_block(const ir::Instruction& inst)
+{
+    return inst.is_jump() || inst.op == ir::OpCode::RETURN ||
+           inst.op == ir::OpCode::HALT || inst.op == ir::OpCode::TAIL_CALL;
+}
+
+bool falls_through(const ir::Instruction& inst)
+{
+    return inst.op != ir::OpCode::JUMP && inst.op != ir::OpCode::RETURN &&
+           inst.op != ir::OpCode::HALT && inst.op != ir::OpCode::TAIL_CALL;
+}
+
+Range range_of(const State& state, const ir::Operand& op)
+{
+    if (auto value = op.as_integer())
+        return {*value, *value};
+    if (is_value(op))
+    {
+        auto it = state.find(op.name);
+        if (it != state.end())
+            return it->second;
+    }
+    return {};
+}
+
+void set_range(State& state, const std::string& name, Range range)
+{
+    if (range.is_full())
+        state.erase(name);
+    else
+        state[name] = range;
+}
+
+// Outcome of `lhs <cmp> rhs` for all values in the two ranges, or nullopt
+// when it depends on the values.
+std::optional<bool> decide(ir::OpCode cmp, Range lhs, Range rhs)
+{
+    switch (cmp)
+    {
+    case ir::OpCode::LT:
+        if (lhs.hi < rhs.lo)
+            return true;
+        if (lhs.lo >= rhs.hi)
+            return false;
+        return std::nullopt;
+    case ir::OpCode::LE:
+        if (lhs.hi <= rhs.lo)
+            return true;
+        if (lhs.lo > rhs.hi)
+            return false;
+        return std::nullopt;
+    case ir::OpCode::GT:
+    case ir::OpCode::GE:
+        return decide(ir::mirror(cmp), rhs, lhs);
+    case ir::OpCode::EQ:
+        if (lhs.is_constant() && lhs == rhs)
+            return true;
+        if (lhs.hi < rhs.lo || rhs.hi < lhs.lo)
+            return false;
+        return std::nullopt;
+    case ir::OpCode::NE:
+        if (auto equal = decide(ir::OpCode::EQ, lhs, rhs))
+            return !*equal;
+        return std::nullopt;
+    default:
+        return std::nullopt;
+    }
+}
+
+// Range of the value `inst` assigns, given the ranges before it.
+Range evaluate_range(const ir::Instruction& inst, const State& state)
+{
+    using Wide = __int128;
+    Range a = inst.arg1 ? range_of(state, *inst.arg1) : Range{};
+    Range b = inst.arg2 ? range_of(state, *inst.arg2) : Range{};
+
+    switch (inst.op)
+    {
+    case ir::OpCode::ASSIGN:
+        return a;
+    case ir::OpCode::ADD:
+        return clamp(Wide(a.lo) + b.lo, Wide(a.hi) + b.hi);
+    case ir::OpCode::SUB:
+        return clamp(Wide(a.lo) - b.hi, Wide(a.hi) - b.lo);
+    case ir::OpCode::MUL: {
+        Wide products[] = {Wide(a.lo) * b.lo, Wide(a.lo) * b.hi, Wide(a.hi) * b.lo,
+                           Wide(a.hi) * b.hi};
+        return clamp(*std::min_element(std::begin(products), std::end(products)),
+                     *std::max_element(std::begin(products), std::end(products)));
+    }
+    case ir::OpCode::NEG:
+        return clamp(-Wide(a.hi), -Wide(a.lo));
+    case ir::OpCode::DIV:
+    case ir::OpCode::UDIV: {
+        // with the sign of the divisor fixed, the quotient is monotonic in
+        // each operand, so its extremes are at the corners; INT64_MIN / -1
+        // wraps around
+        bool sign_known = b.lo >= 1 || b.hi <= -1;
+        if (!sign_known || (a.lo == min_value && b.hi == -1))
+            return {};
+        int64_t quotients[] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+        return {*std::min_element(std::begin(quotients), std::end(quotients)),
+                *std::max_element(std::begin(quotients), std::end(quotients))};
+    }
+    case ir::OpCode::SAR: {
+        auto shift = inst.arg2->as_integer();
+        if (!shift || *shift < 0 || *shift > 63)
+            return {};
+        return {a.lo >> *shift, a.hi >> *shift};
+    }
+    case ir::OpCode::SHR: {
+        auto shift = inst.arg2->as_integer();
+        if (!shift || *shift < 1 || *shift > 63)
+            return {};
+        if (a.lo >= 0)
+            return {a.lo >> *shift, a.hi >> *shift};
+        return {0, int64_t(~uint64_t(0) >> *shift)};
+    }
+    case ir::OpCode::SELECT: {
+        Range c = range_of(state, *inst.arg3);
+        return {std::min(b.lo, c.lo), std::max(b.hi, c.hi)};
+    }
+    case ir::OpCode::NOT:
+        if (a.lo > 0 || a.hi < 0)
+            return {0, 0};
+        if (a == Range{0, 0})
+            return {1, 1};
+        return {0, 1};
+    case ir::OpCode::LT:
+    case ir::OpCode::GT:
+    case ir::OpCode::LE:
+    case ir::OpCode::GE:
+    case ir::OpCode::EQ:
+    case ir::OpCode::NE:
+        if (auto outcome = decide(inst.op, a, b))
+            return {*outcome, *outcome};
+        return {0, 1};
+    default:
+        return {};
+    }
+}
+
+// Effect of `inst` on the ranges.
+void transfer(const ir::Instruction& inst, State& state)
+{
+    // the callee may assign any variable
+    if (inst.is_call())
+    {
+        state.clear();
+        return;
+    }
+
+    const ir::Operand* def = inst.def();
+    if (!def || !is_value(*def))
+        return;
+
+    if (inst.op == ir::OpCode::PARAM_BIND)
+        state.erase(def->name);
+    else
+        set_range(state, def->name, evaluate_range(inst, state));
+}
+
+// Narrows the ranges of `lhs` and `rhs` to the values for which
+// `lhs <cmp> rhs` holds. Returns false when it cannot hold.
+bool assume(State& state,
+            ir::OpCode cmp,
+            const ir::Operand& lhs,
+            const ir::Operand& rhs)
+{
+    Range a = range_of(state, lhs);
+    Range b = range_of(state, rhs);
+
+    switch (cmp)
+    {
+    case ir::OpCode::GT:
+    case ir::OpCode::GE:
+        return assume(state, ir::mirror(cmp), rhs, lhs);
+    case ir::OpCode::LT:
+        if (b.hi == min_value || a.lo == max_value)
+            return false;
+        a.hi = std::min(a.hi, b.hi - 1);
+        b.lo = std::max(b.lo, a.lo + 1);
+        break;
+    case ir::OpCode::LE:
+        a.hi = std::min(a.hi, b.hi);
+        b.lo = std::max(b.lo, a.lo);
+        break;
+    case ir::OpCode::EQ:
+        a.lo = b.lo = std::max(a.lo, b.lo);
+        a.hi = b.hi = std::min(a.hi, b.hi);
+        break;
+    case ir::OpCode::NE:
+        if (a.is_constant() && a == b)
+            return false;
+        // only a constant at one end of the other range narrows it
+        if (b.is_constant() && a.lo == b.lo)
+            a.lo++;
+        else if (b.is_constant() && a.hi == b.lo)
+            a.hi--;
+        else if (a.is_constant() && b.lo == a.lo)
+            b.lo++;
+        else if (a.is_constant() && b.hi == a.lo)
+            b.hi--;
+        break;
+    default:
+        return true;
+    }
+
+    if (a.lo > a.hi || b.lo > b.hi)
+        return false;
+    if (is_value(lhs))
+        set_range(state, lhs.name, a);
+    if (is_value(rhs))
+        set_range(state, rhs.name, b);
+    return true;
+}
+
+// values known on both incoming paths, with the ranges of either
+State join(const State& lhs, const State& rhs)
+{
+    State joined;
+    for (const auto& [name, range] : lhs)
+    {
+        auto other = rhs.find(name);
+        if (other != rhs.end())
+        {
+            joined[name] = {std::min(range.lo, other->second.lo),
+                            std::max(range.hi, other->second.hi)};
+        }
+    }
+    return joined;
+}
+
+// `joined` with every bound that moved past `previous` pushed to infinity
+State widen(const State& previous, State joined)
+{
+    for (auto it = joined.begin(); it != joined.end();)
+    {
+        const Range& before = previous.at(it->first);
+        if (it->second.lo < before.lo)
+            it->second.lo = min_value;
+        if (it->second.hi > before.hi)
+            it->second.hi = max_value;
+
+        if (it->second.is_full())
+            it = joined.erase(it);
+        else
+            ++it;
+    }
+    return joined;
+}
+
+std::vector<Block> find_blocks(const std::vector<ir::Instruction>& code)
+{
+    std::vector<Block> blocks;
+    size_t begin = 0;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].op == ir::OpCode::LABEL && i > begin)
+        {
+            blocks.push_back({begin, i});
+            begin = i;
+        }
+        if (ends_block(code[i]))
+        {
+            blocks.push_back({begin, i + 1});
+            begin = i + 1;
+        }
+    }
+    if (begin < code.size())
+        blocks.push_back({begin, code.size()});
+    return blocks;
+}
+
+} // namespace
+
+bool ValueRanges::run(ir::Program& program)
+{
+    std::vector<ir::Function> functions = ir::split_functions(program);
+    bool changed = false;
+    for (ir::Function& function : functions)
+    {
+        changed |= run_function(function);
+    }
+
+    if (changed)
+        ir::join_functions(program, std::move(functions));
+    return changed;
+}
+
+bool ValueRanges::run_function(ir::Function& function)
+{
+    std::vector<ir::Instruction>& code = function.body;
+    std::vector<Block> blocks = find_blocks(code);
+    if (blocks.empty())
+        return false;
+
+    std::unordered_map<std::string, size_t> block_of;
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        if (code[blocks[b].begin].op == ir::OpCode::LABEL)
+            block_of[code[blocks[b].begin].arg1->name] = b;
+    }
+
+    // the ranges leaving block `b` along each of its edges, given those at its entry
+    auto edges = [&](size_t b, State state)
+    {
+        std::vector<std::pair<size_t, State>> out;
+        const Block& block = blocks[b];
+        for (size_t i = block.begin; i + 1 < block.end; ++i)
+        {
+            transfer(code[i], state);
+        }
+
+        const ir::Instruction& last = code[block.end - 1];
+        if (!ends_block(last))
+            transfer(last, state);
+
+        std::optional<State> taken;
+        std::optional<State> fallthrough;
+        if (last.op == ir::OpCode::JUMP_IF_FALSE || last.op == ir::OpCode::JUMP_IF_TRUE)
+        {
+            ir::Operand zero = ir::Operand::integer(0);
+            bool on_zero = last.op == ir::OpCode::JUMP_IF_FALSE;
+            taken = state;
+            fallthrough = state;
+            ir::OpCode when_taken = on_zero ? ir::OpCode::EQ : ir::OpCode::NE;
+            if (!assume(*taken, when_taken, *last.arg1, zero))
+                taken.reset();
+            if (!assume(*fallthrough, ir::negate(when_taken), *last.arg1, zero))
+                fallthrough.reset();
+        }
+        else if (ir::is_compare_branch(last.op))
+        {
+            ir::OpCode cmp = ir::compared_by(last.op);
+            taken = state;
+            fallthrough = state;
+            if (!assume(*taken, cmp, *last.arg1, *last.arg2))
+                taken.reset();
+            if (!assume(*fallthrough, ir::negate(cmp), *last.arg1, *last.arg2))
+                fallthrough.reset();
+        }
+        else if (last.op == ir::OpCode::JUMP)
+        {
+            taken = state;
+        }
+        else if (falls_through(last))
+        {
+            fallthrough = state;
+        }
+
+        if (const ir::Operand* target = last.jump_target(); target && taken)
+        {
+            auto it = block_of.find(target->name);
+            if (it != block_of.end())
+                out.emplace_back(it->second, std::move(*taken));
+        }
+        if (fallthrough && b + 1 < blocks.size())
+            out.emplace_back(b + 1, std::move(*fallthrough));
+        return out;
+    };
+
+    // ranges at the entry of each block; nullopt while no path reaches it
+    std::vector<std::optional<State>> entry(blocks.size());
+    std::vector<int> updates(blocks.size(), 0);
+    std::vector<bool> queued(blocks.size(), false);
+    std::deque<size_t> worklist{0};
+    entry[0] = State{};
+    queued[0] = true;
+
+    while (!worklist.empty())
+    {
+        size_t b = worklist.front();
+        worklist.pop_front();
+        queued[b] = false;
+
+        for (auto& [successor, state] : edges(b, *entry[b]))
+        {
+            if (!entry[successor])
+            {
+                entry[successor] = std::move(state);
+            }
+            else
+            {
+                State joined = join(*entry[successor], state);
+                if (joined == *entry[successor])
+                    continue;
+                if (++updates[successor] > widen_after)
+                    joined = widen(*entry[successor], std::move(joined));
+                entry[successor] = std::move(joined);
+            }
+
+            if (!queued[successor])
+            {
+                worklist.push_back(successor);
+                queued[successor] = true;
+            }
+        }
+    }
+
+    // rewrite each reachable block with the ranges that hold at each instruction
+    std::vector<ir::Instruction> rewritten;
+    rewritten.reserve(code.size());
+    bool changed = false;
+
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        if (!entry[b])
+        {
+            rewritten.insert(rewritten.end(),
+                             code.begin() + blocks[b].begin,
+                             code.begin() + blocks[b].end);
+            continue;
+        }
+
+        State state = std::move(*entry[b]);
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i)
+        {
+            ir::Instruction inst = std::move(code[i]);
+
+            for (ir::Operand* use : inst.uses())
+            {
+                Range range = range_of(state, *use);
+                if (is_value(*use) && range.is_constant())
+                {
+                    *use = ir::Operand::integer(range.lo);
+                    changed = true;
+                }
+            }
+
+            Range lhs = inst.arg1 ? range_of(state, *inst.arg1) : Range{};
+            Range rhs = inst.arg2 ? range_of(state, *inst.arg2) : Range{};
+            std::optional<bool> taken;
+            std::optional<ir::Operand> target;
+
+            if (inst.op == ir::OpCode::JUMP_IF_FALSE ||
+                inst.op == ir::OpCode::JUMP_IF_TRUE)
+            {
+                auto nonzero = decide(ir::OpCode::NE, lhs, Range{0, 0});
+                if (nonzero)
+                    taken = *nonzero == (inst.op == ir::OpCode::JUMP_IF_TRUE);
+                target = inst.arg2;
+            }
+            else if (ir::is_compare_branch(inst.op))
+            {
+                taken = decide(ir::compared_by(inst.op), lhs, rhs);
+                target = inst.result;
+            }
+            else if (ir::is_comparison(inst.op))
+            {
+                if (auto outcome = decide(inst.op, lhs, rhs))
+                {
+                    inst = {ir::OpCode::ASSIGN,
+                            inst.result,
+                            ir::Operand::integer(*outcome),
+                            std::nullopt};
+                    changed = true;
+                }
+            }
+            else if (inst.op == ir::OpCode::DIV && lhs.lo >= 0 && rhs.lo >= 1)
+            {
+                inst.op = ir::OpCode::UDIV;
+                changed = true;
+            }
+
+            if (taken)
+            {
+                if (*taken)
+                    rewritten.push_back(
+                        {ir::OpCode::JUMP, std::nullopt, target, std::nullopt});
+                changed = true;
+                continue;
+            }
+
+            transfer(inst, state);
+            rewritten.push_back(std::move(inst));
+        }
+    }
+
+    code = std::move(rewritten);
+    return changed;
+}
+
+} // namespace opt
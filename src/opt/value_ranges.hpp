@@ -0,0 +1,24 @@
+#pragma once
+
+#include "../ir/function.hpp"
+
+namespace opt {
+
+// Integer range analysis. Each function is analyzed over its basic blocks,
+// tracking an interval for every variable and temporary at block entry. The
+// interval of a value tested by a branch is narrowed along each of the
+// branch's edges, so facts established by a dominating test carry over into
+// the code it guards. The ranges are then used to:
+//  - fold comparisons and branches whose outcome they decide,
+//  - replace values known to be a single constant by that constant,
+//  - turn divisions with a non-negative dividend and a positive divisor into
+//    UDIV, which needs no sign handling.
+class ValueRanges {
+  public:
+    bool run(ir::Program& program);
+
+  private:
+    bool run_function(ir::Function& function);
+};
+
+} // namespace opt
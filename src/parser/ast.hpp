@@ -3,6 +3,7 @@
 #include "../lexer/token.hpp"
 #include "visitor.hpp"
 
+#include <cstdint>
 #include <vector>
 
 struct Expr {
@@ -130,6 +131,25 @@ struct WhileStmt : Stmt {
     void accept(StmtVisitor& visitor) override { visitor.visitWhileStmt(this); }
 };
 
+struct SwitchStmt : Stmt {
+    struct Case {
+        Token keyword;
+        int64_t value;
+        Stmt* body;
+    };
+
+    Expr* subject;
+    std::vector<Case> cases;
+    Stmt* defaultBranch; // can be nullptr
+
+    SwitchStmt(Expr* subj, std::vector<Case> caseList, Stmt* defaultBr)
+        : subject(subj), cases(std::move(caseList)), defaultBranch(defaultBr)
+    {
+    }
+
+    void accept(StmtVisitor& visitor) override { visitor.visitSwitchStmt(this); }
+};
+
 struct FunctionStmt : Stmt {
     Token name;
     std::vector<Token> parameters;
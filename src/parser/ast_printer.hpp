@@ -4,15 +4,18 @@
 #include <iostream>
 
 class AstPrinter : public ExprVisitor, public StmtVisitor {
+    std::ostream& out;
     int indent = 0;
 
     void printIndent()
     {
         for (int i = 0; i < indent; i++)
-            std::cout << "  ";
+            out << "  ";
     }
 
   public:
+    explicit AstPrinter(std::ostream& out = std::cout) : out(out) {}
+
     const std::string& tokenToString(TokenType type) const
     {
         static const std::string tokenStrings[] = {
@@ -25,7 +28,8 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
             "IDENTIFIER", "STRING",      "NUMBER",
 
             "VAR",        "FUNCTION",    "RETURN",     "PRINT",         "WHILE",
-            "IF",         "ELSE",        "TRUE",       "FALSE",         "NULL_TOK",
+            "IF",         "ELSE",        "SWITCH",     "CASE",          "DEFAULT",
+            "TRUE",       "FALSE",       "NULL_TOK",
 
             "EOF_TOK",    "INVALID"};
 
@@ -43,7 +47,7 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitBlockStmt(BlockStmt* stmt) override
     {
         printIndent();
-        std::cout << "Block\n";
+        out << "Block\n";
         indent++;
         for (auto s : stmt->statements)
             s->accept(*this);
@@ -53,17 +57,17 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitIfStmt(IfStmt* stmt) override
     {
         printIndent();
-        std::cout << "If\n";
+        out << "If\n";
         indent++;
 
         printIndent();
-        std::cout << "Condition:\n";
+        out << "Condition:\n";
         indent++;
         stmt->condition->accept(*this);
         indent--;
 
         printIndent();
-        std::cout << "Then:\n";
+        out << "Then:\n";
         indent++;
         stmt->thenBranch->accept(*this);
         indent--;
@@ -71,7 +75,7 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
         if (stmt->elseBranch)
         {
             printIndent();
-            std::cout << "Else:\n";
+            out << "Else:\n";
             indent++;
             stmt->elseBranch->accept(*this);
             indent--;
@@ -83,17 +87,17 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitWhileStmt(WhileStmt* stmt) override
     {
         printIndent();
-        std::cout << "While\n";
+        out << "While\n";
         indent++;
 
         printIndent();
-        std::cout << "Condition:\n";
+        out << "Condition:\n";
         indent++;
         stmt->condition->accept(*this);
         indent--;
 
         printIndent();
-        std::cout << "Body:\n";
+        out << "Body:\n";
         indent++;
         stmt->body->accept(*this);
         indent--;
@@ -101,10 +105,43 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
         indent--;
     }
 
+    void visitSwitchStmt(SwitchStmt* stmt) override
+    {
+        printIndent();
+        out << "Switch\n";
+        indent++;
+
+        printIndent();
+        out << "Subject:\n";
+        indent++;
+        stmt->subject->accept(*this);
+        indent--;
+
+        for (const auto& c : stmt->cases)
+        {
+            printIndent();
+            out << "Case " << c.value << ":\n";
+            indent++;
+            c.body->accept(*this);
+            indent--;
+        }
+
+        if (stmt->defaultBranch)
+        {
+            printIndent();
+            out << "Default:\n";
+            indent++;
+            stmt->defaultBranch->accept(*this);
+            indent--;
+        }
+
+        indent--;
+    }
+
     void visitReturnStmt(ReturnStmt* stmt) override
     {
         printIndent();
-        std::cout << "Return\n";
+        out << "Return\n";
         indent++;
         if (stmt->value)
         {
@@ -116,21 +153,21 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitFunctionStmt(FunctionStmt* stmt) override
     {
         printIndent();
-        std::cout << "Function " << stmt->name.value.value() << "\n";
+        out << "Function " << stmt->name.value.value() << "\n";
         indent++;
 
         printIndent();
-        std::cout << "Parameters:\n";
+        out << "Parameters:\n";
         indent++;
         for (const auto& param : stmt->parameters)
         {
             printIndent();
-            std::cout << param.value.value() << "\n";
+            out << param.value.value() << "\n";
         }
         indent--;
 
         printIndent();
-        std::cout << "Body:\n";
+        out << "Body:\n";
         indent++;
         stmt->body->accept(*this);
         indent--;
@@ -141,7 +178,7 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitExpressionStmt(ExpressionStmt* stmt) override
     {
         printIndent();
-        std::cout << "ExprStmt\n";
+        out << "ExprStmt\n";
         indent++;
         stmt->expression->accept(*this);
         indent--;
@@ -150,7 +187,7 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitPrintStmt(PrintStmt* stmt) override
     {
         printIndent();
-        std::cout << "Print\n";
+        out << "Print\n";
         indent++;
         stmt->expression->accept(*this);
         indent--;
@@ -158,14 +195,14 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
 
     void visitVarStmt(VarStmt* stmt) override
     {
-        // std::cout << "visit var is where things went wrong\n";
+        // out << "visit var is where things went wrong\n";
         printIndent();
-        std::cout << "Var " << stmt->name.value.value() << "\n";
+        out << "Var " << stmt->name.value.value() << "\n";
         indent++;
         if (stmt->initializer)
         {
             printIndent();
-            std::cout << "Initializer:\n";
+            out << "Initializer:\n";
             indent++;
             stmt->initializer->accept(*this);
             indent--;
@@ -175,9 +212,9 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
 
     void visitBinaryExpr(BinaryExpr* expr) override
     {
-        // std::cout << "binary var is where things went wrong\n";
+        // out << "binary var is where things went wrong\n";
         printIndent();
-        std::cout << "Binary (" << tokenToString(expr->op.type) << ")\n";
+        out << "Binary (" << tokenToString(expr->op.type) << ")\n";
         indent++;
         expr->left->accept(*this);
         expr->right->accept(*this);
@@ -186,9 +223,9 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
 
     void visitUnaryExpr(UnaryExpr* expr) override
     {
-        // std::cout << "unary var is where things went wrong\n";
+        // out << "unary var is where things went wrong\n";
         printIndent();
-        std::cout << "Unary (" << expr->op.value.value() << ")\n";
+        out << "Unary (" << tokenToString(expr->op.type) << ")\n";
         indent++;
         expr->right->accept(*this);
         indent--;
@@ -196,23 +233,23 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
 
     void visitLiteralExpr(LiteralExpr* expr) override
     {
-        // std::cout << "literal var is where things went wrong\n";
+        // out << "literal var is where things went wrong\n";
         printIndent();
-        std::cout << "Literal " << expr->value.value.value() << "\n";
+        out << "Literal " << expr->value.value.value() << "\n";
     }
 
     void visitVariableExpr(VariableExpr* expr) override
     {
-        // std::cout << "variable var is where things went wrong\n";
+        // out << "variable var is where things went wrong\n";
         printIndent();
-        std::cout << "Variable " << expr->name.value.value() << "\n";
+        out << "Variable " << expr->name.value.value() << "\n";
     }
 
     void visitAssignmentExpr(AssignmentExpr* expr) override
     {
-        // std::cout << "assignment var is where things went wrong\n";
+        // out << "assignment var is where things went wrong\n";
         printIndent();
-        std::cout << "Assign " << expr->name.value.value() << "\n";
+        out << "Assign " << expr->name.value.value() << "\n";
         indent++;
         expr->value->accept(*this);
         indent--;
@@ -221,17 +258,17 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitCallExpr(CallExpr* expr) override
     {
         printIndent();
-        std::cout << "Call\n";
+        out << "Call\n";
         indent++;
 
         printIndent();
-        std::cout << "Callee:\n";
+        out << "Callee:\n";
         indent++;
         expr->callee->accept(*this);
         indent--;
 
         printIndent();
-        std::cout << "Args:\n";
+        out << "Args:\n";
         indent++;
         for (auto arg : expr->arguments)
             arg->accept(*this);
@@ -243,7 +280,7 @@ class AstPrinter : public ExprVisitor, public StmtVisitor {
     void visitGroupingExpr(GroupingExpr* expr) override
     {
         printIndent();
-        std::cout << "Group\n";
+        out << "Group\n";
         indent++;
         expr->expression->accept(*this);
         indent--;
@@ -1,5 +1,6 @@
 #include "parser.hpp"
 
+#include <charconv>
 #include <iostream>
 
 std::vector<Stmt*> Parser::parse()
@@ -51,6 +52,8 @@ Stmt* Parser::statement()
         return if_statement();
     if (match({TokenType::WHILE}))
         return while_statement();
+    if (match({TokenType::SWITCH}))
+        return switch_statement();
     if (match({TokenType::LEFT_BRACE}))
         return block();
 
@@ -139,6 +142,46 @@ Stmt* Parser::while_statement()
     return new WhileStmt{condition, body};
 }
 
+Stmt* Parser::switch_statement()
+{
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'switch'.");
+    Expr* subject = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after switch value.");
+    consume(TokenType::LEFT_BRACE, "Expect '{' before switch cases.");
+
+    std::vector<SwitchStmt::Case> cases;
+    Stmt* defaultBranch = nullptr;
+    while (!check(TokenType::RIGHT_BRACE) && !is_at_end())
+    {
+        if (match({TokenType::DEFAULT}))
+        {
+            Token keyword = previous();
+            consume(TokenType::LEFT_BRACE, "Expect '{' before default body.");
+            BlockStmt* body = block();
+            if (defaultBranch)
+            {
+                error(keyword, "A switch can only have one default.");
+                throw ParseError("Duplicate default.");
+            }
+            defaultBranch = body;
+            continue;
+        }
+
+        Token keyword =
+            consume(TokenType::CASE, "Expect 'case' or 'default' in switch.");
+        // a case value is an integer literal, possibly negated
+        bool negated = match({TokenType::MINUS});
+        Token number = consume(TokenType::NUMBER, "Expect a number after 'case'.");
+        int64_t value = integer(number, negated);
+
+        consume(TokenType::LEFT_BRACE, "Expect '{' before case body.");
+        cases.push_back({keyword, value, block()});
+    }
+
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after switch cases.");
+    return new SwitchStmt{subject, std::move(cases), defaultBranch};
+}
+
 Stmt* Parser::expression_statement()
 {
     Expr* expr = expression();
@@ -246,6 +289,18 @@ Expr* Parser::factor()
 
 Expr* Parser::unary()
 {
+    // a minus sign right before a number is part of the literal, so that the
+    // most negative integer can be written
+    if (check(TokenType::MINUS) && m_current + 1 < m_tokens.size() &&
+        m_tokens[m_current + 1].type == TokenType::NUMBER)
+    {
+        Token minus = advance();
+        Token number = advance();
+        integer(number, true);
+        std::string text = "-" + number.value.value();
+        return new LiteralExpr{{TokenType::NUMBER, text, minus.line, minus.column}};
+    }
+
     if (match({TokenType::BANG, TokenType::MINUS}))
     {
         Token op = previous();
@@ -305,7 +360,13 @@ Expr* Parser::primary()
     if (match({TokenType::NULL_TOK}))
         return new LiteralExpr{previous()};
 
-    if (match({TokenType::NUMBER, TokenType::STRING}))
+    if (match({TokenType::NUMBER}))
+    {
+        integer(previous(), false);
+        return new LiteralExpr{previous()};
+    }
+
+    if (match({TokenType::STRING}))
     {
         return new LiteralExpr{previous()};
     }
@@ -350,6 +411,7 @@ void Parser::synchronize()
         case TokenType::VAR:
         case TokenType::IF:
         case TokenType::WHILE:
+        case TokenType::SWITCH:
         case TokenType::PRINT:
         case TokenType::RETURN:
             return;
@@ -361,8 +423,23 @@ void Parser::synchronize()
     }
 }
 
+int64_t Parser::integer(const Token& number, bool negated)
+{
+    std::string digits = (negated ? "-" : "") + number.value.value();
+    int64_t value = 0;
+    auto [end, ec] =
+        std::from_chars(digits.data(), digits.data() + digits.size(), value);
+    if (ec != std::errc() || end != digits.data() + digits.size())
+    {
+        error(number, "Integer literal out of range.");
+        throw ParseError("Integer literal out of range.");
+    }
+    return value;
+}
+
 void Parser::error(const Token& token, const std::string& message)
 {
+    m_had_error = true;
     std::cerr << "[line " << token.line << "] Error at ";
     if (token.type == TokenType::EOF_TOK)
     {
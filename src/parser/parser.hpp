@@ -4,12 +4,15 @@
 #include "ast.hpp"
 #include "parse_error.hpp"
 
+#include <cstdint>
 #include <vector>
 
 class Parser {
   public:
     Parser(const std::vector<Token>& tokens) : m_tokens(tokens), m_current(0) {}
     std::vector<Stmt*> parse();
+    // whether any error was reported; the statements it was in are dropped
+    bool has_errors() const { return m_had_error; }
 
   private:
     Stmt* declaration();
@@ -21,6 +24,7 @@ class Parser {
     Stmt* print_statement();
     Stmt* if_statement();
     Stmt* while_statement();
+    Stmt* switch_statement();
     Stmt* expression_statement();
     BlockStmt* block();
 
@@ -38,6 +42,9 @@ class Parser {
     Token consume(TokenType type, const std::string& message);
     void synchronize();
     void error(const Token& token, const std::string& message);
+    // The value of the integer literal `number`, negated when a minus sign
+    // comes right before it. Reports an error when it does not fit in 64 bits.
+    int64_t integer(const Token& number, bool negated);
 
     bool match(const std::vector<TokenType>& types);
     bool check(TokenType type) const;
@@ -48,4 +55,5 @@ class Parser {
 
     const std::vector<Token>& m_tokens;
     size_t m_current;
+    bool m_had_error = false;
 };
\ No newline at end of file
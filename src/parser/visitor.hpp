@@ -12,6 +12,7 @@ struct ExpressionStmt;
 struct BlockStmt;
 struct IfStmt;
 struct WhileStmt;
+struct SwitchStmt;
 struct ReturnStmt;
 struct VarStmt;
 struct FunctionStmt;
@@ -34,6 +35,7 @@ struct StmtVisitor {
     virtual void visitBlockStmt(BlockStmt*) = 0;
     virtual void visitIfStmt(IfStmt*) = 0;
     virtual void visitWhileStmt(WhileStmt*) = 0;
+    virtual void visitSwitchStmt(SwitchStmt*) = 0;
     virtual void visitReturnStmt(ReturnStmt*) = 0;
     virtual void visitVarStmt(VarStmt*) = 0;
     virtual void visitFunctionStmt(FunctionStmt*) = 0;
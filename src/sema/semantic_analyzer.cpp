@@ -1,5 +1,8 @@
 #include "semantic_analyzer.hpp"
 
+#include <string>
+#include <unordered_set>
+
 void SemanticAnalyzer::analyze(const std::vector<Stmt*>& statements)
 {
     symbol_table.enter_scope(); // global scope
@@ -89,6 +92,26 @@ void SemanticAnalyzer::visitWhileStmt(WhileStmt* stmt)
     resolve(stmt->body);
 }
 
+void SemanticAnalyzer::visitSwitchStmt(SwitchStmt* stmt)
+{
+    resolve(stmt->subject);
+    std::unordered_set<int64_t> values;
+    for (const SwitchStmt::Case& c : stmt->cases)
+    {
+        // only the first of two equal cases could ever run
+        if (!values.insert(c.value).second)
+        {
+            error_handler.report(
+                c.keyword, "Duplicate case value " + std::to_string(c.value) + ".");
+        }
+        resolve(c.body);
+    }
+    if (stmt->defaultBranch != nullptr)
+    {
+        resolve(stmt->defaultBranch);
+    }
+}
+
 void SemanticAnalyzer::visitReturnStmt(ReturnStmt* stmt)
 {
     // or current_function == FunctionType::NONE both are fine
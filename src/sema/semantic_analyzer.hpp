@@ -26,6 +26,7 @@ class SemanticAnalyzer : public ExprVisitor, public StmtVisitor {
     void visitBlockStmt(BlockStmt* stmt) override;
     void visitIfStmt(IfStmt* stmt) override;
     void visitWhileStmt(WhileStmt* stmt) override;
+    void visitSwitchStmt(SwitchStmt* stmt) override;
     void visitReturnStmt(ReturnStmt* stmt) override;
     void visitVarStmt(VarStmt* stmt) override;
     void visitFunctionStmt(FunctionStmt* stmt) override;
@@ -0,0 +1,62 @@
+#include "output_file.hpp"
+
+namespace support {
+
+OutputFile::OutputFile(const std::string& path)
+{
+    if (path == "-")
+    {
+        file = stdout;
+    }
+    else
+    {
+        file = std::fopen(path.c_str(), "w");
+        owned = true;
+        // the writes are large already, so stdio need not buffer them again
+        if (file)
+            std::setvbuf(file, nullptr, _IONBF, 0);
+    }
+    buffer.reserve(capacity);
+}
+
+OutputFile::~OutputFile() { close(); }
+
+void OutputFile::write(std::string_view text)
+{
+    if (!file)
+        return;
+
+    if (buffer.size() + text.size() > capacity)
+    {
+        flush();
+        if (text.size() > capacity)
+        {
+            // too large to be worth copying
+            failed |= std::fwrite(text.data(), 1, text.size(), file) != text.size();
+            return;
+        }
+    }
+    buffer.insert(buffer.end(), text.begin(), text.end());
+}
+
+void OutputFile::flush()
+{
+    if (!buffer.empty())
+        failed |= std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size();
+    buffer.clear();
+}
+
+bool OutputFile::close()
+{
+    if (!file)
+        return false;
+
+    flush();
+    failed |= std::fflush(file) != 0;
+    if (owned)
+        failed |= std::fclose(file) != 0;
+    file = nullptr;
+    return !failed;
+}
+
+} // namespace support
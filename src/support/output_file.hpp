@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdio>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace support {
+
+// A file written through a large buffer of its own, "-" standing for stdout.
+//
+// Text is copied into the buffer and goes out in a few large writes, without
+// the formatting and per-character work of iostreams, so that even very long
+// outputs cost about as much as copying them once.
+class OutputFile {
+  public:
+    explicit OutputFile(const std::string& path);
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    bool is_open() const { return file != nullptr; }
+
+    void write(std::string_view text);
+    void write_line(std::string_view line)
+    {
+        write(line);
+        write("\n");
+    }
+
+    // writes out what is buffered and closes the file; false if any write failed
+    bool close();
+
+  private:
+    static constexpr size_t capacity = size_t(1) << 20;
+
+    std::FILE* file = nullptr;
+    bool owned = false; // not stdout
+    bool failed = false;
+    std::vector<char> buffer;
+
+    void flush();
+};
+
+// Lets what writes to an std::ostream write to an OutputFile:
+//
+//     OutputFileBuffer buffer(file);
+//     std::ostream out(&buffer);
+class OutputFileBuffer : public std::streambuf {
+  public:
+    explicit OutputFileBuffer(OutputFile& file) : file(file) {}
+
+  protected:
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            char character = traits_type::to_char_type(c);
+            file.write({&character, 1});
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* text, std::streamsize count) override
+    {
+        file.write({text, size_t(count)});
+        return count;
+    }
+
+  private:
+    OutputFile& file;
+};
+
+} // namespace support
@@ -0,0 +1,142 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace support {
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::for_each(size_t count, const std::function<void(size_t)>& run)
+{
+    if (workers.empty() || count <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            run(i);
+        }
+        return;
+    }
+
+    // each thread starts out with a contiguous share of the tasks
+    size_t threads = queues.size();
+    for (size_t t = 0; t < threads; ++t)
+    {
+        std::lock_guard<std::mutex> lock(queues[t]->mutex);
+        for (size_t i = t * count / threads; i < (t + 1) * count / threads; ++i)
+        {
+            queues[t]->tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &run;
+        busy = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        task = nullptr;
+        std::swap(error, failure);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void ThreadPool::work(size_t self)
+{
+    unsigned long seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        drain(self);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void ThreadPool::drain(size_t self)
+{
+    while (std::optional<size_t> index = next_task(self))
+    {
+        try
+        {
+            (*task)(*index);
+        } catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+}
+
+std::optional<size_t> ThreadPool::next_task(size_t self)
+{
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            size_t index = own.tasks.back();
+            own.tasks.pop_back();
+            return index;
+        }
+    }
+
+    for (size_t k = 1; k < queues.size(); ++k)
+    {
+        Queue& victim = *queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            size_t index = victim.tasks.front();
+            victim.tasks.pop_front();
+            return index;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace support
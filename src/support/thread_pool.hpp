@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace support {
+
+// A fixed set of threads running independent tasks in parallel.
+//
+// Work is shared out by work stealing: each thread has a queue of its own,
+// takes its tasks from the back of it and, once it is empty, steals from the
+// front of the others'. The thread calling for_each() works along with the
+// pool, so a pool of one thread runs everything on the caller, in order.
+class ThreadPool {
+  public:
+    // `threads` counts the caller; 0 stands for one per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return unsigned(queues.size()); }
+
+    // runs run(0) to run(count - 1) and returns once all of them are done;
+    // the first exception one of them throws is rethrown here
+    void for_each(size_t count, const std::function<void(size_t)>& run);
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    // one queue per thread, the caller's first
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)>* task = nullptr;
+    unsigned long generation = 0; // bumped for every batch of tasks
+    size_t busy = 0;              // workers not done with the current batch
+    bool stopping = false;
+    std::exception_ptr failure;
+
+    void work(size_t self);
+    // runs tasks until there are none left to take or steal
+    void drain(size_t self);
+    std::optional<size_t> next_task(size_t self);
+};
+
+} // namespace support
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Checks that compile time grows linearly with the size of the program: one
+# eight times longer than another must not take more than sixteen times as
+# long to compile. Run from the repository root, after building:
+#
+#   tests/compile_time.sh [path to neko]
+set -e
+
+neko=$(realpath "${1:-build/neko}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/build"
+cd "$dir"
+
+# a program of $1 statements that all go into one function
+generate() {
+    echo "function f(x) { return x + 1; }"
+    echo "var a = 1;"
+    i=0
+    while [ $i -lt "$1" ]; do
+        echo "a = f(a) * 3 - $i;"
+        [ $((i % 3)) -eq 0 ] && echo "print a;"
+        i=$((i + 1))
+    done
+    return 0
+}
+
+# the time in milliseconds to compile $1 at $2
+compile_time() {
+    start=$(date +%s%N)
+    "$neko" "$2" --emit=asm "$dir/$1" >/dev/null
+    end=$(date +%s%N)
+    echo $(((end - start) / 1000000 + 1))
+}
+
+generate 2000 >small.ne
+generate 16000 >large.ne
+for level in -O0 -O1 -O2; do
+    small=$(compile_time small.ne $level)
+    large=$(compile_time large.ne $level)
+    echo "$level: 2000 statements in ${small} ms, 16000 in ${large} ms"
+    if [ "$large" -gt $((small * 16)) ]; then
+        echo "compile time grows faster than the program at $level" >&2
+        exit 1
+    fi
+done